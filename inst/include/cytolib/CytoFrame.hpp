@@ -44,6 +44,27 @@ struct KEY_WORDS_SIMPLE{
 			KEY_WORDS_SIMPLE(const char * k, const char * v):key(k),value(v){};
 		};
 
+/**
+ * The storage layout of the events dataset when writing the cytoframe to h5
+ *
+ * The default keeps the legacy layout, i.e. one chunk per channel without any filter.
+ * The row-block chunks (chunk_rows > 0) allow the row subset to be read without touching the entire columns
+ * and are required for the efficient compression.
+ */
+struct H5WriteOptions{
+	hsize_t chunk_cols;//the number of channels per chunk
+	hsize_t chunk_rows;//the number of events per chunk, 0 means all the events
+	bool shuffle;//byte shuffle filter, which improves the compression ratio of the float data
+	int deflate_level;//gzip level (1-9) of the deflate filter, 0 disables the compression
+	bool double_precision;//store the events as float64 instead of float32, which are converted to EVENT_DATA_TYPE transparently when read
+	H5WriteOptions():chunk_cols(1), chunk_rows(0), shuffle(false), deflate_level(0), double_precision(false){};
+	bool operator==(const H5WriteOptions & other) const{
+		return chunk_cols == other.chunk_cols && chunk_rows == other.chunk_rows && shuffle == other.shuffle
+				&& deflate_level == other.deflate_level && double_precision == other.double_precision;
+	}
+	bool operator!=(const H5WriteOptions & other) const{return !(*this == other);}
+};
+
 class CytoFrame;
 typedef shared_ptr<CytoFrame> CytoFramePtr;
 struct KeyHash {
@@ -81,6 +102,12 @@ protected:
 	 *
 	 */
 	virtual void build_hash();
+	/**
+	 * make sure the keywords (or pheno data) are in memory before they are accessed,
+	 * which allows the backend to defer the loading until the first access
+	 */
+	virtual void ensure_keys_loaded() const{};
+	virtual void ensure_pheno_data_loaded() const{};
 public:
 	virtual ~CytoFrame(){};
 //	virtual void close_h5() =0;
@@ -97,7 +124,7 @@ public:
 	compensation get_compensation(const string & key = "$SPILLOVER")
 		{
 			compensation comp;
-
+			ensure_keys_loaded();
 			if(keys_.find(key)!=keys_.end())
 			{
 				if(g_loglevel>=GATING_HIERARCHY_LEVEL)
@@ -127,7 +154,8 @@ public:
 	virtual void convertToPb(pb::CytoFrame & fr_pb
 			, const string & cf_filename
 			, CytoFileOption h5_opt
-			, const CytoCtx & ctx = CytoCtx()) const = 0;
+			, const CytoCtx & ctx = CytoCtx()
+			, const H5WriteOptions & h5_write_opts = H5WriteOptions()) const = 0;
 
 	virtual void set_readonly(bool flag){
 	}
@@ -158,10 +186,11 @@ public:
 	CompType get_h5_datatype_keys() const;
 	virtual void write_h5_params(H5File file) const;
 	void write_to_disk(const string & filename, FileFormat format = FileFormat::H5
-				, const CytoCtx ctx = CytoCtx()) const
+				, const CytoCtx ctx = CytoCtx()
+				, const H5WriteOptions & h5_write_opts = H5WriteOptions()) const
 		{
 
-				write_h5(filename);
+				write_h5(filename, h5_write_opts);
 
 		}
 
@@ -221,8 +250,16 @@ public:
 	 * save the CytoFrame as HDF5 format
 	 *
 	 * @param filename the path of the output H5 file
+	 * @param h5_write_opts the chunk layout and filters of the events dataset
+	 */
+	virtual void write_h5(const string & filename, const H5WriteOptions & h5_write_opts = H5WriteOptions()) const;
+	/**
+	 * create the (empty) events dataset with the chunk layout and filters of h5_write_opts
+	 * @param file the h5 file to write to
+	 * @param nCol the number of columns
+	 * @param nEvents the number of rows
 	 */
-	virtual void write_h5(const string & filename) const;
+	DataSet create_h5_dataset(H5File file, hsize_t nCol, hsize_t nEvents, const H5WriteOptions & h5_write_opts) const;
 	/**
 	 * get the data of entire event matrix
 	 * @return
@@ -241,15 +278,37 @@ public:
 
 	virtual void set_data(const EVENT_DATA_VEC &)=0;
 	virtual void set_data(EVENT_DATA_VEC &&)=0;
+	/**
+	 * get the data of a single column
+	 */
+	EVENT_DATA_VEC get_column(unsigned idx) const
+	{
+		return get_data(uvec({idx}), true);
+	}
+	/**
+	 * update the selected columns only
+	 *
+	 * The disk-based backends write only the selected columns instead of the entire data matrix
+	 * @param col_idx the indices of the columns to be updated, which must be unique
+	 * @param cols the new data of these columns
+	 */
+	virtual void set_columns(uvec col_idx, const EVENT_DATA_VEC & cols)
+	{
+		EVENT_DATA_VEC dat = get_data();
+		dat.cols(col_idx) = cols;
+		set_data(dat);
+	}
 	/**
 	 * extract all the keyword pairs
 	 *
 	 * @return a vector of pairs of strings
 	 */
 	 virtual const KEY_WORDS & get_keywords() const{
+		ensure_keys_loaded();
 		return keys_;
 	}
 	 virtual void set_keywords(const KEY_WORDS & keys){
+			ensure_keys_loaded();
 			keys_ = keys;
 		}
 	/**
@@ -267,6 +326,7 @@ public:
 	 */
 	virtual void set_keyword(const string & key, const string & value)
 	{
+		ensure_keys_loaded();
 		keys_[key] = value;
 	}
 
@@ -277,11 +337,8 @@ public:
 	 */
 	virtual void rename_keyword(const string & old_key, const string & new_key)
 	{
-		KW_PAIR::iterator it = keys_.find(old_key);
-        if(it!=keys_.end())
-        	it->first = new_key;
-        else
-        	throw(domain_error("keyword not found: " + old_key));
+		ensure_keys_loaded();
+		keys_.rename(old_key, new_key);
 	}
 
 	/**
@@ -292,6 +349,7 @@ public:
 	 *	@param key keyword to be removed
 	 */
 	virtual void remove_keyword(const string & key){
+		ensure_keys_loaded();
 		keys_.erase(key);
 	}
 
@@ -342,6 +400,7 @@ public:
 			//update keywords(linear time, not sure how to improve it other than optionally skip it
 			if(is_update_keywords)
 			{
+				ensure_keys_loaded();
 				for(auto & it : keys_)
 					if(it.second == oldname)
 						it.second = newname;
@@ -500,16 +559,19 @@ public:
 	virtual void flush_meta(){};
 	virtual void load_meta(){};
 
-	const PDATA & get_pheno_data() const {return pheno_data_;}
+	const PDATA & get_pheno_data() const {ensure_pheno_data_loaded(); return pheno_data_;}
 	string get_pheno_data(const string & name) const ;
 	virtual void set_pheno_data(const string & name, const string & value){
+		ensure_pheno_data_loaded();
 		pheno_data_[name] = value;
 	}
 	virtual void set_pheno_data(const PDATA & _pd)
 	{
+		ensure_pheno_data_loaded();
 		pheno_data_ = _pd;
 	}
 	virtual void del_pheno_data(const string & name){
+		ensure_pheno_data_loaded();
 		pheno_data_.erase(name);}
 };
 };
@@ -116,7 +116,8 @@ public:
 	void convertToPb(pb::CytoFrame & fr_pb
 			, const string & cf_filename
 			, CytoFileOption h5_opt
-			, const CytoCtx & ctx = CytoCtx()) const{
+			, const CytoCtx & ctx = CytoCtx()
+			, const H5WriteOptions & h5_write_opts = H5WriteOptions()) const{
 		if(is_row_indexed_ || is_col_indexed_)
 		{
 			if(h5_opt == CytoFileOption::copy||h5_opt == CytoFileOption::move)
@@ -124,12 +125,15 @@ public:
 				//realize view
 				auto cfv = copy_realized(cf_filename, true);
 				//trigger archive logic on the new cfv (which will skip overwriting itself)
-				cfv.convertToPb(fr_pb, cf_filename, h5_opt, ctx);
+				cfv.convertToPb(fr_pb, cf_filename, h5_opt, ctx, h5_write_opts);
 				auto oldh5 = get_uri();
 				if(h5_opt == CytoFileOption::move&&oldh5!="")
 				{
 					if(!fs::equivalent(fs::path(oldh5), fs::path(cf_filename)))
+					{
+						H5FileCache::release(oldh5);
 						fs::remove_all(oldh5);
+					}
 
 				}
 			}
@@ -137,7 +141,7 @@ public:
 				throw(domain_error("Only 'copy' or 'move' option is supported for the indexed CytoFrameView object!"));
 		}
 		else
-			get_cytoframe_ptr()->convertToPb(fr_pb, cf_filename, h5_opt, ctx);
+			get_cytoframe_ptr()->convertToPb(fr_pb, cf_filename, h5_opt, ctx, h5_write_opts);
 
 	};
 	void set_channel(const string & oldname, const string &newname)
@@ -190,7 +194,8 @@ public:
 		return	get_cytoframe_ptr()->get_compensation(key);
 	}
 	void write_to_disk(const string & filename, FileFormat format = FileFormat::H5
-			, const CytoCtx ctx = CytoCtx()) const
+			, const CytoCtx ctx = CytoCtx()
+			, const H5WriteOptions & h5_write_opts = H5WriteOptions()) const
 	{
 		//create a mem-based cfv to avoid extra disk write IO from realization call
 		CytoFrameView cv(*this);
@@ -199,7 +204,7 @@ public:
 		auto cv1 = cv.copy_realized();
 		auto ptr = cv1.get_cytoframe_ptr();
 
-		ptr->write_to_disk(filename, format, ctx);
+		ptr->write_to_disk(filename, format, ctx, h5_write_opts);
 
 	}
 
@@ -0,0 +1,85 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * FCSEventStream.hpp
+ *
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_FCSEVENTSTREAM_HPP_
+#define INST_INCLUDE_CYTOLIB_FCSEVENTSTREAM_HPP_
+#include "MemCytoFrame.hpp"
+
+namespace cytolib
+{
+/**
+ * Iterate over the events of a FCS file in fixed-size blocks of rows
+ *
+ * Only one block of raw bytes (and the decoded block) is held in memory at a time,
+ * so that the files larger than the available memory can be processed (e.g. summarized or converted)
+ * without materializing the entire events matrix.
+ *
+ * The params and keywords are fully updated (e.g. the ranges and the transformation related keywords) once
+ * all the events are consumed, i.e. they are consistent with MemCytoFrame::read_fcs after next() returns false.
+ */
+class FCSEventStream{
+	MemCytoFrame frame_;//holds the header, keywords and params
+	FCSDataDecoder decoder_;
+	FCS_READ_DATA_PARAM config_;
+	size_t block_size_;
+	uint64_t nrow_;
+	uint64_t nrow_read_;
+	vector<EVENT_DATA_TYPE> realMin_;
+	bool is_finalized_;
+	ifstream in_;
+	unique_ptr<char []> buf_;
+	unique_ptr<MappedFileRange> mapped_;
+public:
+	/**
+	 * open the FCS file and parse its header and TEXT segment
+	 *
+	 * @param filename FCS file path
+	 * @param config the parse arguments. which_lines is not supported for streaming
+	 * @param block_size the number of rows of each block
+	 */
+	FCSEventStream(const string & filename, const FCS_READ_PARAM & config, size_t block_size = 65536);
+	FCSEventStream(const FCSEventStream &) = delete;
+	FCSEventStream & operator=(const FCSEventStream &) = delete;
+
+	/**
+	 * decode the next block of events
+	 *
+	 * @param block (output) the col-major events of the block, resized to the actual number of rows read
+	 * @return false when all the events have been consumed
+	 */
+	bool next(EVENT_DATA_VEC & block);
+	/**
+	 * convert the events to the h5 file by consuming the entire stream
+	 *
+	 * Each block is written to the h5 dataset while the next block is being decoded,
+	 * thus only two blocks are held in memory regardless of the size of the FCS file.
+	 * The params and keywords are written at the end once they are finalized.
+	 *
+	 * @param h5_filename the h5 file to write to
+	 * @param h5_write_opts the chunk layout and compression of the events dataset
+	 */
+	void write_h5(const string & h5_filename, const H5WriteOptions & h5_write_opts = H5WriteOptions());
+
+	uint64_t n_rows() const{return nrow_;}
+	unsigned n_cols() const{return decoder_.n_cols();}
+	/**
+	 * the number of events that have been returned so far
+	 */
+	uint64_t n_rows_read() const{return nrow_read_;}
+	bool is_exhausted() const{return nrow_read_ >= nrow_;}
+	size_t get_block_size() const{return block_size_;}
+	/**
+	 * the CytoFrame (without data) that carries the params and keywords
+	 */
+	const MemCytoFrame & get_frame() const{return frame_;}
+	const vector<cytoParam> & get_params() const{return frame_.get_params();}
+	const KEY_WORDS & get_keywords() const{return frame_.get_keywords();}
+};
+
+};
+
+#endif /* INST_INCLUDE_CYTOLIB_FCSEVENTSTREAM_HPP_ */
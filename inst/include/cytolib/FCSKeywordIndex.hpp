@@ -0,0 +1,48 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * FCSKeywordIndex.hpp
+ *
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_FCSKEYWORDINDEX_HPP_
+#define INST_INCLUDE_CYTOLIB_FCSKEYWORDINDEX_HPP_
+#include "MemCytoFrame.hpp"
+
+namespace cytolib
+{
+/**
+ * The keywords of a batch of FCS files in columnar layout
+ */
+struct FCSKeywordTable{
+	vector<string> files;
+	vector<string> keys;//the column names
+	vector<vector<string>> values;//values[k][i] is the value of keys[k] in files[i], which is empty when missing or failed to parse
+	vector<string> errors;//the error message of each file, which is empty when parsed successfully
+	size_t n_files() const{return files.size();}
+	size_t n_keys() const{return keys.size();}
+	/**
+	 * the column of the keyword
+	 */
+	const vector<string> & get_column(const string & key) const;
+};
+
+/**
+ * Index the keywords of multiple FCS files without reading their events
+ *
+ * Only HEADER and TEXT segments are read (see MemCytoFrame::read_fcs_header), and the files are
+ * distributed over a pool of threads. The failure of any file is recorded in FCSKeywordTable::errors
+ * instead of aborting the batch.
+ *
+ * @param files FCS file paths
+ * @param keys the keywords to be extracted. When empty, all the keywords are extracted
+ * 			and the columns are the union of the keywords in the order of their first occurrence
+ * @param config the parse arguments for header
+ * @param num_threads the number of files to be parsed concurrently
+ */
+FCSKeywordTable read_fcs_keywords(const vector<string> & files, const vector<string> & keys = {}
+									, const FCS_READ_HEADER_PARAM & config = FCS_READ_HEADER_PARAM(), int num_threads = 1);
+
+};
+
+#endif /* INST_INCLUDE_CYTOLIB_FCSKEYWORDINDEX_HPP_ */
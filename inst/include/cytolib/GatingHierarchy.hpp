@@ -140,7 +140,7 @@ public:
 	 */
 	void transform_data(MemCytoFrame & cytoframe);
 
-	void calgate(MemCytoFrame & cytoframe, VertexID u, bool computeTerminalBool, INTINDICES &parentIndice);
+	void calgate(MemCytoFrame & cytoframe, VertexID u, bool computeTerminalBool, const EVENT_BITSET &parentMask);
 	void extendGate(MemCytoFrame & cytoframe, float extend_val);
 
 	/**
@@ -165,7 +165,8 @@ public:
 	 */
 	void convertToPb(pb::GatingHierarchy & gh_pb, string uri, CytoFileOption h5_opt
 			, bool is_skip_data = false
-			, const CytoCtx & ctx = CytoCtx());
+			, const CytoCtx & ctx = CytoCtx()
+			, const H5WriteOptions & h5_write_opts = H5WriteOptions());
 	GatingHierarchy(CytoCtx ctx, pb::GatingHierarchy & pb_gh, string uri, bool is_skip_data
 			, bool readonly = true){
 			const pb::populationTree & tree_pb =  pb_gh.tree();
@@ -309,6 +310,10 @@ public:
 	 * transform gates
 	 */
 	void transform_gate();
+	/*
+	 * the transformations applied to the gates, i.e. the local ones except for the data-only ones
+	 */
+	trans_local get_gate_trans() const;
 
 	/*
 	 * Apply post-transformation shifts to gates (like for magnetic gates)
@@ -323,7 +328,7 @@ public:
 	 */
 	void gating(MemCytoFrame & cytoframe, VertexID u,bool recompute=false, bool computeTerminalBool=true, bool skip_faulty_node = false);
 	void gating(MemCytoFrame & cytoframe, VertexID u,bool recompute
-			, bool computeTerminalBool, bool skip_faulty_node, INTINDICES &parentIndice);
+			, bool computeTerminalBool, bool skip_faulty_node, const EVENT_BITSET &parentMask);
 	/*
 	 * bool gating operates on the indices of reference nodes
 	 * because they are global, thus needs to be combined with parent indices
@@ -333,6 +338,7 @@ public:
 	 */
 
 	vector<bool> boolGating(MemCytoFrame & cytoframe, VertexID u, bool computeTerminalBool);
+	EVENT_BITSET boolGatingMask(MemCytoFrame & cytoframe, VertexID u, bool computeTerminalBool);
 	/*
 	 * external boolOpSpec can be provided .
 	 * It is mainly used by openCyto rectRef gate
@@ -343,6 +349,7 @@ public:
 	 * @return
 	 */
 	vector<bool> boolGating(MemCytoFrame & cytoframe, vector<BOOL_GATE_OP> boolOpSpec, bool computeTerminalBool);
+	EVENT_BITSET boolGatingMask(MemCytoFrame & cytoframe, vector<BOOL_GATE_OP> boolOpSpec, bool computeTerminalBool);
 
 	/*
 	 * current output the graph in dot format
@@ -14,6 +14,7 @@
 #include "GatingHierarchy.hpp"
 #include <cytolib/CytoFrameView.hpp>
 #include <string>
+#include <future>
 #include <cytolib/delimitedMessage.hpp>
 #include <cytolib/global.hpp>
 
@@ -73,10 +74,12 @@ public:
 	 * separate filename from dir to avoid to deal with path parsing in c++
 	 * @param path the dir of filename
 	 * @param is_skip_data whether to skip writing cytoframe data to pb. It is typically remain as default unless for debug purpose (e.g. re-writing gs that is loaded from legacy pb archive without actual data associated)
+	 * @param h5_write_opts the chunk layout and filters of the h5 files written from the in-memory cytoframes
 	 */
 	void serialize_pb(string path, CytoFileOption h5_opt
 			, bool is_skip_data = false
-			, const CytoCtx & ctx = CytoCtx());
+			, const CytoCtx & ctx = CytoCtx()
+			, const H5WriteOptions & h5_write_opts = H5WriteOptions());
 	/**
 	 * constructor from the archives (de-serialization)
 	 * @param path
@@ -404,32 +407,80 @@ public:
 	void add_fcs(const vector<pair<string,string>> & sample_uid_vs_file_path
 			, const FCS_READ_PARAM & config, FileFormat fmt, string cf_dir
 			, bool readonly = false
-			, CytoCtx ctx = CytoCtx())
+			, CytoCtx ctx = CytoCtx()
+			, const H5WriteOptions & h5_write_opts = H5WriteOptions())
 	{
 
 		fs::path cf_path;
 		if(fmt!= FileFormat::MEM)
 			cf_path = generate_cytoframe_folder(cf_dir);
-		for(const auto & it : sample_uid_vs_file_path)
+		//parse a batch of config.data.num_files at a time concurrently
+		//while the frames are still written to disk one at a time
+		size_t nFile = sample_uid_vs_file_path.size();
+		size_t nConcurrent = max(config.data.num_files, 1);
+		/*
+		 * when parsing one file at a time, the h5 is converted from FCS by blocks (see FCSEventStream::write_h5)
+		 * instead of holding the entire events in memory
+		 * (the concurrent parsing has to stay in memory since h5 can't be written from multiple threads)
+		 */
+		if(fmt == FileFormat::H5 && nConcurrent == 1 && config.data.which_lines.empty())
 		{
+			for(const auto & it : sample_uid_vs_file_path)
+			{
+				string cf_filename = (cf_path/it.first).string() + "." + fmt_to_str(fmt);
+				FCSEventStream st(it.second, config);
+				st.write_h5(cf_filename, h5_write_opts);
+				add_cytoframe_view(it.first, CytoFrameView(load_cytoframe(cf_filename, readonly, ctx)));
+			}
+			return;
+		}
+		for(size_t i = 0; i < nFile; i += nConcurrent)
+		{
+			size_t iEnd = min(i + nConcurrent, nFile);
+			//the messages of each task are printed from this thread once it is done
+			vector<vector<string>> msgs(iEnd - i);
+			vector<future<CytoFramePtr>> parsed;
+			for(auto j = i; j < iEnd; j++)
+			{
+				string filename = sample_uid_vs_file_path[j].second;
+				vector<string> & task_msgs = msgs[j - i];
+				parsed.push_back(async(nConcurrent > 1?launch::async:launch::deferred, [&config, &task_msgs, filename](){
+					PrintBuffer buf(task_msgs);
+					CytoFramePtr fr_ptr(new MemCytoFrame(filename,config));
+					//set pdata
+					fr_ptr->set_pheno_data("name", path_base_name(filename));
+
+					dynamic_cast<MemCytoFrame&>(*fr_ptr).read_fcs();
+					return fr_ptr;
+				}));
+			}
 
+			for(auto j = i; j < iEnd; j++)
+			{
+				const auto & it = sample_uid_vs_file_path[j];
+				CytoFramePtr fr_ptr;
+				try
+				{
+					fr_ptr = parsed[j - i].get();
+				}
+				catch(...)
+				{
+					flush_prints(msgs[j - i]);
+					throw;
+				}
+				flush_prints(msgs[j - i]);
 
-			CytoFramePtr fr_ptr(new MemCytoFrame(it.second,config));
-			//set pdata
-			fr_ptr->set_pheno_data("name", path_base_name(it.second));
-
-			dynamic_cast<MemCytoFrame&>(*fr_ptr).read_fcs();
+				string cf_filename = (cf_path/it.first).string();
+				if(fmt != FileFormat::MEM)
+				{
+					cf_filename += "." + fmt_to_str(fmt);
+					fr_ptr->write_to_disk(cf_filename, fmt, ctx, h5_write_opts);
+					fr_ptr = load_cytoframe(cf_filename, readonly, ctx);
+				}
 
-			string cf_filename = (cf_path/it.first).string();
-			if(fmt != FileFormat::MEM)
-			{
-				cf_filename += "." + fmt_to_str(fmt);
-				fr_ptr->write_to_disk(cf_filename, fmt, ctx);
-				fr_ptr = load_cytoframe(cf_filename, readonly, ctx);
+				add_cytoframe_view(it.first, CytoFrameView(fr_ptr));
 			}
 
-			add_cytoframe_view(it.first, CytoFrameView(fr_ptr));
-
 		}
 	}
 
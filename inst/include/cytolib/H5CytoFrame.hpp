@@ -10,8 +10,11 @@
 #ifndef INST_INCLUDE_CYTOLIB_H5CYTOFRAME_HPP_
 #define INST_INCLUDE_CYTOLIB_H5CYTOFRAME_HPP_
 #include <cytolib/MemCytoFrame.hpp>
+#include <cytolib/FCSEventStream.hpp>
 #include <cytolib/global.hpp>
+#include <cytolib/H5FileCache.hpp>
 #include <boost/filesystem.hpp>
+#include <atomic>
 namespace fs = boost::filesystem;
 
 namespace cytolib
@@ -31,14 +34,51 @@ protected:
 	bool is_dirty_params;
 	bool is_dirty_keys;
 	bool is_dirty_pdata;
+	//flags indicating if keywords and pdata have been loaded from h5, which are deferred until the first access
+	mutable atomic<bool> is_keys_loaded;
+	mutable atomic<bool> is_pdata_loaded;
 	FileAccPropList access_plist_;//used to custom fapl, especially for s3 backend
 	EVENT_DATA_VEC read_data(uvec col_idx) const;
+	/**
+	 * read the subset of rows of the selected columns
+	 *
+	 * Only the runs of the selected rows (coalesced across the small gaps) are read from disk,
+	 * unless they cover most of the events, in which case the whole span of the selected rows is read and subsetted in memory
+	 */
+	EVENT_DATA_VEC read_data(uvec col_idx, uvec row_idx) const;
 	int h5_flags() const{
 		if(get_readonly())
 			return H5F_ACC_RDONLY;
 		else
 			return H5F_ACC_RDWR;
 	};
+	/**
+	 * get the shared handle of the h5 file from the process-wide cache (see H5FileCache)
+	 * instead of re-opening the file in every accessor
+	 *
+	 * The h5 lock is held until the handle goes out of scope, so that the frames can be accessed from multiple threads
+	 */
+	H5LockedFileHandle get_h5_handle() const{
+		unique_lock<recursive_mutex> lock(H5FileCache::h5_mutex());
+		return H5LockedFileHandle(move(lock), H5FileCache::open(filename_, h5_flags(), access_plist_));
+	}
+	/**
+	 * read the selected columns by the file offsets of their raw chunks
+	 *
+	 * Only the chunk addresses are queried from h5 (under the h5 lock), whereas the bytes are read and decoded
+	 * (inflated and unshuffled) without the lock, so that the frames can be loaded by multiple threads concurrently.
+	 * The read is registered as H5RawRead meanwhile, which the writers of the events wait for.
+	 *
+	 * @return false if the dataset can't be read directly (e.g. the remote h5 or the filters other than shuffle and deflate),
+	 * 			in which case data is untouched
+	 */
+	bool read_data_direct(const uvec & col_idx, EVENT_DATA_VEC & data) const;
+	void ensure_keys_loaded() const;
+	void ensure_pheno_data_loaded() const;
+	/**
+	 * load params and dims, which are needed by most of the accessors
+	 */
+	void load_params();
 public:
 	void flush_meta();
 	void flush_params();
@@ -60,6 +100,9 @@ public:
 		is_dirty_params = frm.is_dirty_params;
 		is_dirty_keys = frm.is_dirty_keys;
 		is_dirty_pdata = frm.is_dirty_pdata;
+		//keywords and pdata have been loaded by the copy of CytoFrame
+		is_keys_loaded = true;
+		is_pdata_loaded = true;
 		readonly_ = frm.readonly_;
 		access_plist_ = frm.access_plist_;
 		memcpy(dims, frm.dims, sizeof(dims));
@@ -80,6 +123,8 @@ public:
 		swap(is_dirty_params, frm.is_dirty_params);
 		swap(is_dirty_keys, frm.is_dirty_keys);
 		swap(is_dirty_pdata, frm.is_dirty_pdata);
+		is_keys_loaded = true;
+		is_pdata_loaded = true;
 	}
 	H5CytoFrame & operator=(const H5CytoFrame & frm)
 	{
@@ -88,6 +133,8 @@ public:
 		is_dirty_params = frm.is_dirty_params;
 		is_dirty_keys = frm.is_dirty_keys;
 		is_dirty_pdata = frm.is_dirty_pdata;
+		is_keys_loaded = true;
+		is_pdata_loaded = true;
 		readonly_ = frm.readonly_;
 		access_plist_ = frm.access_plist_;
 		memcpy(dims, frm.dims, sizeof(dims));
@@ -101,6 +148,8 @@ public:
 		swap(is_dirty_params, frm.is_dirty_params);
 		swap(is_dirty_keys, frm.is_dirty_keys);
 		swap(is_dirty_pdata, frm.is_dirty_pdata);
+		is_keys_loaded = true;
+		is_pdata_loaded = true;
 		swap(readonly_, frm.readonly_);
 		swap(access_plist_, frm.access_plist_);
 		return *this;
@@ -149,16 +198,19 @@ public:
 		return res;
 	}
 
-	void append_data_columns(const EVENT_DATA_VEC & new_cols)
-	{
-		EVENT_DATA_VEC this_data = get_data();
-		this_data.insert_cols(this_data.n_cols, new_cols);
-		set_data(this_data);
-	}
+	/**
+	 * extend the dataset and write the new columns only
+	 */
+	void append_data_columns(const EVENT_DATA_VEC & new_cols);
+	/**
+	 * write the selected columns only (as one union hyperslab)
+	 */
+	void set_columns(uvec col_idx, const EVENT_DATA_VEC & cols);
 	vector<string> get_rownames() const
 	{
 		vector<string> rownames;
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
+		auto h5 = get_h5_handle();
+		H5File & file = h5->file();
 		auto dsname = DATASET_ROWNAME;
 		if(file.exists(dsname))
 		{
@@ -184,17 +236,19 @@ public:
 	}
 	void set_rownames(const vector<string> & rn)
 	{
-
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
 		check_write_permission();
-		write_h5_rownames(file, rn);
+		auto h5 = get_h5_handle();
+		write_h5_rownames(h5->file(), rn);
 	}
 	void del_rownames(){
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
 		check_write_permission();
-
+		auto h5 = get_h5_handle();
+		H5File & file = h5->file();
 		if(file.exists(DATASET_ROWNAME))
+		{
 			file.unlink(DATASET_ROWNAME);
+			file.flush(H5F_SCOPE_LOCAL);
+		}
 	}
 	void set_marker(const string & channelname, const string & markername)
 	{
@@ -227,18 +281,30 @@ public:
 	 * @param h5_filename
 	 */
 	H5CytoFrame(const string & fcs_filename, FCS_READ_PARAM & config, const string & h5_filename
-			, bool readonly = false):filename_(h5_filename), is_dirty_params(false), is_dirty_keys(false), is_dirty_pdata(false)
+			, bool readonly = false):filename_(h5_filename), readonly_(readonly), is_dirty_params(false), is_dirty_keys(false), is_dirty_pdata(false)
+			, is_keys_loaded(false), is_pdata_loaded(false)
 	{
-		MemCytoFrame fr(fcs_filename, config);
-		fr.read_fcs();
-		fr.write_h5(h5_filename);
-		*this = H5CytoFrame(h5_filename, readonly);
+		if(config.data.which_lines.size() > 0)
+		{
+			MemCytoFrame fr(fcs_filename, config);
+			fr.read_fcs();
+			fr.write_h5(h5_filename);
+		}
+		else
+		{
+			//convert by blocks without materializing the events
+			FCSEventStream st(fcs_filename, config);
+			st.write_h5(h5_filename);
+		}
+		access_plist_ = FileAccPropList::DEFAULT;
+		init_load();
 	}
 	/**
 	 * constructor from the H5
 	 * @param _filename H5 file path
 	 */
 	H5CytoFrame(const string & h5_filename, bool readonly = true, bool init = true):CytoFrame(),filename_(h5_filename), readonly_(readonly), is_dirty_params(false), is_dirty_keys(false), is_dirty_pdata(false)
+			, is_keys_loaded(false), is_pdata_loaded(false)
 	{
 		access_plist_ = FileAccPropList::DEFAULT;
 		if(init)//optionally delay load for the s3 derived cytoframe which needs to reset fapl before load
@@ -246,21 +312,16 @@ public:
 	}
 	void init_load(){
 		//always use the same flag and keep lock at cf level to avoid h5 open error caused conflicting h5 flags among cf objects that points to the same h5
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
-		load_meta();
-
-
-		//open dataset for event data
-
-		auto dataset = file.openDataSet(DATASET_NAME);
-		auto dataspace = dataset.getSpace();
-		dataspace.getSimpleExtentDims(dims);
-
+		//only params and dims are loaded upfront, keywords and pdata are loaded on the first access
+		auto h5 = get_h5_handle();
+		load_params();
 	}
 	/**
 	 * abandon the changes to the meta data in cache by reloading them from disk
+	 *
+	 * keywords and pdata are reloaded on the next access
 	 */
-	void load_meta();;;
+	void load_meta();
 
 	string get_uri() const{
 		return filename_;
@@ -274,8 +335,14 @@ public:
 	void convertToPb(pb::CytoFrame & fr_pb
 			, const string & h5_filename
 			, CytoFileOption h5_opt
-			, const CytoCtx & ctx = CytoCtx()) const
+			, const CytoCtx & ctx = CytoCtx()
+			, const H5WriteOptions & h5_write_opts = H5WriteOptions()) const
 	{
+			/*
+			 * the existing h5 is copied (or moved) as it is,
+			 * unless the layout is requested by h5_write_opts (i.e. not the default) and differs from the stored one,
+			 * in which case the events are rewritten in that layout
+			 */
 			fr_pb.set_is_h5(true);
 			if(h5_opt != CytoFileOption::skip)
 			{
@@ -284,22 +351,43 @@ public:
 				if(!fs::exists(dest))
 					throw(logic_error(dest.string() + "doesn't exist!"));
 
+				bool is_rewrite = h5_write_opts != H5WriteOptions() && h5_write_opts != get_write_options();
+				uvec all_rows(n_rows()), all_cols(n_cols());
+				for(unsigned i = 0; i < all_rows.size(); i++)
+					all_rows[i] = i;
+				for(unsigned i = 0; i < all_cols.size(); i++)
+					all_cols[i] = i;
+				//close the cached handles so that the files are complete on disk and free to be replaced
+				//(under h5 lock so that no other thread reopens them in between)
+				lock_guard<recursive_mutex> guard(H5FileCache::h5_mutex());
 				if(!fs::equivalent(fs::path(filename_).parent_path(), dest))
 				{
+					H5FileCache::release(filename_);
+					H5FileCache::release(h5_filename);
 					switch(h5_opt)
 					{
 					case CytoFileOption::copy:
 						{
 							if(fs::exists(h5path))
 								fs::remove(h5path);
-							fs::copy(filename_, h5_filename);
+							if(is_rewrite)
+								copy_subset(h5_filename, all_rows, all_cols, h5_write_opts);
+							else
+								fs::copy(filename_, h5_filename);
 							break;
 						}
 					case CytoFileOption::move:
 						{
 							if(fs::exists(h5path))
 								fs::remove(h5path);
-							fs::rename(filename_, h5_filename);
+							if(is_rewrite)
+							{
+								copy_subset(h5_filename, all_rows, all_cols, h5_write_opts);
+								H5FileCache::release(filename_);
+								fs::remove(filename_);
+							}
+							else
+								fs::rename(filename_, h5_filename);
 							break;
 						}
 					case CytoFileOption::link:
@@ -310,6 +398,7 @@ public:
 						}
 					case CytoFileOption::symlink:
 						{
+							//the link shares the source file, which is left in its own layout
 							if(fs::exists(h5path))
 								fs::remove(h5path);
 							fs::create_symlink(filename_, h5_filename);
@@ -319,6 +408,8 @@ public:
 						throw(logic_error("invalid h5_opt!"));
 					}
 				}
+				else if(is_rewrite)
+					copy_subset(h5_filename, all_rows, all_cols, h5_write_opts);
 			}
 		}
 	/**
@@ -346,11 +437,17 @@ public:
 		if(is_col)
 			return read_data(idx);
 		else
-			return get_data().rows(idx);
+		{
+			unsigned n = n_cols();
+			uvec col_idx(n);
+			for(unsigned i = 0; i < n; i++)
+				col_idx[i] = i;
+			return read_data(col_idx, idx);
+		}
 	}
 	EVENT_DATA_VEC get_data(uvec row_idx, uvec col_idx) const
 	{
-		return read_data(col_idx).rows(row_idx);
+		return read_data(col_idx, row_idx);
 	}
 	/*
 	 * protect the h5 from being overwritten accidentally
@@ -377,14 +474,58 @@ public:
 			new_filename = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
 			fs::remove(new_filename);
 		}
-		fs::copy_file(filename_, new_filename);
+		{
+			lock_guard<recursive_mutex> guard(H5FileCache::h5_mutex());
+			H5FileCache::release(filename_);
+			fs::copy_file(filename_, new_filename);
+		}
 		CytoFramePtr ptr(new H5CytoFrame(new_filename, false));
-		//copy cached meta
+		//copy cached meta (the unloaded ones are identical to the copied file)
 		ptr->set_params(get_params());
-		ptr->set_keywords(get_keywords());
-		ptr->set_pheno_data(get_pheno_data());
+		if(is_keys_loaded)
+			ptr->set_keywords(get_keywords());
+		if(is_pdata_loaded)
+			ptr->set_pheno_data(get_pheno_data());
 		return ptr;
 	}
+	/**
+	 * the upper bound of the events buffered by the subset copy (in bytes)
+	 */
+	static size_t copy_buffer_size;
+	/**
+	 * whether to read the events of the local h5 by the file offsets of the chunks (see read_data_direct)
+	 */
+	static bool direct_read;
+	/**
+	 * the runs (start, length) of the events to be read from h5 for the selected rows
+	 *
+	 * The rows are only merged across the small gaps, so a sparse selection reads about as many rows as selected.
+	 * It becomes the span of the rows once that covers most of the events anyway.
+	 * @param rows the sorted unique rows
+	 * @param nrow the total number of events
+	 */
+	static vector<pair<hsize_t, hsize_t>> row_read_runs(const uvec & rows, hsize_t nrow);
+	/**
+	 * copy the subset of the events to a new h5 file
+	 *
+	 * The selected columns are read and written by blocks of the selected rows
+	 * so that the memory usage is bounded by copy_buffer_size instead of the size of the frame
+	 * @param h5_filename the new h5 file
+	 * @param row_idx the selected rows in the order of the output
+	 * @param col_idx the selected columns in the order of the output
+	 * @param h5_write_opts the layout of the new events dataset
+	 */
+	void copy_subset(const string & h5_filename, const uvec & row_idx, const uvec & col_idx, const H5WriteOptions & h5_write_opts) const;
+	/**
+	 * copy the subset in the same layout (chunks, filters and precision) as the source
+	 */
+	void copy_subset(const string & h5_filename, const uvec & row_idx, const uvec & col_idx) const{
+		copy_subset(h5_filename, row_idx, col_idx, get_write_options());
+	}
+	/**
+	 * the chunk layout, filters and precision that the events dataset is stored with
+	 */
+	H5WriteOptions get_write_options() const;
 	CytoFramePtr copy(uvec row_idx, uvec col_idx, const string & h5_filename = "", bool overwrite = false) const
 	{
 		copy_overwrite_check(h5_filename, overwrite);
@@ -395,8 +536,7 @@ public:
 			new_filename = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
 			fs::remove(new_filename);
 		}
-		MemCytoFrame fr(*this);
-		fr.copy(row_idx, col_idx)->write_h5(new_filename);//this flushes the meta data as well
+		copy_subset(new_filename, row_idx, col_idx);//this flushes the meta data as well
 		return CytoFramePtr(new H5CytoFrame(new_filename, false));
 	}
 
@@ -410,8 +550,14 @@ public:
 			new_filename = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
 			fs::remove(new_filename);
 		}
-		MemCytoFrame fr(*this);
-		fr.copy(idx, is_row_indexed)->write_h5(new_filename);//this flushes the meta data as well
+		unsigned n = is_row_indexed ? n_cols() : n_rows();
+		uvec all_idx(n);
+		for(unsigned i = 0; i < n; i++)
+			all_idx[i] = i;
+		if(is_row_indexed)
+			copy_subset(new_filename, idx, all_idx);
+		else
+			copy_subset(new_filename, all_idx, idx);
 		return CytoFramePtr(new H5CytoFrame(new_filename, false));
 	}
 
@@ -0,0 +1,153 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * H5FileCache.hpp
+ *
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_H5FILECACHE_HPP_
+#define INST_INCLUDE_CYTOLIB_H5FILECACHE_HPP_
+#include <cytolib/global.hpp>
+#include <H5Cpp.h>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+using namespace H5;
+
+namespace cytolib
+{
+/**
+ * The opened H5 file along with the datasets that have been opened through it
+ *
+ * It is shared (by shared_ptr) between the cache and the callers,
+ * so that the file stays open as long as any caller still holds it even after being evicted from the cache.
+ */
+class H5FileHandle{
+	H5File file_;
+	unsigned flags_;
+	unordered_map<string, DataSet> datasets_;
+	mutex mtx_;
+public:
+	H5FileHandle(const string & filename, unsigned flags, const FileAccPropList & access_plist)
+		:file_(filename, flags, FileCreatPropList::DEFAULT, access_plist), flags_(flags){};
+	~H5FileHandle();
+	H5File & file(){return file_;}
+	unsigned flags() const{return flags_;}
+	/**
+	 * get the dataset, which is opened on the first use and kept open along with the file
+	 * @param name the dataset name
+	 */
+	DataSet dataset(const string & name);
+};
+typedef shared_ptr<H5FileHandle> H5FileHandlePtr;
+
+/**
+ * The handle that holds the process-wide h5 lock (see H5FileCache::h5_mutex) during its lifetime
+ *
+ * The h5 objects created through it are expected to be destroyed before the handle
+ * (i.e. declared after it), so that all the h5 calls are made under the lock.
+ */
+class H5LockedFileHandle{
+	unique_lock<recursive_mutex> lock_;
+	H5FileHandlePtr handle_;//declared after the lock so that it is released under the lock
+public:
+	H5LockedFileHandle(unique_lock<recursive_mutex> && lock, H5FileHandlePtr handle)
+		:lock_(move(lock)), handle_(handle){};
+	H5FileHandle * operator->() const{return handle_.get();}
+	H5FileHandlePtr get() const{return handle_;}
+};
+
+/**
+ * Process-wide cache of the opened H5 files, shared by all the H5CytoFrame objects
+ *
+ * Opening H5 file and parsing its metadata is far more expensive than reading a few columns from it,
+ * so the handles are kept open and reused across the accessors (and across the copies of the same frame).
+ * The number of open files is bounded by the capacity, beyond which the least recently used handle is evicted.
+ *
+ * A read-only request can be served by the read-write handle of the same file, whereas a read-write request
+ * replaces the cached read-only handle (since h5 doesn't allow opening the same file with the conflicting flags).
+ * The write permission is still enforced at H5CytoFrame level (see H5CytoFrame::check_write_permission).
+ *
+ * The file operations that replace or remove the h5 files outside of the cache (e.g. truncate, copy, move or delete)
+ * must release the handles first through release().
+ *
+ * The raw chunks can be read outside of the h5 lock (see H5CytoFrame::read_data_direct).
+ * Such reads are registered under the h5 lock (see H5RawRead), and the writers of the events wait for them to finish
+ * (see wait_raw_reads, which release() calls as well) while holding the h5 lock,
+ * so that the chunks are never rewritten while being read.
+ */
+class H5FileCache{
+public:
+	/**
+	 * get the handle of the h5 file, which is opened when not cached yet
+	 *
+	 * @param filename the h5 file path (or url for the remote file)
+	 * @param flags H5F_ACC_RDONLY or H5F_ACC_RDWR
+	 * @param access_plist the file access property list used to open the file
+	 */
+	static H5FileHandlePtr open(const string & filename, unsigned flags, const FileAccPropList & access_plist = FileAccPropList::DEFAULT);
+	/**
+	 * drop the cached handles of the file or all the files under the directory
+	 *
+	 * The file gets actually closed once all its holders are done with it
+	 */
+	static void release(const string & path);
+	/**
+	 * drop all the cached handles
+	 */
+	static void clear();
+	/**
+	 * set the maximal number of the open files kept by the cache, 0 disables the caching
+	 */
+	static void set_capacity(size_t n);
+	static size_t get_capacity();
+	/**
+	 * set the raw data chunk cache of the datasets opened afterwards
+	 * @param nbytes the size of the chunk cache in bytes
+	 * @param nslots the number of the hash slots, which is preferably a prime number about 100 times of the number of chunks fitted in the cache
+	 */
+	static void set_chunk_cache(size_t nbytes, size_t nslots);
+	static void get_chunk_cache(size_t & nbytes, size_t & nslots);
+	/**
+	 * the number of the files currently cached
+	 */
+	static size_t size();
+	/**
+	 * the process-wide lock that serializes the h5 library calls made by cytolib
+	 *
+	 * h5 is not thread-safe unless being built so (and even then it serializes the calls internally),
+	 * thus the threads reading different frames concurrently need to take turns on the h5 calls.
+	 * It is recursive so that the nested accessors can acquire it again.
+	 */
+	static recursive_mutex & h5_mutex();
+	/**
+	 * register the read of the raw chunks of the file that goes on after the h5 lock is released,
+	 * which must be called under the h5 lock and paired with end_raw_read
+	 */
+	static void begin_raw_read(const string & filename);
+	static void end_raw_read(const string & filename);
+	/**
+	 * wait for the raw reads of the file (or the files under the directory) to finish
+	 *
+	 * It is called under the h5 lock, which keeps the new raw reads from starting meanwhile.
+	 */
+	static void wait_raw_reads(const string & path);
+};
+
+/**
+ * The scope of the raw chunk read registered by H5FileCache::begin_raw_read
+ */
+class H5RawRead{
+	string filename_;
+public:
+	H5RawRead(const string & filename):filename_(filename){H5FileCache::begin_raw_read(filename_);}
+	~H5RawRead(){H5FileCache::end_raw_read(filename_);}
+	H5RawRead(const H5RawRead &) = delete;
+	H5RawRead & operator=(const H5RawRead &) = delete;
+};
+
+};
+
+
+
+#endif /* INST_INCLUDE_CYTOLIB_H5FILECACHE_HPP_ */
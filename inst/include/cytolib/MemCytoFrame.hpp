@@ -36,7 +36,7 @@ class MemCytoFrame: public CytoFrame{
 	ifstream in_;//because of this member, the class needs to explicitly define copy/assignment constructor
 
 	void parse_fcs_header(ifstream &in, int nOffset = 0);
-	void string_to_keywords(string txt, bool emptyValue);
+	void string_to_keywords(boost::string_view txt, bool emptyValue);
 	void parse_fcs_text_section(ifstream &in, bool emptyValue);
 	void open_fcs_file();
 
@@ -68,7 +68,8 @@ public:
 	void convertToPb(pb::CytoFrame & fr_pb
 			, const string & h5_filename
 			, CytoFileOption h5_opt
-			, const CytoCtx & ctx = CytoCtx()) const;
+			, const CytoCtx & ctx = CytoCtx()
+			, const H5WriteOptions & h5_write_opts = H5WriteOptions()) const;
 	unsigned n_rows() const;
 
 	void read_fcs();
@@ -86,7 +87,28 @@ public:
 	 * @param config (input) the parsing arguments for data
 	 */
 	void read_fcs_data(ifstream &in, const FCS_READ_DATA_PARAM & config);
+	/**
+	 * validate the data layout keywords and set up the decoder for the DATA segment
+	 *
+	 * It may fix up params (e.g. the invalid bitwidth from CPX software), thus is expected to be called once
+	 * after the header is parsed
+	 * @param config (input) the parsing arguments for data
+	 * @return the decoder that converts the raw row-major bytes to the col-major events
+	 */
+	FCSDataDecoder init_data_decoder(const FCS_READ_DATA_PARAM & config);
+	/**
+	 * update the params ranges and keywords once all the events are decoded
+	 *
+	 * @param decoder (input) the decoder returned by init_data_decoder
+	 * @param config (input) the parsing arguments for data
+	 * @param realMin (input) the minimum of each column accumulated by the decoder
+	 */
+	void finalize_data_decoder(const FCSDataDecoder & decoder, const FCS_READ_DATA_PARAM & config, const vector<EVENT_DATA_TYPE> & realMin);
 	void read_fcs_header();
+	/**
+	 * the offsets of the segments parsed from the FCS header
+	 */
+	const FCS_Header & get_fcs_header() const{return header_;}
 	/**
 	 * parse the FCS header and Text segment
 	 *
@@ -207,6 +229,10 @@ public:
 	}
 
 	void append_data_columns(const EVENT_DATA_VEC & new_cols);
+	void set_columns(uvec col_idx, const EVENT_DATA_VEC & cols)
+	{
+		data_.cols(col_idx) = cols;
+	}
 
 	void transform_data(const trans_local & trans);
 };
@@ -12,6 +12,7 @@
 #define POPINDICES_HPP_
 
 #include "gate.hpp"
+#include "roaring_bitmap.hpp"
 
 namespace cytolib
 {
@@ -37,6 +38,10 @@ public:
 	 */
 	virtual vector<bool> getIndices()=0;
 	virtual vector<unsigned> getIndices_u()=0;
+	/**
+	 * convert the POPINDICES to the dense event mask used by gating
+	 */
+	virtual EVENT_BITSET getMask()=0;
 	/**
 	 * compute the event count from the event indices
 	 */
@@ -50,24 +55,29 @@ public:
 
 };
 /*
- * bool vector
+ * bit vector
  */
 class BOOLINDICES:public POPINDICES{
 private:
-	vector <bool> x;
+	EVENT_BITSET x;
 public:
 	BOOLINDICES():POPINDICES(){};
 
-	BOOLINDICES(vector <unsigned> _ind, unsigned _nEvent);
-	BOOLINDICES(vector <bool> _ind);
+	BOOLINDICES(vector <unsigned> _ind, unsigned _nEvent):POPINDICES(_nEvent),x(_ind, _nEvent){};
+	BOOLINDICES(vector <bool> _ind):POPINDICES(_ind.size()),x(_ind){};
+	BOOLINDICES(EVENT_BITSET _ind):POPINDICES(_ind.size()),x(std::move(_ind)){};
 	vector<bool> getIndices(){
+		return x.to_bool();
+	}
+	vector<unsigned> getIndices_u(){
+		return x.to_indices();
+	}
+	EVENT_BITSET getMask(){
 		return x;
 	}
-	vector<unsigned> getIndices_u();
-
 
 	unsigned getCount(){
-		return count(x.begin(),x.end(),true);
+		return x.count();
 	}
 
 
@@ -95,9 +105,12 @@ public:
 
 	INTINDICES(vector <unsigned> _ind, unsigned _nEvent):POPINDICES(_nEvent),x(_ind){};
 
+	INTINDICES(const EVENT_BITSET & _ind):POPINDICES(_ind.size()),x(_ind.to_indices()){};
+
 	vector<bool> getIndices();
 
 	vector<unsigned> getIndices_u(){return x;};
+	EVENT_BITSET getMask(){return EVENT_BITSET(x, nEvents);};
 	unsigned getCount(){
 
 		return x.size();
@@ -116,6 +129,54 @@ public:
 
 };
 
+/*
+ * compressed bit vector
+ *
+ * It is archived in the legacy layout (INT or the packed bits of BOOL, whichever is smaller) by default.
+ * When g_compress_indices is set, it is archived as pb::BOOL with the compressed stream in place of the packed bits,
+ * which is told apart from the legacy archive by being shorter than the packed bits
+ * (it falls back to the legacy layout whenever the compressed stream is not smaller).
+ */
+class ROARINGINDICES:public POPINDICES{
+private:
+	ROARING_BITMAP x;
+public:
+	ROARINGINDICES():POPINDICES(){};
+	ROARINGINDICES(const EVENT_BITSET & _ind):POPINDICES(_ind.size()),x(_ind){};
+	vector<bool> getIndices(){
+		return x.to_mask().to_bool();
+	}
+	vector<unsigned> getIndices_u(){
+		return x.to_indices();
+	}
+	EVENT_BITSET getMask(){
+		return x.to_mask();
+	}
+	unsigned getCount(){
+		return x.count();
+	}
+	POPINDICES * clone(){
+		ROARINGINDICES * res=new ROARINGINDICES(*this);
+		return res;
+	}
+	void convertToPb(pb::POPINDICES & ind_pb);
+	ROARINGINDICES(const pb::POPINDICES & ind_pb);
+	/**
+	 * whether the pb::BOOL archive holds the compressed stream
+	 */
+	static bool is_compressed(const pb::POPINDICES & ind_pb){
+		return ind_pb.bind().size() < legacy_bytes(ind_pb.nevents());
+	}
+	/**
+	 * the fewest bytes of the packed bits in a legacy archive
+	 * (the legacy writer sized them by ceil(float(nEvents) / 8), which can fall short beyond 2^24 events)
+	 * so the compressed stream has to be shorter than it
+	 */
+	static size_t legacy_bytes(unsigned nEvents){
+		return min<size_t>((size_t(nEvents) + 7) / 8, ceil(float(nEvents) / 8));
+	}
+};
+
 /*
  * root node
  */
@@ -132,6 +193,9 @@ public:
 		return res;
 	}
 	vector<unsigned> getIndices_u();
+	EVENT_BITSET getMask(){
+		return EVENT_BITSET(nEvents, true);
+	}
 
 
 	unsigned getCount(){
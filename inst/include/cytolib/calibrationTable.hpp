@@ -54,6 +54,7 @@ public:
 	 */
 	Spline_Coefs getSplineCoefs();
 	void transforming(double * input, int nSize);
+	void transforming(float * input, int nSize);//for the events held in float32 (CYTOLIB_FLOAT_EVENTS)
 	void convertToPb(pb::calibrationTable & cal_pb);
 
 	calibrationTable(const pb::calibrationTable & cal_pb);
@@ -12,8 +12,15 @@
 
 namespace cytolib
 {
-
-
+	/*
+	 * the in-memory type of the events
+	 * Define CYTOLIB_FLOAT_EVENTS to hold them in float32, which halves the memory footprint
+	 * and matches the precision of the default h5 storage (see H5WriteOptions)
+	 */
+#ifdef CYTOLIB_FLOAT_EVENTS
+	typedef float EVENT_DATA_TYPE;
+#else
 	typedef double EVENT_DATA_TYPE;
+#endif
 }
 #endif /* INST_INCLUDE_CYTOLIB_DATATYPE_HPP_ */
@@ -0,0 +1,214 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * event_bitset.hpp
+ *
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_EVENT_BITSET_HPP_
+#define INST_INCLUDE_CYTOLIB_EVENT_BITSET_HPP_
+
+#include <vector>
+#include <stdint.h>
+#include <stdexcept>
+using namespace std;
+
+namespace cytolib
+{
+inline unsigned popcount64(uint64_t w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(w);
+#else
+	w = w - ((w >> 1) & 0x5555555555555555ULL);
+	w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+	w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (w * 0x0101010101010101ULL) >> 56;
+#endif
+}
+inline unsigned ctz64(uint64_t w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(w);
+#else
+	unsigned n = 0;
+	while(!(w & 1))
+	{
+		w >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+/**
+ * \class EVENT_BITSET
+ * \brief the dense event mask used through the gating pipeline
+ *
+ * Bit i of word i / 64 is set when the event i belongs to the population.
+ * The bits beyond size() in the last word are always kept zero
+ * so that count() and the word-level ops never need to mask the tail.
+ */
+class EVENT_BITSET
+{
+public:
+	typedef uint64_t WORD;
+	static const unsigned WORD_BITS = 64;
+private:
+	vector<WORD> words;
+	unsigned nBits;
+	void clear_tail(){
+		unsigned r = nBits % WORD_BITS;
+		if(r)
+			words.back() &= (WORD(1) << r) - 1;
+	}
+	void check_size(const EVENT_BITSET & other) const{
+		if(nBits != other.nBits)
+			throw(domain_error("the sizes of the event masks do not match!"));
+	}
+public:
+	EVENT_BITSET():nBits(0){};
+	explicit EVENT_BITSET(unsigned n, bool value = false):words((n + WORD_BITS - 1) / WORD_BITS, value ? ~WORD(0) : WORD(0)), nBits(n){
+		clear_tail();
+	};
+	explicit EVENT_BITSET(const vector<bool> & x):EVENT_BITSET(x.size()){
+		for(unsigned i = 0; i < nBits; i++)
+			if(x[i])
+				set(i);
+	}
+	/**
+	 * @param ind the (sorted or unsorted) event indices
+	 * @param n the total number of events
+	 */
+	EVENT_BITSET(const vector<unsigned> & ind, unsigned n):EVENT_BITSET(n){
+		for(auto i : ind)
+			set(i);
+	}
+	unsigned size() const{return nBits;}
+	unsigned n_words() const{return words.size();}
+	const WORD * data() const{return words.data();}
+	/**
+	 * the raw words for the gates to write
+	 * the caller is responsible for leaving the tail bits of the last word zero
+	 */
+	WORD * data(){return words.data();}
+	bool test(unsigned i) const{return (words[i / WORD_BITS] >> (i % WORD_BITS)) & 1;}
+	void set(unsigned i){words[i / WORD_BITS] |= WORD(1) << (i % WORD_BITS);}
+	unsigned count() const{
+		unsigned res = 0;
+		for(auto w : words)
+			res += popcount64(w);
+		return res;
+	}
+	bool any() const{
+		for(auto w : words)
+			if(w)
+				return true;
+		return false;
+	}
+	EVENT_BITSET & operator&=(const EVENT_BITSET & other){
+		check_size(other);
+		WORD * a = words.data();
+		const WORD * b = other.words.data();
+		for(size_t k = 0, n = words.size(); k < n; k++)
+			a[k] &= b[k];
+		return *this;
+	}
+	EVENT_BITSET & operator|=(const EVENT_BITSET & other){
+		check_size(other);
+		WORD * a = words.data();
+		const WORD * b = other.words.data();
+		for(size_t k = 0, n = words.size(); k < n; k++)
+			a[k] |= b[k];
+		return *this;
+	}
+	/**
+	 * this & !other
+	 */
+	EVENT_BITSET & and_not(const EVENT_BITSET & other){
+		check_size(other);
+		WORD * a = words.data();
+		const WORD * b = other.words.data();
+		for(size_t k = 0, n = words.size(); k < n; k++)
+			a[k] &= ~b[k];
+		return *this;
+	}
+	/**
+	 * this | !other
+	 */
+	EVENT_BITSET & or_not(const EVENT_BITSET & other){
+		check_size(other);
+		WORD * a = words.data();
+		const WORD * b = other.words.data();
+		for(size_t k = 0, n = words.size(); k < n; k++)
+			a[k] |= ~b[k];
+		clear_tail();
+		return *this;
+	}
+	EVENT_BITSET & flip(){
+		for(auto & w : words)
+			w = ~w;
+		clear_tail();
+		return *this;
+	}
+	/**
+	 * visit the set bits in ascending order
+	 */
+	template<class FUNC> void for_each(FUNC f) const{
+		for(unsigned k = 0; k < words.size(); k++)
+		{
+			WORD w = words[k];
+			while(w)
+			{
+				f(k * WORD_BITS + ctz64(w));
+				w &= w - 1;
+			}
+		}
+	}
+	vector<unsigned> to_indices() const{
+		vector<unsigned> res;
+		res.reserve(count());
+		for_each([&res](unsigned i){res.push_back(i);});
+		return res;
+	}
+	vector<bool> to_bool() const{
+		vector<bool> res(nBits, false);
+		for_each([&res](unsigned i){res[i] = true;});
+		return res;
+	}
+	bool operator==(const EVENT_BITSET & other) const{
+		return nBits == other.nBits && words == other.words;
+	}
+};
+
+/**
+ * gate the parent events 64 at a time
+ *
+ * The test is evaluated for every event of a non-empty parent word (branch-free, so the loop vectorizes)
+ * and the result is combined with the parent word by a single AND (or ANDNOT when negated).
+ * Empty parent words are skipped.
+ * @param isIn isIn(i) tests the event i
+ */
+template<class IN_GATE> void gate_mask(const EVENT_BITSET & parentMask, bool is_negated, EVENT_BITSET & childMask, IN_GATE isIn)
+{
+	typedef EVENT_BITSET::WORD WORD;
+	const unsigned nBits = parentMask.size(), word_bits = EVENT_BITSET::WORD_BITS;
+	childMask = EVENT_BITSET(nBits);
+	const WORD * p = parentMask.data();
+	WORD * c = childMask.data();
+	for(unsigned k = 0, nWords = parentMask.n_words(); k < nWords; k++)
+	{
+		WORD pw = p[k];
+		if(!pw)
+			continue;
+		unsigned base = k * word_bits;
+		unsigned m = nBits - base < word_bits ? nBits - base : word_bits;
+		WORD w = 0;
+		for(unsigned j = 0; j < m; j++)
+			w |= WORD(isIn(base + j)) << j;
+		c[k] = pw & (is_negated ? ~w : w);
+	}
+}
+
+};
+
+#endif /* INST_INCLUDE_CYTOLIB_EVENT_BITSET_HPP_ */
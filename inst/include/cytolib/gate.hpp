@@ -11,6 +11,8 @@
 #define GATE_HPP_
 #include "MemCytoFrame.hpp"
 #include "trans_group.hpp"
+#include "in_ellipse.hpp"
+#include "event_bitset.hpp"
 
 
 using namespace std;
@@ -147,6 +149,18 @@ public:
 	virtual unsigned short getType() const=0;
 	virtual vector<BOOL_GATE_OP> getBoolSpec() const{throw(domain_error("undefined getBoolSpec function!"));};
 	virtual INDICE_TYPE gating(MemCytoFrame &, INDICE_TYPE &){throw(domain_error("undefined gating function!"));};
+	/**
+	 * gate the events of the parent mask into the child mask
+	 *
+	 * The default goes through the indices version. The gates that can test the events
+	 * 64 at a time override it to write the child words directly.
+	 * @param parentMask
+	 * @param childMask receives the gated events, sized as the parent mask
+	 */
+	virtual void gating(MemCytoFrame & fdata, const EVENT_BITSET & parentMask, EVENT_BITSET & childMask){
+		INDICE_TYPE parentInd = parentMask.to_indices();
+		childMask = EVENT_BITSET(gating(fdata, parentInd), parentMask.size());
+	};
 	virtual void extend(MemCytoFrame &,float){throw(domain_error("undefined extend function!"));};
 	virtual void extend(float,float){throw(domain_error("undefined extend function!"));};
 	virtual void gain(map<string,float> &){throw(domain_error("undefined gain function!"));};
@@ -177,6 +191,7 @@ public:
 	unsigned short getType() const{return RANGEGATE;}
 	void transforming(trans_local & trans);
 	INDICE_TYPE gating(MemCytoFrame & fdata, INDICE_TYPE & parentInd);
+	void gating(MemCytoFrame & fdata, const EVENT_BITSET & parentMask, EVENT_BITSET & childMask);
 
 	void extend(MemCytoFrame & fdata,float extend_val);
 	void extend(float extend_val, float extend_to);
@@ -207,7 +222,16 @@ class polygonGate:public gate {
 protected:
 	paramPoly param;
 	vector<EVENT_DATA_TYPE> shift;
+	mutable shared_ptr<const POLYGON_GRID> grid_;//built by the first gating and shared by the clones
+	/*
+	 * drop the grid once the vertices are changed
+	 */
+	void reset_grid(){atomic_store(&grid_, shared_ptr<const POLYGON_GRID>());};
 public:
+	/**
+	 * the polygons with at least this number of vertices are gated through POLYGON_GRID
+	 */
+	static unsigned grid_min_vertices;
 	polygonGate():gate(), shift(vector<EVENT_DATA_TYPE>{0.0, 0.0}){};
 	virtual unsigned short getType() const{return POLYGONGATE;}
 	/*
@@ -238,7 +262,7 @@ public:
 	 */
 	virtual void transforming(TransPtr trans_x, TransPtr trans_y);
 	virtual vertices_vector getVertices() const{return param.toVector();};
-	void setParam(paramPoly _param){param=_param;};
+	void setParam(paramPoly _param){param=_param;reset_grid();};
 	void update_channels(const CHANNEL_MAP & chnl_map){param.update_channels(chnl_map);};
 	virtual paramPoly getParam() const{return param;};
 	virtual vector<string> getParamNames() const{return param.getNameArray();};
@@ -349,6 +373,7 @@ public:
 			return res;
 
 		}
+	void gating(MemCytoFrame & fdata, const EVENT_BITSET & parentMask, EVENT_BITSET & childMask);
 	unsigned short getType() const{return RECTGATE;}
 	gatePtr clone() const{return gatePtr(new rectGate(*this));};
 	void convertToPb(pb::gate & gate_pb);
@@ -436,15 +461,57 @@ public:
  * Thus we still need to preserve the inheritance to the polygonGate
  */
 class ellipsoidGate:public ellipseGate {
+protected:
+	/*
+	 * the ellipse interpolated by toPolygon, in 256 scale
+	 */
+	ELLIPSE_FORM form_256;
+	bool has_form;
+	/*
+	 * map the events from the data scale back to 256 scale, which are set by setDataScale
+	 * (not archived, so the gates loaded from the archive have them set again on the first gating)
+	 */
+	TransPtr to_raw_x, to_raw_y, to_256_x, to_256_y;
+	bool is_data_scale_set;
+	bool analytic;
+	/*
+	 * compute form_256 from the antipodal vertices the same way toPolygon does
+	 */
+	void computeForm();
 public:
-	ellipsoidGate():ellipseGate(){};
-	ellipsoidGate(vector<coordinate> _antipodal, vector<string> _params):ellipseGate(_antipodal,_params)
+	ellipsoidGate():ellipseGate(), has_form(false), is_data_scale_set(false), analytic(true){};
+	ellipsoidGate(vector<coordinate> _antipodal, vector<string> _params):ellipseGate(_antipodal,_params), has_form(false), is_data_scale_set(false), analytic(true)
 	{
 		/*
 		 * interpolate to polygon gate
 		 */
 		toPolygon(100);
+		computeForm();
 	}
+	/**
+	 * Whether to test the events against the ellipse in 256 scale instead of the 100-vertex polygon interpolated from it (on by default).
+	 *
+	 * The results differ only for the events between the polygon and the ellipse,
+	 * i.e. within the (1 - cos(pi * a / (100 * b))) relative distance to the boundary in 256 scale (a/b being the ratio of the semi axes),
+	 * plus the round-trip error of the inverse transformation.
+	 * The polygon is still used when the way back to 256 scale is not available (see setDataScale).
+	 */
+	void setAnalytic(bool _analytic){analytic = _analytic;};
+	bool isAnalytic() const{return analytic;};
+	/**
+	 * set up the way back from the data scale to 256 scale from the transformations the gate is transformed by
+	 *
+	 * It is called by transforming, and by GatingHierarchy::gating for the gates loaded from the archive,
+	 * so that the parsed and the loaded gates are gated the same way.
+	 * It is left unset (i.e. the events are gated by the polygon) when the channels are not transformed invertibly
+	 * or the interpolated polygon doesn't map back onto the ellipse (e.g. the gate has been shifted in the data scale).
+	 */
+	void setDataScale(const trans_local & trans);
+	bool isDataScaleSet() const{return is_data_scale_set;};
+	/**
+	 * whether the events can be mapped back to 256 scale, i.e. setDataScale has succeeded
+	 */
+	bool hasDataScale() const{return to_256_x&&to_256_y;};
 
 	gatePtr clone() const{return gatePtr(new ellipsoidGate(*this));};
 	void convertToPb(pb::gate & gate_pb);
@@ -464,10 +531,10 @@ public:
 	void transforming(trans_local & trans);
 	/*
 	 * ellipsoidGate can't use ellipseGate gating function due to its special treatment of the scale
+	 * the events are mapped back to 256 scale and tested against the ellipse there (see setAnalytic),
+	 * otherwise they are gated by the interpolated polygon
 	 */
-	INDICE_TYPE gating(MemCytoFrame & fdata, INDICE_TYPE & parentInd){
-		return polygonGate::gating(fdata, parentInd);
-	}
+	INDICE_TYPE gating(MemCytoFrame & fdata, INDICE_TYPE & parentInd);
 	unsigned short getType() const{return POLYGONGATE;}//expose it to R as polygonGate since the original antipodal points can't be used directly anyway
 
 	//ellipsoidGate needs to shift its interpolated points
@@ -631,6 +698,10 @@ public:
 		//construct rect gate on the fly and do the quadrant-specific gating
 		return to_rectgate().gating(fdata, parentInd);
 	}
+	void gating(MemCytoFrame & fdata, const EVENT_BITSET & parentMask, EVENT_BITSET & childMask)
+	{
+		to_rectgate().gating(fdata, parentMask, childMask);
+	}
 	virtual unsigned short getType() const{return QUADGATE;}
 	gatePtr clone() const{return gatePtr(new quadGate(*this));};
 	string get_uid(){return uid_;}
@@ -46,10 +46,32 @@ namespace cytolib
 
 	void PRINT(string a);
 	void PRINT(const char * a);
+	/**
+	 * \class PrintBuffer
+	 * \brief redirects PRINT of the current thread into a vector of messages while it is alive
+	 *
+	 * PRINT is Rprintf in R, which must not be called from the worker threads.
+	 * So each worker holds a PrintBuffer and the calling thread replays the collected messages by flush_prints.
+	 */
+	class PrintBuffer{
+		vector<string> & msgs;
+		PrintBuffer * prev;
+	public:
+		PrintBuffer(vector<string> & _msgs);
+		~PrintBuffer();
+		PrintBuffer(const PrintBuffer &) = delete;
+		PrintBuffer & operator=(const PrintBuffer &) = delete;
+		void append(const string & a){msgs.push_back(a);}
+	};
+	/**
+	 * PRINT the messages collected by a PrintBuffer (on the calling thread)
+	 */
+	void flush_prints(const vector<string> & msgs);
 
 	extern vector<string> spillover_keys;
 	extern unsigned short g_loglevel;// debug print is turned off by default
 	extern bool my_throw_on_error;//can be toggle off to get a partially parsed gating tree for debugging purpose
+	extern bool g_compress_indices;//archive the gated events as the compressed stream, which the older readers can not load, so it is off by default
 
 	const int bsti = 1;  // Byte swap test integer
 	#define is_host_big_endian() ( (*(char*)&bsti) == 0 )
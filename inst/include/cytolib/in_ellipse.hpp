@@ -0,0 +1,44 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * in_ellipse.hpp
+ *
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_IN_ELLIPSE_HPP_
+#define INST_INCLUDE_CYTOLIB_IN_ELLIPSE_HPP_
+
+#include "in_polygon.hpp"
+
+namespace cytolib
+{
+/**
+ * The ellipse as the quadratic form (p - mu)' * Q * (p - mu) <= rhs, precomputed once per gate
+ *
+ * Q = | aa, bb |
+ *     | cc, dd |   is the inverse of the covariance matrix
+ */
+struct ELLIPSE_FORM
+{
+	EVENT_DATA_TYPE mu_x, mu_y;
+	EVENT_DATA_TYPE aa, bb, cc, dd;
+	double rhs;
+};
+/**
+ * the form of the ellipse given by its semi axes
+ * @param mu_x
+ * @param mu_y
+ * @param a the semi axis rotated by alpha from the x axis
+ * @param b the other semi axis
+ * @param alpha
+ */
+ELLIPSE_FORM ellipse_form(double mu_x, double mu_y, double a, double b, double alpha);
+/**
+ * test n contiguous events by a branch-free loop
+ * @param isIn isIn[i] is set to whether the event i falls into the ellipse
+ */
+void in_ellipse(const EVENT_DATA_TYPE * xdata, const EVENT_DATA_TYPE * ydata, size_t n, const ELLIPSE_FORM & form, unsigned char * isIn);
+void in_ellipse(const EVENT_DATA_TYPE * xdata, const EVENT_DATA_TYPE * ydata, const ELLIPSE_FORM & form, const INDICE_TYPE & parentInd, bool is_negated, INDICE_TYPE &res);
+}
+
+#endif /* INST_INCLUDE_CYTOLIB_IN_ELLIPSE_HPP_ */
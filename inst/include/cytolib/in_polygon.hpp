@@ -14,6 +14,8 @@
 #include <vector>
 
 #include <algorithm>
+#include <limits>
+#include <cmath>
 using namespace std;
 
 typedef vector<unsigned> INDICE_TYPE;
@@ -28,7 +30,68 @@ struct CYTO_POINT
 	CYTO_POINT(){};
 };
 
+/**
+ * The edges of a polygon precomputed once per gate and stored as the structure of arrays,
+ * so that the events can be tested against all the edges by a branch-free loop.
+ *
+ * The intersections are computed from the original vertex order (instead of the slope) to stay bit-exact
+ * with the scalar crossing-number test. Horizontal edges never satisfy the crossing test and are dropped.
+ */
+struct POLYGON_EDGES
+{
+	vector<EVENT_DATA_TYPE> y_bottom, y_top, x_right;//the y range and the right end of each edge
+	vector<EVENT_DATA_TYPE> x1, y1, dx, dy;//the first vertex and its distance to the second one
+	/*
+	 * the events at the same y-level as the top vertex are decided by the first edge alone:
+	 * "in" when it reaches the top and x falls within [top_left, top_right]
+	 */
+	EVENT_DATA_TYPE y_max;
+	bool is_top_edge;
+	EVENT_DATA_TYPE top_left, top_right;
+	/*
+	 * bounding box of the stored edges, events outside of it (except for the top level) are never "in"
+	 */
+	EVENT_DATA_TYPE box_x_max, box_y_min, box_y_max;
+	POLYGON_EDGES(const vector<CYTO_POINT> & vertices);
+	size_t size() const{return y_bottom.size();}
+};
+
+/**
+ * A uniform grid over the polygon for the gates with many vertices.
+ *
+ * Each cell is classified as inside, outside or boundary. The cells that no edge (nor the rounding margin around it) touches
+ * resolve their events with one lookup, the events of the boundary cells are tested only against the edges
+ * that can pass the crossing test within that cell, which gives the same result as testing all the edges.
+ */
+struct POLYGON_GRID
+{
+	enum CELL_STATE:unsigned char{OUTSIDE, INSIDE, BOUNDARY};
+	vector<CYTO_POINT> vertices;//the polygon the grid is built from
+	POLYGON_EDGES edges;
+	unsigned nx, ny;
+	double x0, y0, cell_w, cell_h;
+	double margin;//the events closer to the edges than this are always tested against the edges
+	vector<CELL_STATE> states;
+	vector<unsigned> cell_start;//the edges of cell i are cell_edges[cell_start[i], cell_start[i + 1])
+	vector<unsigned> cell_edges;
+	/**
+	 *
+	 * @param vertices
+	 * @param grid_size the number of cells along each axis, 0 to choose it from the number of vertices
+	 */
+	POLYGON_GRID(const vector<CYTO_POINT> & vertices, unsigned grid_size = 0);
+	bool is_built_from(const vector<CYTO_POINT> & _vertices) const;
+};
+
 void in_polygon(EVENT_DATA_TYPE * xdata, EVENT_DATA_TYPE * ydata, const vector<CYTO_POINT> & vertices, INDICE_TYPE & parentInd, bool is_negated, INDICE_TYPE &res);
+/**
+ * test the events against the precomputed edge table by blocks
+ */
+void in_polygon(const EVENT_DATA_TYPE * xdata, const EVENT_DATA_TYPE * ydata, const POLYGON_EDGES & edges, const INDICE_TYPE & parentInd, bool is_negated, INDICE_TYPE &res);
+/**
+ * test the events by the grid lookup, falling back to the edges of the boundary cells
+ */
+void in_polygon(const EVENT_DATA_TYPE * xdata, const EVENT_DATA_TYPE * ydata, const POLYGON_GRID & grid, const INDICE_TYPE & parentInd, bool is_negated, INDICE_TYPE &res);
 }
 
 #endif /* INST_INCLUDE_CYTOLIB_IN_POLYGON_HPP_ */
@@ -123,6 +123,10 @@ public:
 	 */
 	vector<bool> getIndices();
 	vector<unsigned> getIndices_u();
+	/**
+	 * Retrieve the event indices as the dense event mask
+	 */
+	EVENT_BITSET getMask();
 
 	void setIndices(unsigned _nEvent){
 			indices.reset(new ROOTINDICES(_nEvent));
@@ -135,6 +139,11 @@ public:
 	void setIndices(vector<bool> _ind);
 
 	void setIndices(INDICE_TYPE _ind, unsigned nTotal);
+	/**
+	 * update the node with the event mask
+	 * which is stored as the compressed containers
+	 */
+	void setIndices(const EVENT_BITSET & _ind);
 	/*
 	 * potentially it is step can be done within the same loop in gating
 	 * TODO:MFI can be calculated here as well
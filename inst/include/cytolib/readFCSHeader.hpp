@@ -17,6 +17,8 @@
 #include <unordered_map>
 #include <iostream>
 #include <algorithm>
+#include <cctype>
+#include <boost/utility/string_view.hpp>
 using namespace std;
 #include <cytolib/armadillo>
 using namespace arma;
@@ -40,47 +42,135 @@ typedef vector<pair <string, string>> KW_PAIR;
 /**
  * this class mimic the map behavior so that the same code
  * can be used for both map and vector based container
+ *
+ * The pairs are kept in their insertion order (i.e. the order of FCS TEXT segment) for round-tripping,
+ * while the positions are indexed by the hash of the keys for constant-time lookups,
+ * which accept string_view so that the key doesn't need to be allocated.
+ * The keys can optionally be matched case-insensitively (as FCS 3.0 defines them).
+ * The keys must not be modified through the iterators (use rename instead), whereas the values can.
+ * The index is only updated by the non-const members, so that the const lookups are safe to be called concurrently.
  */
 class vec_kw_constainer{
  KW_PAIR kw;
+ unordered_multimap<size_t, size_t> idx;//hash of key --> position in kw
+ bool ignore_case = false;
+ static const size_t npos = static_cast<size_t>(-1);
+
+ char normalize(char c) const{return ignore_case?static_cast<char>(tolower(static_cast<unsigned char>(c))):c;}
+ size_t hash_key(boost::string_view key) const{
+	 uint64_t h = 14695981039346656037ULL;//FNV-1a
+	 for(char c : key)
+	 {
+		 h ^= static_cast<unsigned char>(normalize(c));
+		 h *= 1099511628211ULL;
+	 }
+	 return static_cast<size_t>(h);
+ }
+ bool is_key_equal(const string & a, boost::string_view b) const{
+	 if(!ignore_case)
+		 return a == b;
+	 return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [this](char x, char y){return normalize(x) == normalize(y);});
+ }
+ void build_index(){
+	 idx.clear();
+	 idx.reserve(kw.size());
+	 for(size_t i = 0; i < kw.size(); i++)
+		 idx.emplace(hash_key(kw[i].first), i);
+ }
+ void erase_index(boost::string_view key, size_t pos){
+	 auto range = idx.equal_range(hash_key(key));
+	 for(auto it = range.first; it != range.second; it++)
+		 if(it->second == pos)
+		 {
+			 idx.erase(it);
+			 break;
+		 }
+ }
+ /*
+  * the position of the first pair matching the key
+  */
+ size_t find_pos(boost::string_view key) const{
+	 size_t pos = npos;
+	 auto range = idx.equal_range(hash_key(key));
+	 for(auto it = range.first; it != range.second; it++)
+		 if(it->second < pos && is_key_equal(kw[it->second].first, key))
+			 pos = it->second;
+	 return pos;
+ }
 public:
  typedef KW_PAIR::iterator iterator;
  typedef KW_PAIR::const_iterator const_iterator;
- void clear(){kw.clear();}
- void resize(size_t n){kw.resize(n);}
+ void clear(){kw.clear();idx.clear();}
+ /**
+  * resize the pairs, the new ones are empty and meant to be filled by set_pair
+  */
+ void resize(size_t n){kw.resize(n);build_index();}
  size_t size() const{return kw.size();}
  const KW_PAIR & getPairs() const{return kw;}
- void setPairs(const KW_PAIR & _kw){kw = _kw;}
+ void setPairs(const KW_PAIR & _kw){kw = _kw;build_index();}
+ bool is_ignore_case() const{return ignore_case;}
+ /**
+  * whether to match the keys case-insensitively
+  */
+ void set_ignore_case(bool _ignore_case){ignore_case = _ignore_case;build_index();}
  iterator end() {return kw.end();}
  const_iterator end() const{return kw.end();}
  iterator begin(){return kw.begin();}
  const_iterator begin() const{return kw.begin();}
- iterator find(const string &key){
-         return std::find_if(kw.begin(), kw.end(), [key](const pair<string, string> & p){return p.first == key;});
+ iterator find(boost::string_view key){
+	 size_t pos = find_pos(key);
+	 return pos == npos?kw.end():kw.begin() + pos;
  }
- const_iterator find(const string &key) const{
-          return std::find_if(kw.begin(), kw.end(), [key](const pair<string, string> & p){return p.first == key;});
+ const_iterator find(boost::string_view key) const{
+	 size_t pos = find_pos(key);
+	 return pos == npos?kw.end():kw.begin() + pos;
   }
- string & operator [](const string & key){
-         iterator it = find(key);
-         if(it==end())
+ string & operator [](boost::string_view key){
+         size_t pos = find_pos(key);
+         if(pos == npos)
          {
-                 kw.push_back(pair<string, string>(key, ""));
+                 kw.push_back(pair<string, string>(key.to_string(), ""));
+                 idx.emplace(hash_key(key), kw.size() - 1);
                  return kw.back().second;
          }
          else
-                 return it->second;
+                 return kw[pos].second;
    }
- pair <string, string> & operator [](const int & n){
+ /**
+  * positional access, which is read-only so that the index stays in sync (see set_value and set_pair)
+  */
+ const pair <string, string> & operator [](const int & n) const{
 	 return kw[n];
  }
- void erase(const string & key){
-	 iterator it = find(key);
-     if(it!=end())
-     	kw.erase(it);
+ void set_value(size_t n, const string & value){
+	 kw[n].second = value;
+ }
+ void set_pair(size_t n, const pair<string, string> & p){
+	 erase_index(kw[n].first, n);
+	 kw[n] = p;
+	 idx.emplace(hash_key(p.first), n);
+ }
+ void erase(boost::string_view key){
+	 size_t pos = find_pos(key);
+     if(pos != npos)
+     {
+     	kw.erase(kw.begin() + pos);
+     	build_index();//positions after the erased one are shifted
+     }
      else
-     	throw(domain_error("keyword not found: " + key));
+     	throw(domain_error("keyword not found: " + key.to_string()));
  };
+ /**
+  * Change the key of a pair while keeping its position
+  */
+ void rename(boost::string_view old_key, boost::string_view new_key){
+	 size_t pos = find_pos(old_key);
+	 if(pos == npos)
+		 throw(domain_error("keyword not found: " + old_key.to_string()));
+	 erase_index(kw[pos].first, pos);
+	 kw[pos].first = new_key.to_string();
+	 idx.emplace(hash_key(new_key), pos);
+ }
 };
 
 
@@ -22,6 +22,16 @@ namespace cytolib
 typedef unsigned char BYTE;
 
 
+/**
+ * How the events are sampled when which_lines gives the sample size (i.e. of size 1)
+ *
+ * replacement: uniformly with replacement
+ * reservoir: uniformly without replacement (reservoir sampling), so that exactly the sample size of distinct events are drawn
+ * bernoulli: each event is independently selected with the probability of sample size / total events,
+ * 			thus the actual number of events varies around the sample size
+ */
+enum class SampleType {replacement, reservoir, bernoulli};
+
 /**
  * The struct stores all the parsing arguments for events data
  */
@@ -29,10 +39,15 @@ struct FCS_READ_DATA_PARAM{
 	 bool scale, truncate_max_range, truncate_min_val;
 	 EVENT_DATA_TYPE decades, min_limit;
 	 TransformType transform;
-	 int num_threads; //number of cores to be used for parallel-read of data (channel / core)
+	 int num_threads; //number of cores to be used for parallel-read of data (tasks of row block and channel group / core)
+	 int num_files; //number of files to be parsed concurrently when reading multiple files (e.g. GatingSet::add_fcs), each of which uses num_threads
 	 vector<int64_t> which_lines; //select rows to be read in
+	 SampleType sample_type; //how the rows are sampled when which_lines is of size 1
+	 int64_t which_lines_gap; //the selected rows separated by no more than this number of bytes are read in one I/O
 	 int seed;
 	 bool isTransformed;//record the outcome after parsing
+	 bool use_mmap; //decode directly from the memory-mapped DATA segment instead of reading it into a separate buffer
+	 bool use_simd; //use the vectorized decode kernels when supported by the cpu
 	 FCS_READ_DATA_PARAM(){
 		 scale = false;
 		 truncate_max_range = true;
@@ -41,13 +56,142 @@ struct FCS_READ_DATA_PARAM{
 		 min_limit=-111;
 		 transform =  TransformType::linearize;
 		 num_threads = 1;
+		 num_files = 1;
 		 isTransformed = false;
 		 seed = 1;
+		 sample_type = SampleType::replacement;
+		 which_lines_gap = 65536;
+		 use_mmap = false;
+		 use_simd = true;
 	 }
 
 
 };
 
+/**
+ * Decodes the row-major DATA segment of FCS into col-major events
+ *
+ * All the settings (data type, byte order, bitmasks, transformation and scaling) are
+ * resolved once from the keywords and FCS_READ_DATA_PARAM (see MemCytoFrame::init_data_decoder),
+ * so that any contiguous block of rows can be decoded independently,
+ * which is shared by the full parsing and the streaming (FCSEventStream) of the DATA segment.
+ */
+class FCSDataDecoder{
+public:
+	vector<cytoParam> params;
+	vector<size_t> bits_offset;//bit offset of each parameter within a row
+	size_t nRowSize;//total bits for each row
+	bool is_int;//$DATATYPE I
+	bool isbyteswap;
+	vector<int> iByteOrd;//byte permutation for the legacy mixed endian data, empty otherwise
+	bool isTransformation, scale, fcsPnGtransform;
+	bool transDefinedinKeys;
+	bool truncate_max_range, truncate_min_val;
+	EVENT_DATA_TYPE min_limit;
+	float decade;
+	int num_threads;
+	bool use_simd;//whether to dispatch to the vectorized kernels, which requires is_simd_supported()
+
+	FCSDataDecoder():nRowSize(0),is_int(false),isbyteswap(false),isTransformation(false),scale(false),fcsPnGtransform(false)
+						,transDefinedinKeys(false),truncate_max_range(true),truncate_min_val(false),min_limit(-111),decade(1),num_threads(1),use_simd(false){};
+	unsigned n_cols() const{return params.size();}
+	size_t row_bytes() const{return nRowSize/8;}
+	/**
+	 * decode a contiguous block of rows
+	 *
+	 * @param src the raw bytes starting from the first row of the block
+	 * @param nrow the number of rows to decode
+	 * @param dest the col-major output, where column c starts at dest + c * ld
+	 * @param ld the leading dimension (i.e. number of rows) of dest
+	 * @param realMin (input/output) the running minimum of the decoded values of each column
+	 */
+	void decode(const char * src, size_t nrow, EVENT_DATA_TYPE * dest, size_t ld, vector<EVENT_DATA_TYPE> & realMin) const;
+	/**
+	 * decode one column of a contiguous block of rows
+	 *
+	 * The specialized kernels are selected once for the column based on its data type, byte width, byte order and the transformation settings
+	 * @param c the column index
+	 * @param src the raw bytes starting from the first row of the block
+	 * @param nrow the number of rows to decode
+	 * @param out the contiguous output of the column
+	 * @param colMin (input/output) the running minimum of the column
+	 */
+	void decode_column(unsigned c, const char * src, size_t nrow, EVENT_DATA_TYPE * out, EVENT_DATA_TYPE & colMin) const;
+};
+
+/**
+ * Read-only memory mapping of a byte range of a file
+ *
+ * Used to decode the FCS DATA segment in place without
+ * copying the entire segment into a heap buffer first.
+ * The range is clamped to the actual file size so that a truncated DATA segment
+ * can be detected by the caller instead of faulting on access.
+ */
+class MappedFileRange{
+	void * addr_;//page-aligned start of the mapping
+	size_t map_len_;
+	const char * data_;//start of the requested range
+	size_t len_;
+public:
+	/**
+	 * @param filename the file to be mapped
+	 * @param offset the first byte of the range
+	 * @param len the number of bytes requested
+	 * @param is_sequential whether the range is going to be scanned sequentially (passed to madvise)
+	 */
+	MappedFileRange(const string & filename, int64_t offset, size_t len, bool is_sequential = true);
+	~MappedFileRange();
+	MappedFileRange(const MappedFileRange &) = delete;
+	MappedFileRange & operator=(const MappedFileRange &) = delete;
+	const char * data() const{return data_;}
+	/**
+	 * the number of bytes that are actually mapped, which may be less than requested
+	 * when the file is truncated
+	 */
+	size_t size() const{return len_;}
+};
+
+/**
+ * Read the selected rows of the DATA segment
+ *
+ * The sorted rows are coalesced into contiguous runs (including the unselected rows within the gap),
+ * each of which is read by one positional read (pread), and the runs are read in parallel.
+ * So the sparse selections cost one I/O per run instead of one per row,
+ * and the dense selections become a sequential scan of the DATA segment.
+ *
+ * @param filename the FCS file
+ * @param datastart the offset of the DATA segment
+ * @param dataend the last byte of the DATA segment
+ * @param nRowSizeBytes the number of bytes of each row
+ * @param which_lines the sorted row indices, which may contain duplicates
+ * @param gap_bytes the maximal gap (in bytes) between two selected rows to be read in the same run
+ * @param dest the output buffer of which_lines.size() rows
+ * @param num_threads the number of threads to read the runs
+ */
+void read_fcs_rows(const string & filename, int64_t datastart, int64_t dataend, size_t nRowSizeBytes
+					, const vector<int64_t> & which_lines, int64_t gap_bytes, char * dest, int num_threads = 1);
+
+/**
+ * draw the row indices to be sampled from the DATA segment
+ *
+ * @param nrow the total number of rows
+ * @param nSample the sample size
+ * @param type the sampling method
+ * @param seed the random seed
+ * @return the sorted row indices
+ */
+vector<int64_t> sample_fcs_rows(int64_t nrow, int64_t nSample, SampleType type, int seed);
+
+/**
+ * whether the memory-mapped reader mode is supported on this platform
+ */
+bool is_mmap_supported();
+
+/**
+ * whether the vectorized (AVX2) decode kernels are supported by the cpu, which is detected at runtime
+ */
+bool is_simd_supported();
+
 
 };
 
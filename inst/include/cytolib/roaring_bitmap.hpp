@@ -0,0 +1,79 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * roaring_bitmap.hpp
+ *
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_ROARING_BITMAP_HPP_
+#define INST_INCLUDE_CYTOLIB_ROARING_BITMAP_HPP_
+
+#include "event_bitset.hpp"
+#include <string>
+
+namespace cytolib
+{
+/**
+ * \class ROARING_BITMAP
+ * \brief the compressed event mask
+ *
+ * The events are split into the blocks of 65536 and each non-empty block is kept in whichever
+ * of the three containers is the smallest:
+ *  - ARRAY: the sorted 16-bit offsets of the events (2 bytes/event)
+ *  - RUN: the (start, length - 1) pairs of the consecutive events (4 bytes/run)
+ *  - BITMAP: the 1024 words of the dense mask (8 KB)
+ * so that the sparse and the clustered populations cost a fraction of the dense mask
+ * while the dense ones never cost more than it.
+ */
+class ROARING_BITMAP
+{
+public:
+	static const unsigned BLOCK_BITS = 65536;
+	static const unsigned BLOCK_WORDS = BLOCK_BITS / EVENT_BITSET::WORD_BITS;
+	static const unsigned ARRAY_MAX = 4096;
+	enum CONTAINER_TYPE{ARRAY = 0, RUN = 1, BITMAP = 2};
+	struct CONTAINER
+	{
+		unsigned key;//block index
+		unsigned char type;
+		unsigned card;
+		vector<uint16_t> values;//ARRAY: the offsets, RUN: the (start, length - 1) pairs
+		vector<EVENT_BITSET::WORD> bits;//BITMAP
+	};
+private:
+	vector<CONTAINER> containers;//sorted by key
+	unsigned nBits;
+	unsigned card;
+	unsigned block_words(unsigned key) const;
+	void push_block(unsigned key, const EVENT_BITSET::WORD * block);
+	void expand(const CONTAINER & c, EVENT_BITSET::WORD * block) const;
+public:
+	ROARING_BITMAP():nBits(0),card(0){};
+	explicit ROARING_BITMAP(const EVENT_BITSET & mask);
+	/**
+	 * restore from the byte stream written by serialize
+	 * @param bytes
+	 * @param n the total number of events
+	 */
+	ROARING_BITMAP(const string & bytes, unsigned n);
+	unsigned size() const{return nBits;}
+	unsigned count() const{return card;}
+	const vector<CONTAINER> & get_containers() const{return containers;}
+	EVENT_BITSET to_mask() const;
+	vector<unsigned> to_indices() const;
+	ROARING_BITMAP & operator&=(const ROARING_BITMAP & other);
+	ROARING_BITMAP & operator|=(const ROARING_BITMAP & other);
+	/**
+	 * the compact byte stream of the containers (little-endian)
+	 *
+	 * version(u8) followed by each container as key(u16) type(u8) and
+	 * ARRAY: card - 1(u16), offsets(u16 * card)
+	 * RUN: nRuns - 1(u16), (start(u16), length - 1(u16)) * nRuns
+	 * BITMAP: the words of the block (8 bytes each)
+	 */
+	void serialize(string & bytes) const;
+};
+
+};
+
+#endif /* INST_INCLUDE_CYTOLIB_ROARING_BITMAP_HPP_ */
@@ -40,5 +40,7 @@ void spline_eval_C(int *method, int *nu, double *u, double *v,
 void natural_spline(vector<double>x, vector<double> y, vector<double>& b,vector<double>& c,vector<double>& d);
 void spline_eval(int method, double* u,int nSize,
 		  const vector<double> & x, const vector<double> & y, const vector<double> & b, const vector<double> & c, const vector<double> & d);
+void spline_eval(int method, float* u,int nSize,
+		  const vector<double> & x, const vector<double> & y, const vector<double> & b, const vector<double> & c, const vector<double> & d);
 };
 #endif /* SPLINE_HPP_ */
@@ -325,6 +325,37 @@ BOOST_AUTO_TEST_CASE(flags)
 
 }
 
+BOOST_AUTO_TEST_CASE(h5_handle_cache)
+{
+	if(file_format == FileFormat::H5)
+	{
+	string h5file = cf_disk->copy()->get_uri();
+	H5FileCache::release(h5file);
+	auto n = H5FileCache::size();
+	//the frame and its copy share the same handle
+	H5CytoFrame fr1(h5file);
+	H5CytoFrame fr2(fr1);
+	fr1.get_data(uvec({0, 2}), true);
+	fr2.get_data(uvec({1}), true);
+	BOOST_CHECK_EQUAL(H5FileCache::size(), n + 1);
+
+	//the writable frame coexists with the read-only one
+	H5CytoFrame fr3(h5file, false);
+	EVENT_DATA_VEC dat = fr3.get_data();
+	dat[100] = 100;
+	fr3.set_data(dat);
+	BOOST_CHECK_CLOSE(fr1.get_data()[100], 100, 1e-6);
+	BOOST_CHECK_EQUAL(H5FileCache::size(), n + 1);
+
+	//bounded by the capacity
+	auto cap = H5FileCache::get_capacity();
+	H5FileCache::set_capacity(0);
+	BOOST_CHECK_EQUAL(H5FileCache::size(), 0);
+	BOOST_CHECK_CLOSE(fr2.get_data()[100], 100, 1e-6);
+	H5FileCache::set_capacity(cap);
+	}
+}
+
 BOOST_AUTO_TEST_CASE(set_range)
 {
 	MemCytoFrame fr1 = *fr.copy();
@@ -364,6 +395,266 @@ BOOST_AUTO_TEST_CASE(subset_by_cols)
 
 	BOOST_CHECK_EQUAL(cf->n_cols(), sub_channels.size());
 }
+BOOST_AUTO_TEST_CASE(h5_read_cols)
+{
+	string tmp = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.write_h5(tmp);
+	H5CytoFrame fr1(tmp);
+	EVENT_DATA_VEC dat = fr.get_data();
+	//contiguous runs, unsorted and duplicated columns are all read by one selection
+	for(auto cols : {uvec({0, 1, 2, 5, 6}), uvec({5, 1, 3}), uvec({2, 2, 0}), uvec()})
+		BOOST_CHECK(approx_equal(fr1.get_data(cols, true), dat.cols(cols), "absdiff", 0));
+}
+BOOST_AUTO_TEST_CASE(h5_read_rows)
+{
+	string tmp = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.write_h5(tmp);
+	H5CytoFrame fr1(tmp);
+	EVENT_DATA_VEC dat = fr.get_data();
+	//sparse rows are read by runs whereas the dense ones fall back to full columns
+	uvec sparse = {3, 4, 5, 900, 20, 20};
+	uvec dense = regspace<uvec>(0, 2, fr.n_rows() - 1);
+	uvec cols = {4, 0, 1};
+	for(auto rows : {sparse, dense})
+	{
+		BOOST_CHECK(approx_equal(fr1.get_data(rows, false), dat.rows(rows), "absdiff", 0));
+		BOOST_CHECK(approx_equal(fr1.get_data(rows, cols), dat.submat(rows, cols), "absdiff", 0));
+	}
+	//more scattered runs than one selection takes, which are read by batches
+	uvec scattered = regspace<uvec>(7, 40, fr.n_rows() - 1);
+	BOOST_CHECK(approx_equal(fr1.get_data(scattered, cols), dat.submat(scattered, cols), "absdiff", 0));
+	CytoFrameView cv(CytoFramePtr(new H5CytoFrame(fr1)));
+	cv.rows_(sparse);
+	BOOST_CHECK(approx_equal(cv.get_data(), dat.rows(sparse), "absdiff", 0));
+	BOOST_CHECK_THROW(fr1.get_data(uvec({fr.n_rows()}), false), domain_error);
+}
+BOOST_AUTO_TEST_CASE(h5_row_read_runs)
+{
+	//the rows read from disk for a sparse subset of 10M events
+	hsize_t nrow = 10000000;
+	auto count_read = [nrow](const uvec & rows){
+		hsize_t n = 0;
+		for(const auto & r : H5CytoFrame::row_read_runs(rows, nrow))
+			n += r.second;
+		return n;
+	};
+	arma_rng::set_seed(1);
+	for(uword k : {10000, 100000})
+	{
+		uvec rows = unique(randi<uvec>(k, distr_param(0, int(nrow - 1))));
+		BOOST_CHECK_LT(count_read(rows), 10 * k);
+		BOOST_CHECK_LT(count_read(rows), nrow / 10);
+	}
+	//the evenly spaced rows are read one by one
+	uvec even = regspace<uvec>(0, 1000, nrow - 1);
+	BOOST_CHECK_EQUAL(count_read(even), even.size());
+	//the dense ones as the span
+	uvec dense = regspace<uvec>(100, 2, nrow - 1);
+	auto runs = H5CytoFrame::row_read_runs(dense, nrow);
+	BOOST_REQUIRE_EQUAL(runs.size(), 1);
+	BOOST_CHECK_EQUAL(runs[0].first, 100);
+	BOOST_CHECK_EQUAL(runs[0].second, dense[dense.size() - 1] - 99);
+}
+BOOST_AUTO_TEST_CASE(h5_write_options)
+{
+	string tmp = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	string tmp1 = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.write_h5(tmp);
+	H5WriteOptions opts;
+	opts.chunk_cols = 4;
+	opts.chunk_rows = 1000;
+	opts.shuffle = true;
+	opts.deflate_level = 4;
+	fr.write_to_disk(tmp1, FileFormat::H5, CytoCtx(), opts);
+	{
+		H5File file(tmp1, H5F_ACC_RDONLY);
+		auto plist = file.openDataSet(DATASET_NAME).getCreatePlist();
+		hsize_t chunk_dims[2];
+		plist.getChunk(2, chunk_dims);
+		BOOST_CHECK_EQUAL(chunk_dims[0], 4);
+		BOOST_CHECK_EQUAL(chunk_dims[1], 1000);
+		BOOST_CHECK_EQUAL(plist.getNfilters(), 2);
+	}
+	BOOST_CHECK_LT(fs::file_size(tmp1), fs::file_size(tmp));
+
+	H5CytoFrame fr1(tmp1);
+	uvec rows = {5, 1500, 1501};
+	BOOST_CHECK(approx_equal(fr1.get_data(), fr.get_data(), "absdiff", 0));
+	BOOST_CHECK(approx_equal(fr1.get_data(rows, false), fr.get_data().rows(rows), "absdiff", 0));
+
+	//float64 storage on request keeps the events exactly, at the cost of the larger file than the default float32 one
+	H5WriteOptions opts64;
+	opts64.double_precision = true;
+	string tmp2 = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.write_to_disk(tmp2, FileFormat::H5, CytoCtx(), opts64);
+	H5CytoFrame fr2(tmp2);
+	BOOST_CHECK(approx_equal(fr2.get_data(), fr.get_data(), "absdiff", 0));
+	BOOST_CHECK_GT(fs::file_size(tmp2), fs::file_size(tmp));
+
+	//the subset copies keep the layout and precision of the source
+	BOOST_CHECK(fr1.get_write_options() == opts);
+	BOOST_CHECK(fr2.get_write_options() == opts64);
+	uvec all_rows = sort(regspace<uvec>(0, fr.n_rows() - 1), "descend");
+	uvec cols = sort(regspace<uvec>(0, fr.n_cols() - 1), "descend");
+	for(H5CytoFrame * src : {&fr1, &fr2})
+	{
+		auto cp = src->copy(all_rows, cols);
+		BOOST_CHECK(dynamic_cast<H5CytoFrame &>(*cp).get_write_options() == src->get_write_options());
+		BOOST_CHECK(approx_equal(cp->get_data(), fr.get_data().submat(all_rows, cols), "absdiff", 0));
+	}
+	//the archive of the h5 frame is rewritten in the requested layout, and copied as it is by default
+	pb::CytoFrame fr_pb;
+	string tmp3 = generate_unique_dir(fs::temp_directory_path().string(), "gs") + "/1.h5";
+	H5CytoFrame fr0(tmp);
+	fr0.convertToPb(fr_pb, tmp3, CytoFileOption::copy, CytoCtx(), opts);
+	BOOST_CHECK(H5CytoFrame(tmp3).get_write_options() == opts);
+	BOOST_CHECK(approx_equal(H5CytoFrame(tmp3).get_data(), fr.get_data(), "absdiff", 0));
+	BOOST_CHECK_LT(fs::file_size(tmp3), fs::file_size(tmp));
+	fr0.convertToPb(fr_pb, tmp3, CytoFileOption::copy);
+	BOOST_CHECK(H5CytoFrame(tmp3).get_write_options() == H5WriteOptions());
+}
+BOOST_AUTO_TEST_CASE(h5_set_columns)
+{
+	string tmp = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.write_h5(tmp);
+	H5CytoFrame fr1(tmp, false);
+	EVENT_DATA_VEC dat = fr1.get_data();
+	uvec cols = {3, 0};
+	EVENT_DATA_VEC new_cols = dat.cols(cols) * 2;
+	fr1.set_columns(cols, new_cols);
+	dat.cols(cols) = new_cols;
+	BOOST_CHECK(approx_equal(fr1.get_data(), dat, "absdiff", 0));
+	BOOST_CHECK(approx_equal(fr1.get_column(3), dat.col(3), "absdiff", 0));
+	BOOST_CHECK_THROW(fr1.set_columns(uvec({1, 1}), dat.cols(0, 1)), domain_error);
+
+	fr1.append_data_columns(new_cols);
+	dat.insert_cols(dat.n_cols, new_cols);
+	//the params are not updated by append_data_columns (see append_columns)
+	uvec all = regspace<uvec>(0, dat.n_cols - 1);
+	BOOST_CHECK(approx_equal(fr1.get_data(all, true), dat, "absdiff", 0));
+}
+BOOST_AUTO_TEST_CASE(h5_copy_subset)
+{
+	string tmp = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.write_h5(tmp);
+	H5CytoFrame fr1(tmp, true);
+	MemCytoFrame fr2(fr1);
+	//small buffer to copy by many blocks
+	auto buf_size = H5CytoFrame::copy_buffer_size;
+	H5CytoFrame::copy_buffer_size = 1000;
+	uvec rows = {9, 2, 2, 100, 5000, 3};
+	uvec cols = {4, 1};
+	auto cp = fr1.copy(rows, cols);
+	auto cp_mem = fr2.copy(rows, cols);
+	BOOST_CHECK(approx_equal(cp->get_data(), cp_mem->get_data(), "absdiff", 0));
+	BOOST_CHECK_EQUAL_COLLECTIONS(cp->get_channels().begin(), cp->get_channels().end()
+								, cp_mem->get_channels().begin(), cp_mem->get_channels().end());
+	BOOST_CHECK(approx_equal(fr1.copy(cols, false)->get_data(), fr2.copy(cols, false)->get_data(), "absdiff", 0));
+	//scattered rows in reverse, whose blocks are shrunk to bound the rows read from disk
+	uvec scattered = sort(regspace<uvec>(3, 41, fr1.n_rows() - 1), "descend");
+	BOOST_CHECK(approx_equal(fr1.copy(scattered, cols)->get_data(), fr2.copy(scattered, cols)->get_data(), "absdiff", 0));
+	uvec all = regspace<uvec>(0, 2, fr1.n_rows() - 1);
+	BOOST_CHECK(approx_equal(fr1.copy(all, true)->get_data(), fr2.copy(all, true)->get_data(), "absdiff", 0));
+	H5CytoFrame::copy_buffer_size = buf_size;
+}
+BOOST_AUTO_TEST_CASE(h5_concurrent_read)
+{
+	//the enlarged frame so that the time is spent on the events rather than on opening the files
+	MemCytoFrame fr_large(fr);
+	fr_large.set_data(repmat(fr.get_data(), 20, 1));
+	//half of the samples are chunked and compressed, which are inflated outside of the h5 lock as well
+	H5WriteOptions opts;
+	opts.chunk_cols = 4;
+	opts.chunk_rows = 10000;
+	opts.shuffle = true;
+	opts.deflate_level = 4;
+	unsigned nSample = 8;
+	vector<string> files(nSample);
+	for(unsigned i = 0; i < nSample; i++)
+	{
+		files[i] = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+		fr_large.write_h5(files[i], i % 2 ? opts : H5WriteOptions());
+	}
+	H5CytoFrame::direct_read = false;
+	EVENT_DATA_VEC dat = H5CytoFrame(files[0]).get_data();
+	H5CytoFrame::direct_read = true;
+	BOOST_CHECK(approx_equal(H5CytoFrame(files[0]).get_data(), dat, "absdiff", 0));
+	BOOST_CHECK(approx_equal(H5CytoFrame(files[1]).get_data(), dat, "absdiff", 0));
+
+	auto load = [&files, &dat, nSample](unsigned nThread){
+		H5FileCache::clear();
+		double start = gettime();
+		vector<future<bool>> res;
+		for(unsigned t = 0; t < nThread; t++)
+			res.push_back(async(launch::async, [&files, &dat, nThread, nSample, t](){
+				bool is_equal = true;
+				for(unsigned i = t; i < nSample; i += nThread)
+				{
+					H5CytoFrame fr1(files[i]);
+					is_equal = is_equal && approx_equal(fr1.get_data(), dat, "absdiff", 0);
+				}
+				return is_equal;
+			}));
+		for(auto & r : res)
+			BOOST_CHECK(r.get());
+		return gettime() - start;
+	};
+	//the reads through h5 are serialized by the h5 lock, whereas the direct ones are not
+	unsigned nThread = 4;
+	H5CytoFrame::direct_read = false;
+	double t_h5 = load(nThread);
+	H5CytoFrame::direct_read = true;
+	double t_direct1 = load(1);
+	double t_direct = load(nThread);
+	cout << "load " << nSample << " samples by " << nThread << " threads through h5: " << t_h5
+			<< ", directly: " << t_direct << " (1 thread: " << t_direct1 << ")" << endl;
+	BOOST_WARN_LT(t_direct, t_h5);
+	BOOST_WARN_LT(t_direct, t_direct1);
+
+	//the events are rewritten while being read, which never yields the mix of the old and new chunks
+	EVENT_DATA_VEC dat2 = dat * 2;//exact in float32
+	for(unsigned i : {0, 1})
+	{
+		auto reader = async(launch::async, [&files, &dat, &dat2, i](){
+			bool is_valid = true;
+			for(unsigned j = 0; j < 20; j++)
+			{
+				EVENT_DATA_VEC res = H5CytoFrame(files[i]).get_data();
+				is_valid = is_valid && (approx_equal(res, dat, "absdiff", 0) || approx_equal(res, dat2, "absdiff", 0));
+			}
+			return is_valid;
+		});
+		H5CytoFrame fr1(files[i], false);
+		for(unsigned j = 0; j < 10; j++)
+			fr1.set_data(j % 2 ? dat : dat2);
+		BOOST_CHECK(reader.get());
+	}
+}
+BOOST_AUTO_TEST_CASE(h5_lazy_meta)
+{
+	string tmp = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.set_pheno_data("name", "lazy");
+	fr.write_h5(tmp);
+	//keywords and pdata are loaded on the first access
+	H5CytoFrame fr1(tmp, false);
+	BOOST_CHECK_EQUAL(fr1.n_rows(), fr.n_rows());
+	BOOST_CHECK_EQUAL(fr1.get_channels()[1], fr.get_channels()[1]);
+	BOOST_CHECK_EQUAL(fr1.get_keyword("$P2N"), fr.get_keyword("$P2N"));
+	BOOST_CHECK_EQUAL(fr1.get_keywords().size(), fr.get_keywords().size());
+	BOOST_CHECK_EQUAL(fr1.get_pheno_data("name"), "lazy");
+	//copy of the unloaded frame carries the full meta
+	H5CytoFrame fr2(tmp, false);
+	MemCytoFrame fr3(fr2);
+	BOOST_CHECK_EQUAL(fr3.get_keywords().size(), fr.get_keywords().size());
+	BOOST_CHECK_EQUAL(fr3.get_pheno_data("name"), "lazy");
+
+	fr1.set_keyword("lazy", "1");
+	fr1.flush_meta();
+	fr1.set_keyword("lazy", "2");
+	fr1.load_meta();
+	BOOST_CHECK_EQUAL(fr1.get_keyword("lazy"), "1");
+	BOOST_CHECK_EQUAL(H5CytoFrame(tmp).get_keyword("lazy"), "1");
+}
 BOOST_AUTO_TEST_CASE(rownames)
 {
 	auto cf1 = cf_disk->copy();
@@ -587,6 +878,41 @@ BOOST_AUTO_TEST_CASE(deep_copy)
 
 
 
+}
+BOOST_AUTO_TEST_CASE(keywords)
+{
+	KEY_WORDS kw = fr.get_keywords();
+	//insertion order is preserved
+	BOOST_CHECK(kw.getPairs() == fr.get_keywords().getPairs());
+	BOOST_CHECK_EQUAL(kw.find("$P3N")->second, fr.get_channels()[2]);
+	BOOST_CHECK(kw.find("$p3n") == kw.end());
+	kw.set_ignore_case(true);
+	BOOST_CHECK_EQUAL(kw.find("$p3n")->second, fr.get_channels()[2]);
+	kw.set_ignore_case(false);
+
+	auto pos = kw.find("$P3N") - kw.begin();
+	kw.rename("$P3N", "newkey");
+	BOOST_CHECK(kw.find("$P3N") == kw.end());
+	BOOST_CHECK_EQUAL(kw.find("newkey") - kw.begin(), pos);
+	auto pos_par = kw.find("$PAR") - kw.begin();
+	kw.erase("$PAR");
+	BOOST_CHECK(kw.find("$PAR") == kw.end());
+	BOOST_CHECK_EQUAL(kw.find("newkey") - kw.begin(), pos_par < pos?pos - 1:pos);
+	BOOST_CHECK_EQUAL(kw.size(), fr.get_keywords().size() - 1);
+
+	//positional updates keep the index in sync
+	kw.set_value(pos, "newval");
+	BOOST_CHECK_EQUAL(kw.find("newkey")->second, "newval");
+	BOOST_CHECK_EQUAL(kw[pos].second, "newval");
+	auto n = kw.size();
+	kw.resize(n + 1);
+	kw.set_pair(n, {"appended", "1"});
+	kw.set_pair(pos, {"replaced", "2"});
+	BOOST_CHECK(kw.find("newkey") == kw.end());
+	BOOST_CHECK_EQUAL(kw.find("replaced") - kw.begin(), pos);
+	const KEY_WORDS & ckw = kw;
+	BOOST_CHECK_EQUAL(ckw.find("appended")->second, "1");
+	BOOST_CHECK_EQUAL(ckw[n].first, "appended");
 }
 BOOST_AUTO_TEST_CASE(flush_meta)
 {
@@ -41,6 +41,14 @@ BOOST_AUTO_TEST_CASE(constructor) {
 //	BOOST_CHECK_EXCEPTION(GatingSet(file_paths, config, fmt, "");, domain_error,
 //			[](const exception & ex) {return string(ex.what()).find("already exists") != string::npos;});
 }
+BOOST_AUTO_TEST_CASE(concurrent_files) {
+	config.data.num_files = 2;
+	GatingSet cs1(file_paths, config, FileFormat::MEM);
+	vector<string> samples = cs.get_sample_uids();
+	BOOST_CHECK(samples == cs1.get_sample_uids());
+	for(auto sn : samples)
+		BOOST_CHECK(approx_equal(cs.get_cytoframe_view_ref(sn).get_data(), cs1.get_cytoframe_view_ref(sn).get_data(), "absdiff", 0));
+}
 BOOST_AUTO_TEST_CASE(copy) {
 	GatingSet cs1 = cs.copy();
 	vector<string> samples = cs.get_sample_uids();
@@ -1,6 +1,7 @@
 #include <cytolib/GatingSet.hpp>
 #include <experimental/filesystem>
 #include <regex>
+#include <random>
 
 #include "fixture.hpp"
 using namespace cytolib;
@@ -107,6 +108,187 @@ BOOST_AUTO_TEST_CASE(quadgate) {
 					gh->getNodeProperty(gh->getNodeID("D")).getCounts());
 
 }
+BOOST_AUTO_TEST_CASE(float32_precision) {
+	//gate the float32 events (i.e. h5 storage or CYTOLIB_FLOAT_EVENTS) and check the counts against the float64 reference computed by hand
+	GatingSet gs1({"../flowWorkspace/output/s5a01.fcs"}, FCS_READ_PARAM(), FileFormat::MEM);
+	auto gh = gs1.begin()->second;
+	auto cf = MemCytoFrame(*(gh->get_cytoframe_view().get_cytoframe_ptr()));
+	string chnl = "FSC-H";
+	unsigned n = cf.n_rows();
+	EVENT_DATA_TYPE * x = cf.get_data_memptr(chnl, ColType::channel);
+	vector<double> x64(x, x + n);
+#ifndef CYTOLIB_FLOAT_EVENTS
+	//round the events the way the float32 h5 storage does
+	for(unsigned i = 0; i < n; i++)
+		x[i] = float(x[i]);
+#endif
+	//the calibration table is evaluated in the precision of the events
+	biexpTrans trans;
+	trans.transforming(x, n);
+	trans.getCalTbl().transforming(&x64[0], n);
+
+	vector<double> sorted(x64);
+	sort(sorted.begin(), sorted.end());
+	double lo = sorted[n / 4], hi = sorted[3 * n / 4];
+	shared_ptr<rangeGate> g(new rangeGate());
+	g->setParam(paramRange(lo, hi, chnl));
+	auto id = gh->addGate(g, 0, "test");
+	gh->gating(cf, 0, true, true);
+
+	int count64 = count_if(x64.begin(), x64.end(), [lo, hi](double v){return v >= lo && v <= hi;});
+	int count32 = gh->getNodeProperty(id).getCounts();
+	BOOST_TEST_MESSAGE("float64 = " + to_string(count64) + ", float32 = " + to_string(count32));
+	BOOST_CHECK_GT(count64, 0);
+	BOOST_CHECK_LE(abs(count32 - count64), max(1, count64 / 1000));
+}
+BOOST_AUTO_TEST_CASE(ellipsoid_gate) {
+	//gate the events against the ellipse in 256 scale after mapping them back through the inverse transformation
+	GatingSet gs1({"../flowWorkspace/output/s5a01.fcs"}, FCS_READ_PARAM(), FileFormat::MEM);
+	auto cf = MemCytoFrame(*(gs1.begin()->second->get_cytoframe_view().get_cytoframe_ptr()));
+	string chx = "FSC-H", chy = "SSC-H";
+	trans_local trans;
+	trans.addTrans(chx, TransPtr(new biexpTrans()));
+	trans.addTrans(chy, TransPtr(new biexpTrans()));
+	vector<coordinate> antipodal = {coordinate(80, 120), coordinate(160, 120), coordinate(120, 100), coordinate(120, 140)};
+	ELLIPSE_FORM form = ellipse_form(120, 120, 40, 20, 0);
+
+	//the events around the ellipse in 256 scale, mapped to the data scale the way the gate is (256 -> raw -> data)
+	unsigned n = cf.n_rows();
+	mt19937 gen(1);
+	uniform_real_distribution<double> unif(60, 180);
+	vector<EVENT_DATA_TYPE> x256(n), y256(n);
+	for(unsigned i = 0; i < n; i++)
+	{
+		x256[i] = unif(gen);
+		y256[i] = unif(gen);
+	}
+	auto to_data = [&trans, n](const string & chnl, vector<EVENT_DATA_TYPE> v){
+		TransPtr t = trans.getTran(chnl);
+		TransPtr t256 = t->clone();
+		t256->setTransformedScale(256);
+		t256->getInverseTransformation()->transforming(&v[0], n);
+		t->transforming(&v[0], n);
+		return v;
+	};
+	vector<EVENT_DATA_TYPE> xdata = to_data(chx, x256), ydata = to_data(chy, y256);
+	INDICE_TYPE parentInd(n), expected;
+	for(unsigned i = 0; i < n; i++)
+		parentInd[i] = i;
+	in_ellipse(&x256[0], &y256[0], form, parentInd, false, expected);
+	BOOST_REQUIRE_GT(expected.size(), 0);
+
+	auto set_events = [&](EVENT_DATA_TYPE shift){
+		EVENT_DATA_TYPE * x = cf.get_data_memptr(chx, ColType::channel);
+		EVENT_DATA_TYPE * y = cf.get_data_memptr(chy, ColType::channel);
+		for(unsigned i = 0; i < n; i++)
+		{
+			x[i] = xdata[i] + shift;
+			y[i] = ydata[i] + shift;
+		}
+	};
+	set_events(0);
+	ellipsoidGate g(antipodal, {chx, chy});
+	BOOST_CHECK(g.isAnalytic());
+	g.transforming(trans);
+	BOOST_CHECK(g.hasDataScale());
+	auto res = g.gating(cf, parentInd);
+	g.setAnalytic(false);
+	auto res_poly = g.gating(cf, parentInd);
+
+	int tol = max<int>(5, expected.size() / 100);
+	BOOST_CHECK_LE(abs(int(res.size()) - int(expected.size())), tol);
+	BOOST_CHECK_LE(abs(int(res_poly.size()) - int(expected.size())), tol);
+	//the misses of the analytic test are down to the round trip of the transformations, i.e. on the boundary
+	vector<unsigned> diff;
+	set_symmetric_difference(res.begin(), res.end(), expected.begin(), expected.end(), back_inserter(diff));
+	for(auto i : diff)
+	{
+		double dx = (x256[i] - 120) / 40, dy = (y256[i] - 120) / 20;
+		BOOST_CHECK_CLOSE(dx * dx + dy * dy, 1.0, 5);
+	}
+
+	//the gate loaded from the archive finds the way back to 256 scale from the local transformations (as GatingHierarchy::gating does)
+	pb::gate gate_pb;
+	ellipsoidGate g0(antipodal, {chx, chy});
+	g0.transforming(trans);
+	g0.convertToPb(gate_pb);
+	ellipsoidGate g1(gate_pb);
+	BOOST_CHECK(g1.isAnalytic());
+	BOOST_CHECK(!g1.isDataScaleSet());
+	g1.setDataScale(trans);
+	BOOST_CHECK(g1.hasDataScale());
+	auto res_loaded = g1.gating(cf, parentInd);
+	BOOST_CHECK_EQUAL_COLLECTIONS(res.begin(), res.end(), res_loaded.begin(), res_loaded.end());
+
+	//the shifted gate falls back to the polygon, both before and after the archive
+	EVENT_DATA_TYPE shift = 50;
+	set_events(shift);
+	ellipsoidGate g2(antipodal, {chx, chy});
+	g2.transforming(trans);
+	g2.setShift({shift, shift});
+	g2.shiftGate();
+	BOOST_CHECK(!g2.isDataScaleSet());
+	g2.setDataScale(trans);
+	BOOST_CHECK(g2.isDataScaleSet());
+	BOOST_CHECK(!g2.hasDataScale());
+	auto res_shifted = g2.gating(cf, parentInd);
+	g2.convertToPb(gate_pb);
+	ellipsoidGate g3(gate_pb);
+	g3.setDataScale(trans);
+	BOOST_CHECK(!g3.hasDataScale());
+	auto res_shifted_loaded = g3.gating(cf, parentInd);
+	//only the events right on the polygon may differ by the rounding of the shift
+	auto n_diff = [](const INDICE_TYPE & a, const INDICE_TYPE & b){
+		vector<unsigned> d;
+		set_symmetric_difference(a.begin(), a.end(), b.begin(), b.end(), back_inserter(d));
+		return d.size();
+	};
+	BOOST_CHECK_LE(n_diff(res_poly, res_shifted), 5);
+	BOOST_CHECK_LE(n_diff(res_shifted, res_shifted_loaded), 5);
+}
+BOOST_AUTO_TEST_CASE(indices_pb) {
+	//archive the gated events in each layout that the readers have to load
+	unsigned n = 200000;
+	EVENT_BITSET sparse(n), clustered(n);
+	for(unsigned i = 0; i < n; i += 1000)
+		sparse.set(i);
+	for(unsigned i = 20000; i < 150000; i++)
+		clustered.set(i);
+	shared_ptr<rangeGate> g(new rangeGate());
+	g->setParam(paramRange(0, 1, "FSC-H"));
+	auto archive = [&g](const EVENT_BITSET & mask){
+		nodeProperties np;
+		np.setGate(g);
+		np.setIndices(mask);
+		pb::nodeProperties np_pb;
+		np.convertToPb(np_pb, false);
+		return np_pb;
+	};
+	//the legacy INT and BOOL layouts by default
+	auto np_pb = archive(sparse);
+	BOOST_CHECK_EQUAL(np_pb.indices().indtype(), pb::INT);
+	BOOST_CHECK(INTINDICES(np_pb.indices()).getMask() == sparse);
+	BOOST_CHECK(nodeProperties(np_pb).getMask() == sparse);
+
+	np_pb = archive(clustered);
+	BOOST_CHECK_EQUAL(np_pb.indices().indtype(), pb::BOOL);
+	BOOST_CHECK_EQUAL(np_pb.indices().bind().size(), (n + 7) / 8);
+	BOOST_CHECK(BOOLINDICES(np_pb.indices()).getMask() == clustered);
+	BOOST_CHECK(nodeProperties(np_pb).getMask() == clustered);
+
+	//the compressed stream on request
+	g_compress_indices = true;
+	for(auto mask : {sparse, clustered})
+	{
+		np_pb = archive(mask);
+		BOOST_CHECK_EQUAL(np_pb.indices().indtype(), pb::BOOL);
+		BOOST_CHECK_LT(np_pb.indices().bind().size(), (n + 7) / 8);
+		nodeProperties np(np_pb);
+		BOOST_CHECK(np.getMask() == mask);
+		BOOST_CHECK_EQUAL(np.getCounts(), mask.count());
+	}
+	g_compress_indices = false;
+}
 BOOST_AUTO_TEST_CASE(serialize) {
 	GatingSet gs1 = gs.copy();
 	/*
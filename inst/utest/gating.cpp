@@ -0,0 +1,396 @@
+#include <cytolib/in_polygon.hpp>
+#include <cytolib/in_ellipse.hpp>
+#include <cytolib/ellipse2points.hpp>
+#include <cytolib/roaring_bitmap.hpp>
+#include <random>
+#include "fixture.hpp"
+using namespace cytolib;
+
+/*
+ * the scalar crossing-number test that in_polygon must reproduce bit-exactly
+ */
+void in_polygon_scalar(EVENT_DATA_TYPE * xdata, EVENT_DATA_TYPE * ydata, const vector<CYTO_POINT> & vertices, INDICE_TYPE & parentInd, bool is_negated, INDICE_TYPE &res)
+{
+	double p_y_max = max_element(vertices.begin(), vertices.end(),[](const CYTO_POINT & v1, const CYTO_POINT & v2){return v1.y < v2.y;})->y;
+	for(auto i : parentInd)
+	{
+		unsigned counter = 0;
+		for(auto p1 = vertices.begin(), p2 = p1 + 1; p1 < vertices.end(); p1++,p2++)
+		{
+			if (p2 == vertices.end())
+				p2 = vertices.begin();
+			const CYTO_POINT *  p_bottom = &(*p1);
+			const CYTO_POINT *  p_top = &(*p2);
+			if(p_bottom->y > p_top->y)
+				swap(p_bottom, p_top);
+			const CYTO_POINT *  p_left = p_bottom;
+			const CYTO_POINT *  p_right = p_top;
+			if(p_left->x > p_right->x)
+				swap(p_left, p_right);
+
+			if(ydata[i] >= p_bottom->y && ydata[i] < p_top->y &&xdata[i] <= p_right->x && p2->y != p1->y)
+			{
+				EVENT_DATA_TYPE xinters = (ydata[i]-p1->y)*(p2->x-p1->x)/(p2->y-p1->y)+p1->x;
+				if(xinters==xdata[i])
+				{
+				  counter=1;
+				  break;
+				}
+				if (xinters > xdata[i])counter++;
+			}
+			else if(ydata[i] == p_y_max)
+			{
+				if(p_top->y == ydata[i])
+				{
+				  if(p_bottom->y == ydata[i])
+					  counter = xdata[i] >= p_left->x && xdata[i] <= p_right->x;
+				  else
+					  counter = xdata[i] == p_top->x;
+				}
+				break;
+			}
+		}
+		bool isIn =((counter % 2) != 0);
+		if(isIn != is_negated)
+			res.push_back(i);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE(gating)
+BOOST_AUTO_TEST_CASE(polygon_edge_table)
+{
+	mt19937 gen(1);
+	uniform_real_distribution<double> unif(-5, 5);
+	for(int iter = 0; iter < 1000; iter++)
+	{
+		//integer grids generate plenty of the events on the vertices, edges and the top level
+		bool is_grid = iter % 2;
+		auto rnd = [&](){return is_grid ? EVENT_DATA_TYPE(int(gen() % 11) - 5) : EVENT_DATA_TYPE(unif(gen));};
+		unsigned nVert = 1 + gen() % 12;
+		vector<CYTO_POINT> vertices(nVert);
+		for(auto & v : vertices)
+			v = CYTO_POINT(rnd(), rnd());
+
+		unsigned nEvents = 1 + gen() % 1000;
+		vector<EVENT_DATA_TYPE> x(nEvents), y(nEvents);
+		for(unsigned i = 0; i < nEvents; i++)
+		{
+			if(gen() % 4 == 0)
+			{
+				auto & v = vertices[gen() % nVert];
+				x[i] = v.x;
+				y[i] = v.y;
+			}
+			else
+			{
+				x[i] = rnd();
+				y[i] = rnd();
+			}
+		}
+		INDICE_TYPE parentInd;
+		for(unsigned i = 0; i < nEvents; i++)
+			if(gen() % 5)
+				parentInd.push_back(i);
+		for(bool is_negated : {false, true})
+		{
+			INDICE_TYPE res, res_scalar;
+			in_polygon(x.data(), y.data(), vertices, parentInd, is_negated, res);
+			in_polygon_scalar(x.data(), y.data(), vertices, parentInd, is_negated, res_scalar);
+			BOOST_REQUIRE_EQUAL_COLLECTIONS(res.begin(), res.end(), res_scalar.begin(), res_scalar.end());
+		}
+	}
+}
+BOOST_AUTO_TEST_CASE(polygon_grid)
+{
+	mt19937 gen(2);
+	uniform_real_distribution<double> unif(0, 1);
+	for(int iter = 0; iter < 500; iter++)
+	{
+		//star shaped polygons like the interpolated ellipses and random (self-intersecting) ones on the integer grid
+		bool is_grid = iter % 2;
+		unsigned nVert = 3 + gen() % 200;
+		vector<CYTO_POINT> vertices(nVert);
+		for(unsigned i = 0; i < nVert; i++)
+		{
+			if(is_grid)
+				vertices[i] = CYTO_POINT(int(gen() % 21) - 10, int(gen() % 21) - 10);
+			else
+			{
+				double a = i * 2 * M_PI / nVert;
+				double r = 1 + 3 * unif(gen);
+				vertices[i] = CYTO_POINT(r * cos(a) + 100, r * sin(a));
+			}
+		}
+		unsigned nEvents = 2000;
+		vector<EVENT_DATA_TYPE> x(nEvents), y(nEvents);
+		for(unsigned i = 0; i < nEvents; i++)
+		{
+			auto & p1 = vertices[gen() % nVert];
+			auto & p2 = vertices[gen() % nVert];
+			switch(gen() % 3)
+			{
+			case 0://on the vertices and the segments between them
+			{
+				double t = (gen() % 9) / 8.0;
+				x[i] = p1.x + (p2.x - p1.x) * t;
+				y[i] = p1.y + (p2.y - p1.y) * t;
+				break;
+			}
+			case 1:
+				x[i] = is_grid ? int(gen() % 25) - 12 : 95 + 10 * unif(gen);
+				y[i] = is_grid ? int(gen() % 25) - 12 : 10 * unif(gen) - 5;
+				break;
+			default:
+				x[i] = is_grid ? 30 * unif(gen) - 15 : 95 + 10 * unif(gen);
+				y[i] = is_grid ? 30 * unif(gen) - 15 : 10 * unif(gen) - 5;
+			}
+		}
+		INDICE_TYPE parentInd(nEvents);
+		for(unsigned i = 0; i < nEvents; i++)
+			parentInd[i] = i;
+		POLYGON_EDGES edges(vertices);
+		POLYGON_GRID grid(vertices, iter % 5 == 0 ? 1 + gen() % 300 : 0);
+		BOOST_CHECK(grid.is_built_from(vertices));
+		INDICE_TYPE res, res_grid;
+		in_polygon(x.data(), y.data(), edges, parentInd, false, res);
+		in_polygon(x.data(), y.data(), grid, parentInd, false, res_grid);
+		BOOST_REQUIRE_EQUAL_COLLECTIONS(res.begin(), res.end(), res_grid.begin(), res_grid.end());
+	}
+}
+BOOST_AUTO_TEST_CASE(ellipse_vs_polygon)
+{
+	mt19937 gen(3);
+	uniform_real_distribution<double> unif(0, 1);
+	for(int iter = 0; iter < 100; iter++)
+	{
+		//antipodal points in 256 scale
+		float mu_x = 50 + 150 * unif(gen), mu_y = 50 + 150 * unif(gen);
+		float a = 10 + 40 * unif(gen), b = 10 + 40 * unif(gen), alpha = M_PI * unif(gen);
+		vector<float> x = {mu_x + a * cos(alpha), mu_x - a * cos(alpha), mu_x - b * sin(alpha), mu_x + b * sin(alpha)};
+		vector<float> y = {mu_y + a * sin(alpha), mu_y - a * sin(alpha), mu_y + b * cos(alpha), mu_y - b * cos(alpha)};
+		ellipse_parsed parsed = parseEllipse(x, y);
+		ELLIPSE_FORM form = ellipse_form(parsed.mu_x, parsed.mu_y, parsed.a, parsed.b, parsed.alpha);
+		unsigned nVert = 100;
+		matrix poly = toPoly(parsed, nVert);
+		vector<CYTO_POINT> vertices(nVert);
+		for(unsigned i = 0; i < nVert; i++)
+			vertices[i] = CYTO_POINT(poly.x[i], poly.y[i]);
+		auto q = [&](EVENT_DATA_TYPE px, EVENT_DATA_TYPE py){
+			double dx = px - form.mu_x, dy = py - form.mu_y;
+			return dx * dx * form.aa + dx * dy * (form.bb + form.cc) + dy * dy * form.dd;
+		};
+		//the polygon is inscribed, so the events in between are within the chords (the closest points being the mid points)
+		double q_min = 1;
+		for(unsigned i = 0; i < nVert; i++)
+		{
+			auto & p1 = vertices[i];
+			auto & p2 = vertices[(i + 1) % nVert];
+			q_min = min(q_min, q((p1.x + p2.x) / 2, (p1.y + p2.y) / 2));
+		}
+		//the documented bound (see ellipsoidGate::setAnalytic)
+		double bound = cos(M_PI * max(parsed.a, parsed.b) / (nVert * min(parsed.a, parsed.b)));
+		BOOST_CHECK_GE(q_min, bound * bound * (1 - 1e-4));
+
+		unsigned nEvents = 20000;
+		vector<EVENT_DATA_TYPE> ex(nEvents), ey(nEvents);
+		INDICE_TYPE parentInd(nEvents);
+		for(unsigned i = 0; i < nEvents; i++)
+		{
+			ex[i] = mu_x + 120 * (unif(gen) - 0.5);
+			ey[i] = mu_y + 120 * (unif(gen) - 0.5);
+			parentInd[i] = i;
+		}
+		INDICE_TYPE res_ellipse, res_poly;
+		in_ellipse(ex.data(), ey.data(), form, parentInd, false, res_ellipse);
+		in_polygon(ex.data(), ey.data(), vertices, parentInd, false, res_poly);
+		BOOST_CHECK_GT(res_ellipse.size(), 0);
+		vector<unsigned> diff;
+		set_symmetric_difference(res_ellipse.begin(), res_ellipse.end(), res_poly.begin(), res_poly.end(), back_inserter(diff));
+		for(auto i : diff)
+		{
+			BOOST_CHECK_GE(q(ex[i], ey[i]), q_min * (1 - 1e-4));
+			BOOST_CHECK_LE(q(ex[i], ey[i]), 1 + 1e-4);
+		}
+	}
+}
+BOOST_AUTO_TEST_CASE(ellipse_form_exact)
+{
+	//the vectorized test must reproduce the scalar quadratic form bit-exactly, including the events right on the ellipse
+	mt19937 gen(5);
+	uniform_real_distribution<double> unif(0, 1);
+	for(int iter = 0; iter < 100; iter++)
+	{
+		ELLIPSE_FORM form = ellipse_form(100 * unif(gen), 100 * unif(gen), 1 + 20 * unif(gen), 1 + 20 * unif(gen), M_PI * unif(gen));
+		unsigned n = gen() % 64;
+		vector<EVENT_DATA_TYPE> x(n), y(n);
+		for(unsigned i = 0; i < n; i++)
+		{
+			double a = 2 * M_PI * unif(gen), r = gen() % 2 ? 1 : 2 * unif(gen);
+			x[i] = form.mu_x + r * 20 * cos(a);
+			y[i] = form.mu_y + r * 20 * sin(a);
+		}
+		vector<unsigned char> isIn(n);
+		in_ellipse(x.data(), y.data(), n, form, isIn.data());
+		for(unsigned i = 0; i < n; i++)
+		{
+			EVENT_DATA_TYPE dx = x[i] - form.mu_x;
+			EVENT_DATA_TYPE dy = y[i] - form.mu_y;
+			bool expected = (dx * dx * form.aa + dx * dy * form.cc + dx * dy * form.bb + dy * dy * form.dd) <= form.rhs;
+			BOOST_REQUIRE_EQUAL(bool(isIn[i]), expected);
+		}
+	}
+}
+BOOST_AUTO_TEST_CASE(event_bitset)
+{
+	mt19937 gen(4);
+	for(unsigned nEvents : {0u, 1u, 63u, 64u, 65u, 1000u, 4097u})
+	{
+		//the sparse, dense and the empty masks
+		auto rnd = [&](unsigned density){
+			vector<bool> res(nEvents);
+			for(unsigned i = 0; i < nEvents; i++)
+				res[i] = gen() % 8 < density;
+			return res;
+		};
+		for(unsigned density : {0u, 1u, 4u, 8u})
+		{
+			vector<bool> a = rnd(density), b = rnd(4);
+			EVENT_BITSET ma(a), mb(b);
+			BOOST_CHECK(ma.to_bool() == a);
+			BOOST_CHECK_EQUAL(ma.count(), count(a.begin(), a.end(), true));
+			BOOST_CHECK_EQUAL(ma.any(), ma.count() > 0);
+			INDICE_TYPE ind = ma.to_indices();
+			BOOST_CHECK(EVENT_BITSET(ind, nEvents) == ma);
+
+			vector<bool> r_and(nEvents), r_or(nEvents), r_and_not(nEvents), r_or_not(nEvents), r_flip(nEvents);
+			for(unsigned i = 0; i < nEvents; i++)
+			{
+				r_and[i] = a[i] && b[i];
+				r_or[i] = a[i] || b[i];
+				r_and_not[i] = a[i] && !b[i];
+				r_or_not[i] = a[i] || !b[i];
+				r_flip[i] = !a[i];
+			}
+			BOOST_CHECK((EVENT_BITSET(a) &= mb).to_bool() == r_and);
+			BOOST_CHECK((EVENT_BITSET(a) |= mb).to_bool() == r_or);
+			BOOST_CHECK(EVENT_BITSET(a).and_not(mb).to_bool() == r_and_not);
+			//the tail bits must stay clear
+			EVENT_BITSET m_or_not = EVENT_BITSET(a).or_not(mb);
+			BOOST_CHECK(m_or_not.to_bool() == r_or_not);
+			BOOST_CHECK_EQUAL(m_or_not.count(), count(r_or_not.begin(), r_or_not.end(), true));
+			EVENT_BITSET m_flip = EVENT_BITSET(a).flip();
+			BOOST_CHECK(m_flip.to_bool() == r_flip);
+			BOOST_CHECK_EQUAL(m_flip.count(), nEvents - ma.count());
+
+			//word-level gating against the indices loop
+			vector<EVENT_DATA_TYPE> x(nEvents);
+			for(auto & v : x)
+				v = EVENT_DATA_TYPE(gen() % 11);
+			auto isIn = [&x](unsigned i){return (x[i] >= 3) & (x[i] <= 7);};
+			for(bool is_negated : {false, true})
+			{
+				INDICE_TYPE res;
+				for(auto i : ind)
+					if(isIn(i) != is_negated)
+						res.push_back(i);
+				EVENT_BITSET child;
+				gate_mask(ma, is_negated, child, isIn);
+				BOOST_CHECK_EQUAL(child.size(), nEvents);
+				INDICE_TYPE res_mask = child.to_indices();
+				BOOST_CHECK_EQUAL_COLLECTIONS(res.begin(), res.end(), res_mask.begin(), res_mask.end());
+			}
+		}
+	}
+	EVENT_BITSET m1(10), m2(11);
+	BOOST_CHECK_THROW(m1 &= m2, domain_error);
+}
+BOOST_AUTO_TEST_CASE(roaring_bitmap)
+{
+	mt19937 gen(5);
+	//spans the partial last block and a few full ones
+	for(unsigned nEvents : {0u, 100u, 65536u, 200003u})
+	{
+		//sparse, clustered, dense and full populations pick the array, run and bitmap containers
+		auto rnd = [&](int kind){
+			EVENT_BITSET res(nEvents);
+			unsigned i = 0;
+			while(i < nEvents)
+			{
+				switch(kind)
+				{
+				case 0:
+					if(gen() % 100 == 0)
+						res.set(i);
+					i++;
+					break;
+				case 1:
+				{
+					unsigned len = 1 + gen() % 3000;
+					bool on = gen() % 2;
+					for(unsigned j = i; j < min(nEvents, i + len); j++)
+						if(on)
+							res.set(j);
+					i += len;
+					break;
+				}
+				case 2:
+					if(gen() % 2)
+						res.set(i);
+					i++;
+					break;
+				default:
+					res.set(i++);
+				}
+			}
+			return res;
+		};
+		vector<EVENT_BITSET> masks;
+		for(int kind = 0; kind < 4; kind++)
+			masks.push_back(rnd(kind));
+		for(auto & m : masks)
+		{
+			ROARING_BITMAP r(m);
+			BOOST_CHECK_EQUAL(r.size(), nEvents);
+			BOOST_CHECK_EQUAL(r.count(), m.count());
+			BOOST_CHECK(r.to_mask() == m);
+			INDICE_TYPE ind = r.to_indices(), ind_mask = m.to_indices();
+			BOOST_CHECK_EQUAL_COLLECTIONS(ind.begin(), ind.end(), ind_mask.begin(), ind_mask.end());
+			//the byte stream is never much larger than the packed bits
+			string bytes;
+			r.serialize(bytes);
+			BOOST_CHECK_LE(bytes.size(), 1 + nEvents / 8 + 8 + 3 * r.get_containers().size());
+			ROARING_BITMAP r1(bytes, nEvents);
+			BOOST_CHECK(r1.to_mask() == m);
+			BOOST_CHECK_EQUAL(r1.count(), m.count());
+
+			for(auto & m2 : masks)
+			{
+				ROARING_BITMAP r_and(m), r_or(m);
+				r_and &= ROARING_BITMAP(m2);
+				r_or |= ROARING_BITMAP(m2);
+				EVENT_BITSET m_and(m), m_or(m);
+				m_and &= m2;
+				m_or |= m2;
+				BOOST_CHECK(r_and.to_mask() == m_and);
+				BOOST_CHECK_EQUAL(r_and.count(), m_and.count());
+				BOOST_CHECK(r_or.to_mask() == m_or);
+				BOOST_CHECK_EQUAL(r_or.count(), m_or.count());
+			}
+		}
+		if(nEvents == 200003)
+		{
+			//the order of magnitude smaller for the sparse and clustered populations
+			string bytes;
+			ROARING_BITMAP(masks[1]).serialize(bytes);
+			BOOST_CHECK_LT(bytes.size() * 10, nEvents / 8);
+			ROARING_BITMAP(masks[3]).serialize(bytes);
+			BOOST_CHECK_LT(bytes.size() * 100, nEvents / 8);
+			ROARING_BITMAP r(masks[2]);
+			for(auto & c : r.get_containers())
+				BOOST_CHECK_EQUAL(c.type, ROARING_BITMAP::BITMAP);
+		}
+	}
+	BOOST_CHECK_THROW(ROARING_BITMAP(string(1, 2), 10), domain_error);
+	BOOST_CHECK_THROW(ROARING_BITMAP(string("\x01\x00\x00\x00", 4), 10), domain_error);
+}
+BOOST_AUTO_TEST_SUITE_END()
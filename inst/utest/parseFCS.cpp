@@ -1,9 +1,40 @@
 #include <cytolib/MemCytoFrame.hpp>
 #include <cytolib/H5CytoFrame.hpp>
+#include <cytolib/FCSEventStream.hpp>
+#include <cytolib/FCSKeywordIndex.hpp>
 #include "fixture.hpp"
 #include <cytolib/global.hpp>
+#include <thread>
 using namespace cytolib;
 
+/*
+ * parse the keywords of a minimal FCS 2.0 file (without events) holding the given TEXT segment
+ */
+KEY_WORDS parse_text(const string & txt, bool emptyValue)
+{
+	string filename = generate_unique_filename(fs::temp_directory_path().string(), "", ".fcs");
+	char header[59];
+	snprintf(header, sizeof(header), "FCS2.0    %8d%8d%8d%8d%8d%8d", 58, int(58 + txt.size() - 1), 0, 0, 0, 0);
+	{
+		ofstream out(filename, ios::out|ios::binary);
+		out.write(header, 58);
+		out.write(txt.data(), txt.size());
+	}
+	FCS_READ_PARAM config;
+	config.header.isEmptyKeyValue = emptyValue;
+	MemCytoFrame fr(filename, config);
+	try
+	{
+		fr.read_fcs_header();
+	}
+	catch(...)
+	{
+		fs::remove(filename);
+		throw;
+	}
+	fs::remove(filename);
+	return fr.get_keywords();
+}
 BOOST_FIXTURE_TEST_SUITE(parseFCS,parseFCSFixture)
 BOOST_AUTO_TEST_CASE(sample_1071)
 {
@@ -42,6 +73,197 @@ BOOST_AUTO_TEST_CASE(sample_1071)
 //	for(auto c: h5fr.getKeywords())
 //			cout << c.first << ";" << c.second << endl;
 
+}
+BOOST_AUTO_TEST_CASE(mmap_reader)
+{
+	string filename="../flowCore/misc/sample_1071.001";
+	FCS_READ_PARAM config;
+	MemCytoFrame cf1(filename.c_str(), config);
+	cf1.read_fcs();
+
+	config.data.use_mmap = true;
+	MemCytoFrame cf2(filename.c_str(), config);
+	cf2.read_fcs();
+	BOOST_CHECK_EQUAL(cf2.n_rows(), 23981);
+	BOOST_CHECK(approx_equal(cf1.get_data(), cf2.get_data(), "absdiff", 0));
+
+	//subset
+	config.data.which_lines = {10, 12};
+	MemCytoFrame cf3(filename.c_str(), config);
+	cf3.read_fcs();
+	BOOST_CHECK_EQUAL(cf3.n_rows(), 2);
+	BOOST_CHECK_EQUAL(cf3.get_data()[0], cf1.get_data()[10]);
+}
+BOOST_AUTO_TEST_CASE(event_stream)
+{
+	string filename="../flowCore/misc/sample_1071.001";
+	FCS_READ_PARAM config;
+	MemCytoFrame cf1(filename.c_str(), config);
+	cf1.read_fcs();
+
+	FCSEventStream st(filename, config, 1000);
+	BOOST_CHECK_EQUAL(st.n_rows(), 23981);
+	EVENT_DATA_VEC blk;
+	unsigned nblk = 0;
+	while(st.next(blk))
+	{
+		BOOST_CHECK(approx_equal(blk, cf1.get_data().rows(nblk * 1000, nblk * 1000 + blk.n_rows - 1), "absdiff", 0));
+		nblk++;
+	}
+	BOOST_CHECK_EQUAL(nblk, 24);
+	BOOST_CHECK_EQUAL(st.n_rows_read(), 23981);
+	//params and keywords are finalized once exhausted
+	for(unsigned i = 0; i < cf1.n_cols(); i++)
+	{
+		BOOST_CHECK_EQUAL(st.get_params()[i].min, cf1.get_params()[i].min);
+		BOOST_CHECK_EQUAL(st.get_params()[i].max, cf1.get_params()[i].max);
+	}
+	BOOST_CHECK_EQUAL(st.get_frame().get_keyword("GUID"), cf1.get_keyword("GUID"));
+
+	config.data.which_lines = {10};
+	BOOST_CHECK_THROW(FCSEventStream(filename, config), domain_error);
+}
+BOOST_AUTO_TEST_CASE(event_stream_h5)
+{
+	string filename="../flowCore/misc/sample_1071.001";
+	FCS_READ_PARAM config;
+	MemCytoFrame cf1(filename.c_str(), config);
+	cf1.read_fcs();
+
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	FCSEventStream st(filename, config, 1000);
+	st.write_h5(h5file);
+	H5CytoFrame fr1(h5file);
+	BOOST_CHECK(approx_equal(fr1.get_data(), cf1.get_data(), "absdiff", 0));
+	for(unsigned i = 0; i < cf1.n_cols(); i++)
+	{
+		BOOST_CHECK_EQUAL(fr1.get_params()[i].min, cf1.get_params()[i].min);
+		BOOST_CHECK_EQUAL(fr1.get_params()[i].max, cf1.get_params()[i].max);
+	}
+	BOOST_CHECK_EQUAL(fr1.get_keyword("GUID"), cf1.get_keyword("GUID"));
+	BOOST_CHECK_EQUAL(fr1.get_pheno_data("name"), cf1.get_pheno_data("name"));
+	BOOST_CHECK_THROW(st.write_h5(h5file), domain_error);
+}
+BOOST_AUTO_TEST_CASE(simd_decode)
+{
+	//the vectorized kernels must be bit-exact with the scalar path
+	vector<string> files = {"../flowCore/misc/sample_1071.001"
+							, "../flowCore/misc/double_precision/wishbone_thymus_panel1_rep1.fcs"
+							, "../flowCore/misc/mixedEndian.fcs"};
+	for(auto transform : {TransformType::linearize, TransformType::scale, TransformType::linearize_with_PnG_scaling})
+	{
+		for(auto filename : files)
+		{
+			FCS_READ_PARAM config;
+			config.data.transform = transform;
+			config.data.use_simd = false;
+			MemCytoFrame cf1(filename.c_str(), config);
+			cf1.read_fcs();
+
+			config.data.use_simd = true;
+			MemCytoFrame cf2(filename.c_str(), config);
+			cf2.read_fcs();
+			BOOST_CHECK(approx_equal(cf1.get_data(), cf2.get_data(), "absdiff", 0));
+			for(unsigned i = 0; i < cf1.n_cols(); i++)
+				BOOST_CHECK_EQUAL(cf1.get_params()[i].min, cf2.get_params()[i].min);
+		}
+	}
+}
+BOOST_AUTO_TEST_CASE(blocked_decode)
+{
+	//row blocks decoded by multiple threads must match the single-threaded decoding
+	string filename="../flowCore/misc/double_precision/wishbone_thymus_panel1_rep1.fcs";
+	FCS_READ_PARAM config;
+	MemCytoFrame cf1(filename.c_str(), config);
+	cf1.read_fcs();
+
+	config.data.num_threads = 4;
+	MemCytoFrame cf2(filename.c_str(), config);
+	cf2.read_fcs();
+	BOOST_CHECK(approx_equal(cf1.get_data(), cf2.get_data(), "absdiff", 0));
+	for(unsigned i = 0; i < cf1.n_cols(); i++)
+		BOOST_CHECK_EQUAL(cf1.get_params()[i].min, cf2.get_params()[i].min);
+}
+BOOST_AUTO_TEST_CASE(keyword_index)
+{
+	vector<string> files = {"../flowCore/misc/sample_1071.001"
+							, "../flowCore/misc/nonexistent.fcs"
+							, "../flowCore/misc/double_precision/wishbone_thymus_panel1_rep1.fcs"};
+	FCSKeywordTable tbl = read_fcs_keywords(files, {"$TOT", "$PAR", "$NOTAKEYWORD"}, FCS_READ_HEADER_PARAM(), 2);
+	BOOST_CHECK_EQUAL(tbl.n_files(), 3);
+	BOOST_CHECK_EQUAL(tbl.n_keys(), 3);
+	BOOST_CHECK_EQUAL(tbl.get_column("$TOT")[0], "23981");
+	BOOST_CHECK_EQUAL(tbl.get_column("$PAR")[0], "8");
+	BOOST_CHECK_EQUAL(tbl.get_column("$PAR")[2], "35");
+	BOOST_CHECK_EQUAL(tbl.get_column("$NOTAKEYWORD")[0], "");
+	BOOST_CHECK(tbl.errors[0].empty());
+	BOOST_CHECK(!tbl.errors[1].empty());
+	BOOST_CHECK_EQUAL(tbl.get_column("$TOT")[1], "");
+	BOOST_CHECK(tbl.errors[2].empty());
+
+	//all keywords
+	tbl = read_fcs_keywords(files, {}, FCS_READ_HEADER_PARAM(), 2);
+	MemCytoFrame fr(files[0], FCS_READ_PARAM());
+	fr.read_fcs_header();
+	for(auto & kw : fr.get_keywords())
+		BOOST_CHECK_EQUAL(tbl.get_column(kw.first)[0], kw.second);
+}
+BOOST_AUTO_TEST_CASE(print_buffer)
+{
+	//the messages of the workers are collected instead of printed from their threads
+	vector<string> msgs, nested;
+	std::thread t([&](){
+		PrintBuffer buf(msgs);
+		PRINT("a");
+		{
+			PrintBuffer buf1(nested);
+			PRINT("b");
+		}
+		PRINT(string("c"));
+	});
+	t.join();
+	BOOST_REQUIRE_EQUAL(msgs.size(), 2);
+	BOOST_CHECK_EQUAL(msgs[0], "a");
+	BOOST_CHECK_EQUAL(msgs[1], "c");
+	BOOST_REQUIRE_EQUAL(nested.size(), 1);
+	BOOST_CHECK_EQUAL(nested[0], "b");
+}
+BOOST_AUTO_TEST_CASE(which_lines_io)
+{
+	string filename="../flowCore/misc/sample_1071.001";
+	FCS_READ_PARAM config;
+	MemCytoFrame cf1(filename.c_str(), config);
+	cf1.read_fcs();
+
+	//coalesced reads give the same rows regardless of the gap, duplicated rows are kept
+	vector<int64_t> lines = {23980, 5, 6, 6, 100, 20000};
+	vector<int64_t> sorted_lines = {5, 6, 6, 100, 20000, 23980};
+	for(auto gap : {0, 1024, 1<<20})
+	{
+		config.data.which_lines = lines;
+		config.data.which_lines_gap = gap;
+		config.data.num_threads = 2;
+		MemCytoFrame cf2(filename.c_str(), config);
+		cf2.read_fcs();
+		BOOST_CHECK_EQUAL(cf2.n_rows(), lines.size());
+		for(unsigned i = 0; i < sorted_lines.size(); i++)
+			BOOST_CHECK(approx_equal(cf2.get_data().row(i), cf1.get_data().row(sorted_lines[i]), "absdiff", 0));
+	}
+
+	config = FCS_READ_PARAM();
+	config.data.which_lines = {1000};
+	config.data.sample_type = SampleType::reservoir;
+	MemCytoFrame cf3(filename.c_str(), config);
+	cf3.read_fcs();
+	BOOST_CHECK_EQUAL(cf3.n_rows(), 1000);
+
+	config.data.sample_type = SampleType::bernoulli;
+	MemCytoFrame cf4(filename.c_str(), config);
+	cf4.read_fcs();
+	BOOST_CHECK(cf4.n_rows() > 800 && cf4.n_rows() < 1200);
+	//reservoir sampling draws distinct rows
+	auto rows = sample_fcs_rows(100, 99, SampleType::reservoir, 1);
+	BOOST_CHECK(adjacent_find(rows.begin(), rows.end()) == rows.end());
 }
 BOOST_AUTO_TEST_CASE(double_precision)
 {
@@ -200,6 +422,52 @@ BOOST_AUTO_TEST_CASE(newline_in_txt)
 	BOOST_CHECK_CLOSE(cytofrm.get_data()[1], 9220, 1e-6);
 
 }
+BOOST_AUTO_TEST_CASE(text_tokenizer)
+{
+	//the keywords required by the header parser
+	string req = "$DATATYPE/F/$PAR/0/";
+	//escaped double delimiters within the keys and values, including the one right before the last delimiter
+	KEY_WORDS kw = parse_text("/" + req + "key//with/value//a//b/k2/ends with///", false);
+	BOOST_CHECK_EQUAL(kw.find("key/with")->second, "value/a/b");
+	BOOST_CHECK_EQUAL(kw.find("k2")->second, "ends with/");
+	BOOST_CHECK_EQUAL(kw.find("$PAR")->second, "0");
+
+	//whitespace delimiter, which is never trimmed from the tokens
+	kw = parse_text(" $DATATYPE F $PAR 0 key two  words k2 v2", false);
+	BOOST_CHECK_EQUAL(kw.find("key")->second, "two words");
+	BOOST_CHECK_EQUAL(kw.find("k2")->second, "v2");
+
+	//the trailing delimiter is optional
+	KEY_WORDS kw1 = parse_text("/" + req + "k/v/", false);
+	KEY_WORDS kw2 = parse_text("/" + req + "k/v", false);
+	BOOST_CHECK(kw1.getPairs() == kw2.getPairs());
+	BOOST_CHECK_EQUAL(kw1.find("k")->second, "v");
+
+	//double delimiters are the empty values when allowed, otherwise the escaped delimiter
+	kw = parse_text("/" + req + "k1//k2/v2/", true);
+	BOOST_CHECK_EQUAL(kw.find("k1")->second, "");
+	BOOST_CHECK_EQUAL(kw.find("k2")->second, "v2");
+	kw = parse_text("/" + req + "k1//k2/v2/", false);
+	BOOST_CHECK_EQUAL(kw.find("k1/k2")->second, "v2");
+	BOOST_CHECK(kw.find("k1") == kw.end());
+
+	//the dangling key of the uneven tokens is dropped
+	kw = parse_text("/" + req + "k1/v1/dangling/", false);
+	BOOST_CHECK_EQUAL(kw.find("k1")->second, "v1");
+	BOOST_CHECK(kw.find("dangling") == kw.end());
+
+	//empty keys
+	BOOST_CHECK_THROW(parse_text("/" + req + "k1/v1//v2/", true), std::range_error);
+	BOOST_CHECK_THROW(parse_text("/" + req + " /v/", false), std::range_error);
+
+	//the bytes beyond ASCII are kept as they are
+	string high;
+	for(int c = 127; c <= 254; c++)
+		high.push_back(static_cast<char>(c));
+	kw = parse_text("/" + req + "$HIGH/" + high + "/" + high + "/v/", false);
+	BOOST_CHECK(kw.find("$HIGH")->second == high);
+	BOOST_CHECK_EQUAL(kw.find(high)->second, "v");
+}
 BOOST_AUTO_TEST_CASE(samples_F1)
 {
 
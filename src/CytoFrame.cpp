@@ -1,6 +1,7 @@
 // Copyright 2019 Fred Hutchinson Cancer Research Center
 // See the included LICENSE file for details on the licence that is granted to the user of this software.
 #include <cytolib/CytoFrame.hpp>
+#include <cytolib/H5FileCache.hpp>
 
 
 namespace cytolib
@@ -24,6 +25,8 @@ namespace cytolib
 	CytoFrame::CytoFrame(const CytoFrame & frm)
 	{
 //		cout << "copy CytoFrame member" << endl;
+		frm.ensure_keys_loaded();
+		frm.ensure_pheno_data_loaded();
 		pheno_data_ = frm.pheno_data_;
 		keys_ = frm.keys_;
 		params = frm.params;
@@ -33,6 +36,8 @@ namespace cytolib
 
 	CytoFrame & CytoFrame::operator=(const CytoFrame & frm)
 	{
+		frm.ensure_keys_loaded();
+		frm.ensure_pheno_data_loaded();
 		pheno_data_ = frm.pheno_data_;
 		keys_ = frm.keys_;
 		params = frm.params;
@@ -44,6 +49,8 @@ namespace cytolib
 
 	CytoFrame & CytoFrame::operator=(CytoFrame && frm)
 	{
+		frm.ensure_keys_loaded();
+		frm.ensure_pheno_data_loaded();
 		swap(pheno_data_, frm.pheno_data_);
 		swap(keys_, frm.keys_);
 		swap(params, frm.params);
@@ -55,6 +62,8 @@ namespace cytolib
 
 	CytoFrame::CytoFrame(CytoFrame && frm)
 	{
+		frm.ensure_keys_loaded();
+		frm.ensure_pheno_data_loaded();
 		swap(pheno_data_, frm.pheno_data_);
 		swap(keys_, frm.keys_);
 		swap(params, frm.params);
@@ -84,7 +93,6 @@ namespace cytolib
 	 */
 	void CytoFrame::compensate(const compensation& comp) {
 	  int nMarker = comp.marker.size();
-	  EVENT_DATA_VEC dat = get_data();
 	  arma::uvec indices(nMarker);
 	  for (int i = 0; i < nMarker; i++) {
 	    int id = get_col_idx(comp.marker[i], ColType::channel);
@@ -104,10 +112,8 @@ namespace cytolib
 	    
 	    indices_detector[i] = id;
 	  }
-	  arma::mat A(dat.memptr(), n_rows(), n_cols(), false,
-               true);  // point to the original data
-	  // Try to avoid extra memory burden from copies by performing
-	  // all of these transpositions in-place
+	  // only the detector columns are read and the marker columns are written back
+	  arma::mat A = conv_to<arma::mat>::from(get_data(indices_detector, true));
 	  inplace_trans(A);
 	  arma::mat B = comp.get_spillover_mat();
 	  // B.print("comp");
@@ -116,14 +122,13 @@ namespace cytolib
 	  arma::mat R;
 	  qr_econ(Q, R, B);
 	  inplace_trans(Q);
-	  // Assign to rows representing t(X)
+	  // Solve for t(X), i.e. the rows of the markers
 	  // Note: trimatu to tell Armadillo that R is upper-triangular
 	  // so it goes straight to back-substitution
-	  A.rows(indices) = solve(trimatu(R), Q * A.rows(indices_detector));
-	  // Need to transpose A back to proper orientation
-	  //(which also takes care of transposing t(X) back to X)
-	  inplace_trans(A);
-	  set_data(dat);
+	  arma::mat X = solve(trimatu(R), Q * A);
+	  // Need to transpose X back to proper orientation
+	  inplace_trans(X);
+	  set_columns(indices, conv_to<EVENT_DATA_VEC>::from(X));
 	}
 
 	void CytoFrame::scale_time_channel(string time_channel){
@@ -133,13 +138,12 @@ namespace cytolib
 			EVENT_DATA_TYPE timestep = get_time_step(time_channel);
 			if(g_loglevel>=GATING_HIERARCHY_LEVEL)
 				PRINT("multiplying "+time_channel+" by :"+ to_string(timestep) + "\n");
-			//TODO:partial IO
-			EVENT_DATA_VEC data = get_data();;//get_data(idx);
-			EVENT_DATA_TYPE * x = data.colptr(idx);
+			EVENT_DATA_VEC data = get_column(idx);
+			EVENT_DATA_TYPE * x = data.memptr();
 			int nEvents = n_rows();
 			for(int i = 0; i < nEvents; i++)
 				x[i] = x[i] * timestep;
-			set_data(data);
+			set_columns(uvec({(uword)idx}), data);
 			//TODO:update instrument range as well
 			auto param_range = get_range(time_channel, ColType::channel, RangeType::data);
 			param_range.first = param_range.first * timestep;
@@ -235,7 +239,7 @@ namespace cytolib
 				set_keyword("$P" + pid + "R", boost::lexical_cast<string>((long long)ceil(new_maxs(i)) + 1));
 
 
-			if( keys_.find("transformation")!=keys_.end() &&  keys_["transformation"] == "custom"){
+			if(get_keyword("transformation") == "custom"){
 				set_keyword("flowCore_$P" + pid + "Rmin", boost::lexical_cast<string>(new_mins(i)));
 				set_keyword("flowCore_$P" + pid + "Rmax", boost::lexical_cast<string>(new_maxs(i)));
 			}
@@ -259,7 +263,7 @@ namespace cytolib
 			return datatype;
 		}
 		else
-			return FloatType(PredType::NATIVE_DOUBLE);
+			return FloatType(sizeof(EVENT_DATA_TYPE) == sizeof(float) ? PredType::NATIVE_FLOAT : PredType::NATIVE_DOUBLE);
 	}
 	CompType CytoFrame::get_h5_datatype_params(DataTypeLocation storage_type) const
 	{
@@ -335,6 +339,7 @@ namespace cytolib
 	void CytoFrame::write_h5_keys(H5File file) const
 	{
 		CompType key_type = get_h5_datatype_keys();
+		ensure_keys_loaded();
 		hsize_t dim_key[] = {keys_.size()};
 		hsize_t dim_max[] = {H5S_UNLIMITED};
 		DataSpace dsp_key(1, dim_key, dim_max);
@@ -354,6 +359,7 @@ namespace cytolib
 	void CytoFrame::write_h5_pheno_data(H5File file) const
 	{
 		CompType key_type = get_h5_datatype_keys();
+		ensure_pheno_data_loaded();
 		hsize_t nSize = pheno_data_.size();
 		if(nSize==0)
 			throw runtime_error("CytoFrame requires non-empty pdata to write to h5!");
@@ -378,9 +384,12 @@ namespace cytolib
 	 * save the CytoFrame as HDF5 format
 	 *
 	 * @param filename the path of the output H5 file
+	 * @param h5_write_opts the chunk layout and filters of the events dataset
 	 */
-	void CytoFrame::write_h5(const string & filename) const
+	void CytoFrame::write_h5(const string & filename, const H5WriteOptions & h5_write_opts) const
 	{
+		lock_guard<recursive_mutex> guard(H5FileCache::h5_mutex());
+		H5FileCache::release(filename);//the cached handle would block the truncation
 		H5File file( filename, H5F_ACC_TRUNC );
 
 		write_h5_params(file);
@@ -394,16 +403,7 @@ namespace cytolib
 		* store events data as fixed
 		* size dataset.
 		*/
-		unsigned nEvents = n_rows();
-		hsize_t dimsf[2] = {n_cols(), nEvents};              // dataset dimensions
-		DSetCreatPropList plist;
-		hsize_t	chunk_dims[2] = {1, (nEvents > 0 ? nEvents : 1)};
-		plist.setChunk(2, chunk_dims);
-	//	plist.setFilter()
-		hsize_t dim_max[] = {H5S_UNLIMITED, H5S_UNLIMITED};
-
-		DataSpace dataspace( 2, dimsf, dim_max);
-		DataSet dataset = file.createDataSet( DATASET_NAME, h5_datatype_data(DataTypeLocation::H5), dataspace, plist);
+		DataSet dataset = create_h5_dataset(file, n_cols(), n_rows(), h5_write_opts);
 		/*
 		* Write the data to the dataset using default memory space, file
 		* space, and transfer properties.
@@ -415,6 +415,35 @@ namespace cytolib
 		write_h5_rownames(file, rn);
 	}
 
+	DataSet CytoFrame::create_h5_dataset(H5File file, hsize_t nCol, hsize_t nEvents, const H5WriteOptions & h5_write_opts) const
+	{
+		hsize_t dimsf[2] = {nCol, nEvents};              // dataset dimensions
+		DSetCreatPropList plist;
+		hsize_t chunk_rows = h5_write_opts.chunk_rows > 0 ? min<hsize_t>(h5_write_opts.chunk_rows, nEvents) : nEvents;
+		hsize_t chunk_cols = min<hsize_t>(max<hsize_t>(h5_write_opts.chunk_cols, 1), nCol);
+		hsize_t	chunk_dims[2] = {max<hsize_t>(chunk_cols, 1), max<hsize_t>(chunk_rows, 1)};
+		plist.setChunk(2, chunk_dims);
+		//shuffle goes before deflate in the filter pipeline
+		if(h5_write_opts.shuffle)
+			plist.setShuffle();
+		if(h5_write_opts.deflate_level > 0)
+		{
+			if(!H5Zfilter_avail(H5Z_FILTER_DEFLATE))
+				throw(domain_error("The deflate filter is not available in the h5 library!"));
+			plist.setDeflate(min(h5_write_opts.deflate_level, 9));
+		}
+		hsize_t dim_max[] = {H5S_UNLIMITED, H5S_UNLIMITED};
+
+		DataSpace dataspace( 2, dimsf, dim_max);
+		FloatType datatype = h5_datatype_data(DataTypeLocation::H5);
+		if(h5_write_opts.double_precision)
+		{
+			datatype = FloatType(PredType::NATIVE_DOUBLE);
+			datatype.setOrder(is_host_big_endian()?H5T_ORDER_BE:H5T_ORDER_LE );
+		}
+		return file.createDataSet( DATASET_NAME, datatype, dataspace, plist);
+	}
+
 
 	/**
 	 * extract the value of the single keyword by keyword name
@@ -425,6 +454,7 @@ namespace cytolib
 	string CytoFrame::get_keyword(const string & key) const
 	{
 		string res="";
+		ensure_keys_loaded();
 		auto it = keys_.find(key);
 		if(it!=keys_.end())
 			res = it->second;
@@ -638,6 +668,7 @@ namespace cytolib
 
 	  //check if $TIMESTEP is available
 		EVENT_DATA_TYPE ts;
+		ensure_keys_loaded();
 		auto it_time = keys_.find("$TIMESTEP");
 		if(it_time != keys_.end())
 				ts = boost::lexical_cast<EVENT_DATA_TYPE>(it_time->second);
@@ -667,6 +698,7 @@ namespace cytolib
 
 
 	string CytoFrame::get_pheno_data(const string & name) const {
+		ensure_pheno_data_loaded();
 		auto it = pheno_data_.find(name);
 		if(it==pheno_data_.end())
 			return "";
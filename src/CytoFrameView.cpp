@@ -170,6 +170,14 @@ namespace cytolib
 				throw(domain_error("Cannot assign non-empty input data to empty CytoFrameView!"));	
 			}
 		}else{
+			//only the columns are replaced, which doesn't need to touch the rest of the data
+			if(is_col_indexed_&&!is_row_indexed_)
+			{
+				if(data_in.n_cols!=col_idx_.size()||data_in.n_rows!=n_rows())
+					throw(domain_error("The size of the input data is different from the cytoframeview!"));
+				get_cytoframe_ptr()->set_columns(col_idx_, data_in);
+				return;
+			}
 			//fetch the original view of data
 			EVENT_DATA_VEC data_orig = get_cytoframe_ptr()->get_data();
 			//update it
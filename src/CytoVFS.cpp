@@ -6,6 +6,7 @@
  */
 
 #include <cytolib/CytoVFS.hpp>
+#include <cytolib/H5FileCache.hpp>
 #include <fstream>
 namespace cytolib
 {
@@ -55,9 +56,9 @@ namespace cytolib
 		}
 	bool CytoVFS::is_dir(string p) const{return fs::is_directory(p);}
 	bool CytoVFS::is_file(string p) const{return !fs::is_directory(p)&&fs::exists(p);}
-	void CytoVFS::remove_dir(string p){fs::remove_all(p);}
+	void CytoVFS::remove_dir(string p){H5FileCache::release(p);fs::remove_all(p);}
 	void CytoVFS::create_dir(string p){ fs::create_directory(p);}
-	void CytoVFS::move_dir(string p, string p1){fs::rename(p, p1);}
+	void CytoVFS::move_dir(string p, string p1){H5FileCache::release(p);fs::rename(p, p1);}
 	int CytoVFS::file_size(string p){return fs::file_size(p);}
 
 }
@@ -0,0 +1,134 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/FCSEventStream.hpp>
+#include <cytolib/cytolibConfig.h>
+#include <cytolib/H5FileCache.hpp>
+#include <future>
+
+namespace cytolib
+{
+	FCSEventStream::FCSEventStream(const string & filename, const FCS_READ_PARAM & config, size_t block_size):frame_(filename, config)
+		, config_(config.data), block_size_(block_size), nrow_(0), nrow_read_(0), is_finalized_(false)
+	{
+		if(block_size_ == 0)
+			throw(domain_error("block_size must be positive!"));
+		if(config_.which_lines.size() > 0)
+			throw(domain_error("which_lines is not supported by FCSEventStream!"));
+
+		frame_.read_fcs_header();
+		frame_.set_keyword("$CYTOLIB_VERSION", CYTOLIB_VERSION);
+		decoder_ = frame_.init_data_decoder(config_);
+
+		const FCS_Header & header = frame_.get_fcs_header();
+		uint64_t nBytes = header.dataend - header.datastart + 1;
+		uint64_t nRowSizeBytes = decoder_.row_bytes();
+		uint64_t bytes_available;
+		if(config_.use_mmap && is_mmap_supported())
+		{
+			mapped_.reset(new MappedFileRange(filename, header.datastart, nBytes));
+			bytes_available = mapped_->size();
+		}
+		else
+		{
+			in_.open(filename, ios::in|ios::binary);
+			if(!in_.is_open())
+				throw(domain_error("can't open the file: " + filename + "\nPlease check if the path is normalized to be recognized by c++!"));
+			in_.seekg(0, ios::end);
+			int64_t fsize = in_.tellg();
+			bytes_available = fsize > header.datastart?min<uint64_t>(nBytes, fsize - header.datastart):0;
+			in_.seekg(header.datastart);
+			buf_.reset(new char[min<uint64_t>(block_size_, nBytes/nRowSizeBytes) * nRowSizeBytes]);
+		}
+		//same check as read_fcs_data, done upfront since the data is not read in one go
+		uint64_t events_read = bytes_available * 8 / decoder_.nRowSize;
+		uint64_t events_expected = boost::lexical_cast<uint64_t>(frame_.get_keyword("$TOT"));
+		if(events_read != events_expected)
+		{
+			throw(domain_error("file " + filename + " seems to be corrupted. \n The actual number of cells in data section ("
+	                 + to_string(events_read) + ") is not consistent with keyword '$TOT' (" + to_string(events_expected) + ")"));
+		}
+		nrow_ = events_read;
+	}
+
+	bool FCSEventStream::next(EVENT_DATA_VEC & block)
+	{
+		if(nrow_read_ >= nrow_)
+		{
+			if(!is_finalized_)
+			{
+				if(realMin_.size() != decoder_.n_cols())
+					realMin_.resize(decoder_.n_cols(), numeric_limits<EVENT_DATA_TYPE>::max());
+				frame_.finalize_data_decoder(decoder_, config_, realMin_);
+				is_finalized_ = true;
+				mapped_.reset();
+				in_.close();
+			}
+			block.reset();
+			return false;
+		}
+		uint64_t nrow = min<uint64_t>(block_size_, nrow_ - nrow_read_);
+		uint64_t nRowSizeBytes = decoder_.row_bytes();
+		const char * src;
+		if(mapped_)
+			src = mapped_->data() + nrow_read_ * nRowSizeBytes;
+		else
+		{
+			in_.read(buf_.get(), nrow * nRowSizeBytes);
+			if(static_cast<uint64_t>(in_.gcount()) != nrow * nRowSizeBytes)
+				throw(domain_error("failed to read the events of the DATA segment!"));
+			src = buf_.get();
+		}
+		block.set_size(nrow, decoder_.n_cols());
+		decoder_.decode(src, nrow, block.memptr(), nrow, realMin_);
+		nrow_read_ += nrow;
+		return true;
+	}
+
+	void FCSEventStream::write_h5(const string & h5_filename, const H5WriteOptions & h5_write_opts)
+	{
+		if(nrow_read_ > 0)
+			throw(domain_error("Can't write the partially consumed FCSEventStream to h5!"));
+		//the background writer makes the h5 calls on behalf of this thread, which holds the lock without calling h5 meanwhile
+		lock_guard<recursive_mutex> guard(H5FileCache::h5_mutex());
+		H5FileCache::release(h5_filename);//the cached handle would block the truncation
+		H5File file(h5_filename, H5F_ACC_TRUNC);
+		hsize_t nCol = n_cols();
+		H5WriteOptions opts = h5_write_opts;
+		//the compressed whole-column chunk would be re-compressed by every block, thus align the chunks with the blocks instead
+		if(opts.chunk_rows == 0 && opts.deflate_level > 0)
+			opts.chunk_rows = block_size_;
+		DataSet dataset = frame_.create_h5_dataset(file, nCol, nrow_, opts);
+		DataSpace dataspace = dataset.getSpace();
+		FloatType mem_type = h5_datatype_data(DataTypeLocation::MEM);
+		/*
+		 * double buffering: the previous block is written by the background task while the current one is being decoded,
+		 * h5 is never called concurrently since the decoder doesn't touch h5 objects
+		 */
+		EVENT_DATA_VEC blocks[2];
+		future<void> writing;
+		hsize_t start = 0;
+		unsigned cur = 0;
+		while(next(blocks[cur]))
+		{
+			if(writing.valid())
+				writing.get();
+			hsize_t nrow = blocks[cur].n_rows;
+			const EVENT_DATA_TYPE * src = blocks[cur].memptr();
+			writing = async(launch::async, [&dataset, &dataspace, &mem_type, src, start, nrow, nCol](){
+				hsize_t offset[] = {0, start};
+				hsize_t count[] = {nCol, nrow};
+				dataspace.selectHyperslab(H5S_SELECT_SET, count, offset);
+				DataSpace memspace(2, count);
+				dataset.write(src, mem_type, memspace, dataspace);
+			});
+			start += nrow;
+			cur = 1 - cur;
+		}
+		if(writing.valid())
+			writing.get();
+		//min and max have been updated by the decoding
+		frame_.write_h5_params(file);
+		frame_.write_h5_keys(file);
+		frame_.write_h5_pheno_data(file);
+	}
+};
@@ -0,0 +1,100 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/FCSKeywordIndex.hpp>
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+
+namespace cytolib
+{
+	const vector<string> & FCSKeywordTable::get_column(const string & key) const
+	{
+		auto it = std::find(keys.begin(), keys.end(), key);
+		if(it == keys.end())
+			throw(domain_error("keyword not found: " + key));
+		return values[it - keys.begin()];
+	}
+
+	FCSKeywordTable read_fcs_keywords(const vector<string> & files, const vector<string> & keys
+										, const FCS_READ_HEADER_PARAM & config, int num_threads)
+	{
+		size_t nFile = files.size();
+		FCSKeywordTable res;
+		res.files = files;
+		res.keys = keys;
+		res.errors.resize(nFile);
+		res.values.resize(keys.size(), vector<string>(nFile));
+		//all keywords of each file need to be kept only when the columns are not known upfront
+		bool is_all = keys.empty();
+		vector<KEY_WORDS> kws(is_all?nFile:0);
+
+		FCS_READ_PARAM fcs_config;
+		fcs_config.header = config;
+		//the messages of each file are printed from this thread after the workers are done
+		vector<vector<string>> msgs(nFile);
+		std::atomic<size_t> next(0);
+		auto worker = [&](){
+			for(size_t i = next++; i < nFile; i = next++)
+			{
+				PrintBuffer buf(msgs[i]);
+				try
+				{
+					MemCytoFrame fr(files[i], fcs_config);
+					fr.read_fcs_header();
+					const KEY_WORDS & kw = fr.get_keywords();
+					if(is_all)
+						kws[i] = kw;
+					else
+					{
+						for(size_t k = 0; k < keys.size(); k++)
+						{
+							auto it = kw.find(keys[k]);
+							if(it != kw.end())
+								res.values[k][i] = it->second;
+						}
+					}
+				}
+				catch(const exception & e)
+				{
+					res.errors[i] = e.what();
+					if(res.errors[i].empty())
+						res.errors[i] = "failed to parse the FCS header";
+				}
+				catch(...)
+				{
+					res.errors[i] = "failed to parse the FCS header";
+				}
+			}
+		};
+
+		size_t nThread = max<size_t>(1, min<size_t>(max(num_threads, 1), nFile));
+		vector<std::thread> pool;
+		for(size_t t = 1; t < nThread; t++)
+			pool.emplace_back(worker);
+		worker();
+		for(auto & t : pool)
+			t.join();
+		for(const auto & m : msgs)
+			flush_prints(m);
+
+		if(is_all)
+		{
+			unordered_set<string> seen;
+			for(const auto & kw : kws)
+				for(const auto & p : kw)
+					if(seen.insert(p.first).second)
+						res.keys.push_back(p.first);
+			res.values.resize(res.keys.size(), vector<string>(nFile));
+			for(size_t i = 0; i < nFile; i++)
+			{
+				for(size_t k = 0; k < res.keys.size(); k++)
+				{
+					auto it = kws[i].find(res.keys[k]);
+					if(it != kws[i].end())
+						res.values[k][i] = it->second;
+				}
+			}
+		}
+		return res;
+	}
+};
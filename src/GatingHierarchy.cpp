@@ -175,7 +175,7 @@ namespace cytolib
 	}
 
 
-	void GatingHierarchy::calgate(MemCytoFrame & cytoframe, VertexID u, bool computeTerminalBool, INTINDICES &parentIndice)
+	void GatingHierarchy::calgate(MemCytoFrame & cytoframe, VertexID u, bool computeTerminalBool, const EVENT_BITSET &parentMask)
 	{
 		nodeProperties & node=getNodeProperty(u);
 
@@ -213,13 +213,9 @@ namespace cytolib
 				{
 
 
-					vector<bool> curIndices;
-					curIndices=boolGating(cytoframe, u, computeTerminalBool);
+					EVENT_BITSET curIndices=boolGatingMask(cytoframe, u, computeTerminalBool);
 					//combine with parent indices
-					VertexID pid=getParent(u);
-					nodeProperties & parentNode =getNodeProperty(pid);
-
-					transform (curIndices.begin(), curIndices.end(), parentNode.getIndices().begin(), curIndices.begin(),logical_and<bool>());
+					curIndices &= parentMask;
 					node.setIndices(curIndices);
 				}
 				else
@@ -233,11 +229,9 @@ namespace cytolib
 			}
 		case LOGICALGATE://skip any gating operation since the indice is already set once the gate is added
 		case CLUSTERGATE:{
-		  auto curIndices = node.getIndices();
-		  std::transform(curIndices.begin(), curIndices.end(),
-                   parentIndice.getIndices().begin(), curIndices.begin(),
-                   std::logical_and<bool>());
-		  
+		  EVENT_BITSET curIndices = node.getMask();
+		  curIndices &= parentMask;
+
 		  node.setIndices(curIndices);
 		  node.computeStats();
 		}
@@ -245,9 +239,13 @@ namespace cytolib
 			return;
 		default:
 			{
-				vector<unsigned> pind = parentIndice.getIndices_u();
-				vector<unsigned> curIndices=g->gating(cytoframe, pind);
-				node.setIndices(curIndices, parentIndice.getTotal());
+				//the ellipsoid gates loaded from the archive (or shifted) have yet to find the way back to 256 scale
+				ellipsoidGate * eg = dynamic_cast<ellipsoidGate *>(g.get());
+				if(eg&&eg->Transformed()&&!eg->isDataScaleSet())
+					eg->setDataScale(get_gate_trans());
+				EVENT_BITSET curIndices;
+				g->gating(cytoframe, parentMask, curIndices);
+				node.setIndices(curIndices);
 			}
 
 		}
@@ -294,7 +292,8 @@ namespace cytolib
 			, string cf_filename
 			, CytoFileOption h5_opt
 			, bool is_skip_data
-			, const CytoCtx & ctx){
+			, const CytoCtx & ctx
+			, const H5WriteOptions & h5_write_opts){
 		pb::populationTree * ptree = gh_pb.mutable_tree();
 		/*
 		 * cp tree
@@ -335,7 +334,7 @@ namespace cytolib
 			frame_.set_readonly(flag);//restore the lock
 			string ext= ".h5";
 
-			frame_.convertToPb(*fr_pb, cf_filename + ext, h5_opt, ctx);
+			frame_.convertToPb(*fr_pb, cf_filename + ext, h5_opt, ctx, h5_write_opts);
 		}
 
 
@@ -557,10 +556,7 @@ namespace cytolib
 	/*
 	 * transform gates
 	 */
-	void GatingHierarchy::transform_gate(){
-		if(g_loglevel>=GATING_HIERARCHY_LEVEL)
-				PRINT("\nstart transform Gates \n");
-
+	trans_local GatingHierarchy::get_gate_trans() const{
 		// rm dataonly trans
 		auto trans1 = trans;
 		cytolib::trans_map transMap;
@@ -571,6 +567,14 @@ namespace cytolib
 		  }
 		}
 		trans1.setTransMap(transMap);
+		return trans1;
+	}
+
+	void GatingHierarchy::transform_gate(){
+		if(g_loglevel>=GATING_HIERARCHY_LEVEL)
+				PRINT("\nstart transform Gates \n");
+
+		auto trans1 = get_gate_trans();
 		
 			VertexID_vec vertices=getVertices(0);
 
@@ -646,7 +650,7 @@ namespace cytolib
 	void GatingHierarchy::gating(MemCytoFrame & cytoframe, VertexID u,bool recompute, bool computeTerminalBool, bool skip_faulty_node)
 	{
 		//get parent ind
-		INTINDICES parentIndice;
+		EVENT_BITSET parentMask;
 
 		if(u>0)
 		{
@@ -659,13 +663,13 @@ namespace cytolib
 			if(!node.isGated())
 				gating(cytoframe, pid, recompute, computeTerminalBool, skip_faulty_node);
 
-			parentIndice = INTINDICES(node.getIndices());
+			parentMask = node.getMask();
 
 		}
 
-		gating(cytoframe, u, recompute, computeTerminalBool, skip_faulty_node, parentIndice);
+		gating(cytoframe, u, recompute, computeTerminalBool, skip_faulty_node, parentMask);
 	}
-	void GatingHierarchy::gating(MemCytoFrame & cytoframe, VertexID u,bool recompute, bool computeTerminalBool, bool skip_faulty_node, INTINDICES &parentIndice)
+	void GatingHierarchy::gating(MemCytoFrame & cytoframe, VertexID u,bool recompute, bool computeTerminalBool, bool skip_faulty_node, const EVENT_BITSET &parentMask)
 	{
 
 	//	if(!isLoaded)
@@ -686,7 +690,7 @@ namespace cytolib
 			if(recompute||!node.isGated())
 			{
 				try{
-					calgate(cytoframe, u, computeTerminalBool, parentIndice);
+					calgate(cytoframe, u, computeTerminalBool, parentMask);
 				}
 				catch(const std::exception & e)
 				{
@@ -707,19 +711,55 @@ namespace cytolib
 		//recursively gate all the descendants of u
 		if(node.isGated())
 		{
-			INTINDICES pind(node.getIndices_u(), node.getTotal());
+			//the parent mask is shared by reference among all the children
+			EVENT_BITSET pmask = node.getMask();
 			VertexID_vec children=getChildren(u);
 			for(VertexID_vec::iterator it=children.begin();it!=children.end();it++)
 			{
 				//add boost node
 				VertexID curChildID = *it;
 
-				gating(cytoframe, curChildID,recompute, computeTerminalBool, skip_faulty_node, pind);
+				gating(cytoframe, curChildID,recompute, computeTerminalBool, skip_faulty_node, pmask);
 			}
 
 		}
 
 	}
+	/*
+	 * combine the mask of one reference population into the mask of the bool gate
+	 * by word-level AND/OR (ANDNOT/ORNOT for the negated reference)
+	 */
+	static void combine_bool_op(EVENT_BITSET & ind, EVENT_BITSET && curPopInd, const BOOL_GATE_OP & op, bool is_first)
+	{
+		/*
+		 * for the first reference node
+		 * assign the indices directly without logical operation
+		 */
+		if(is_first)
+		{
+			ind = std::move(curPopInd);
+			if(op.isNot)
+				ind.flip();
+			return;
+		}
+		switch(op.op)
+		{
+			case '&':
+				if(op.isNot)
+					ind.and_not(curPopInd);
+				else
+					ind &= curPopInd;
+				break;
+			case '|':
+				if(op.isNot)
+					ind.or_not(curPopInd);
+				else
+					ind |= curPopInd;
+				break;
+			default:
+				throw(domain_error("not supported operator!"));
+		}
+	}
 	/*
 	 * bool gating operates on the indices of reference nodes
 	 * because they are global, thus needs to be combined with parent indices
@@ -729,18 +769,14 @@ namespace cytolib
 	 */
 
 	vector<bool> GatingHierarchy::boolGating(MemCytoFrame & cytoframe, VertexID u, bool computeTerminalBool){
+		return boolGatingMask(cytoframe, u, computeTerminalBool).to_bool();
+	}
+	EVENT_BITSET GatingHierarchy::boolGatingMask(MemCytoFrame & cytoframe, VertexID u, bool computeTerminalBool){
 
 		nodeProperties & node=getNodeProperty(u);
 		gatePtr  g=node.getGate();
 
-		//init the indices
-	//	unsigned nEvents=fdata.getEventsCount();
-
-	//	vector<bool> ind(nEvents,true);
-		/*it is kinda of expensive to init a long bool vector
-		 *
-		 */
-		vector<bool> ind;
+		EVENT_BITSET ind;
 		/*
 		 * combine the indices of reference populations
 		 */
@@ -773,30 +809,7 @@ namespace cytolib
 				gating(cytoframe, nodeID, true, computeTerminalBool);
 			}
 
-			vector<bool> curPopInd=curPop.getIndices();
-			if(it->isNot)
-				curPopInd.flip();
-
-			/*
-			 * for the first reference node
-			 * assign the indices directly without logical operation
-			 */
-			if(it==boolOpSpec.begin())
-				ind=curPopInd;
-			else
-			{
-				switch(it->op)
-				{
-					case '&':
-						transform (ind.begin(), ind.end(), curPopInd.begin(), ind.begin(),logical_and<bool>());
-						break;
-					case '|':
-						transform (ind.begin(), ind.end(), curPopInd.begin(), ind.begin(),logical_or<bool>());
-						break;
-					default:
-						throw(domain_error("not supported operator!"));
-				}
-			}
+			combine_bool_op(ind, curPop.getMask(), *it, it==boolOpSpec.begin());
 
 		}
 
@@ -816,8 +829,11 @@ namespace cytolib
 	 * @return
 	 */
 	vector<bool> GatingHierarchy::boolGating(MemCytoFrame & cytoframe, vector<BOOL_GATE_OP> boolOpSpec, bool computeTerminalBool){
+		return boolGatingMask(cytoframe, boolOpSpec, computeTerminalBool).to_bool();
+	}
+	EVENT_BITSET GatingHierarchy::boolGatingMask(MemCytoFrame & cytoframe, vector<BOOL_GATE_OP> boolOpSpec, bool computeTerminalBool){
 
-		vector<bool> ind;
+		EVENT_BITSET ind;
 		/*
 		 * combine the indices of reference populations
 		 */
@@ -845,30 +861,7 @@ namespace cytolib
 				gating(cytoframe, nodeID, true, computeTerminalBool);
 			}
 
-			vector<bool> curPopInd=curPop.getIndices();
-			if(it->isNot)
-				curPopInd.flip();
-
-			/*
-			 * for the first reference node
-			 * assign the indices directly without logical operation
-			 */
-			if(it==boolOpSpec.begin())
-				ind=curPopInd;
-			else
-			{
-				switch(it->op)
-				{
-					case '&':
-						transform (ind.begin(), ind.end(), curPopInd.begin(), ind.begin(),logical_and<bool>());
-						break;
-					case '|':
-						transform (ind.begin(), ind.end(), curPopInd.begin(), ind.begin(),logical_or<bool>());
-						break;
-					default:
-						throw(domain_error("not supported operator!"));
-				}
-			}
+			combine_bool_op(ind, curPop.getMask(), *it, it==boolOpSpec.begin());
 
 		}
 
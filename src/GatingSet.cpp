@@ -205,7 +205,8 @@ namespace cytolib
 	void GatingSet::serialize_pb(string path
 			, CytoFileOption cf_opt
 			, bool is_skip_data
-			, const CytoCtx & ctx)
+			, const CytoCtx & ctx
+			, const H5WriteOptions & h5_write_opts)
 	{
 
 		string errmsg = "Not a valid GatingSet archiving folder! " + path + "\n";
@@ -339,7 +340,7 @@ namespace cytolib
 
 
 			pb::GatingHierarchy pb_gh;
-			gh->convertToPb(pb_gh, cf_filename, cf_opt, is_skip_data, ctx);
+			gh->convertToPb(pb_gh, cf_filename, cf_opt, is_skip_data, ctx, h5_write_opts);
 
 
 			bool success = writeDelimitedTo(pb_gh, raw_output);
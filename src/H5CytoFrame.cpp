@@ -1,47 +1,413 @@
 // Copyright 2019 Fred Hutchinson Cancer Research Center
 // See the included LICENSE file for details on the licence that is granted to the user of this software.
 #include <cytolib/H5CytoFrame.hpp>
+#include <cstring>
+#ifdef H5_HAVE_FILTER_DEFLATE
+#include <zlib.h>//the deflate filter of h5 is built on zlib, which is linked along with h5
+#endif
 
 namespace cytolib
 {
+	namespace
+	{
+		/*
+		 * the upper bound of the hyperslab blocks in one selection,
+		 * since h5 (1.10) merges each additional block into the selection in linear time.
+		 * The selections with more blocks are read by batches of this size.
+		 */
+		const size_t H5_MAX_SELECT_BLOCKS = 1024;
+		/*
+		 * the unselected rows within the gaps up to this size are read through
+		 * rather than starting another hyperslab block
+		 */
+		const uword H5_ROW_GAP = 32;
+		/*
+		 * fall back to the full column read when the rows to be read cover more than this fraction of the events
+		 */
+		const double H5_ROW_SUBSET_RATIO = 0.5;
+		typedef vector<pair<hsize_t, hsize_t>> RUNS;//(start, length)
+		/*
+		 * split the sorted unique indices into runs, merging across the gaps up to max_gap
+		 * (i.e. reads the unselected ones within those gaps as well)
+		 */
+		RUNS split_runs(const uvec & idx, uword max_gap)
+		{
+			RUNS runs;
+			size_t n = idx.size();
+			if(n == 0)
+				return runs;
+			hsize_t start = idx[0];
+			for(size_t i = 1; i <= n; i++)
+			{
+				if(i == n || idx[i] - idx[i-1] - 1 > max_gap)
+				{
+					runs.push_back(make_pair(start, idx[i-1] - start + 1));
+					if(i < n)
+						start = idx[i];
+				}
+			}
+			return runs;
+		}
+		bool is_strictly_sorted(const uvec & idx)
+		{
+			return adjacent_find(idx.begin(), idx.end(), greater_equal<uword>()) == idx.end();
+		}
+		/*
+		 * the raw chunk of the events dataset located by its file address
+		 */
+		struct RawChunk{
+			hsize_t col;//the offset of the chunk within the dataset
+			hsize_t row;
+			haddr_t addr;
+			hsize_t nbytes;
+			bool is_shuffled;
+			bool is_deflated;
+		};
+		/*
+		 * reverse the byte shuffle filter of h5
+		 */
+		void unshuffle(const char * src, char * dest, size_t nelem, size_t esize)
+		{
+			for(size_t b = 0; b < esize; b++)
+				for(size_t i = 0; i < nelem; i++)
+					dest[i * esize + b] = src[b * nelem + i];
+		}
+		/*
+		 * read the keywords (or pdata) stored as the compound of the vlen strings
+		 */
+		template<class T> T read_h5_kw(DataSet ds)
+		{
+			struct key_t{
+					char * key;
+					char * value;
+				};
+			StrType str_type(H5::PredType::C_S1, H5T_VARIABLE);	//define variable-length string data type
+			CompType key_type(sizeof(key_t));
+			key_type.insertMember("key", HOFFSET(key_t, key), str_type);
+			key_type.insertMember("value", HOFFSET(key_t, value), str_type);
+
+			DataSpace dsp_key = ds.getSpace();
+			hsize_t dim_key[1];
+			dsp_key.getSimpleExtentDims(dim_key);
+			int nKey = dim_key[0];
+
+			vector<key_t> keyVec(nKey);
+			ds.read(keyVec.data(), key_type);
+			T res;
+			for(auto i = 0; i < nKey; i++)
+			{
+				res[keyVec[i].key] = keyVec[i].value;
+				delete [] keyVec[i].key;//reclaim vlen char
+				delete [] keyVec[i].value;
+			}
+			return res;
+		}
+		template<typename T, typename U> void convert_raw(const char * src, size_t n, bool is_swap, EVENT_DATA_TYPE * dest)
+		{
+			for(size_t i = 0; i < n; i++)
+			{
+				U u;
+				memcpy(&u, src + i * sizeof(U), sizeof(U));
+				if(is_swap)
+					u = sizeof(U) == 4 ? __builtin_bswap32(u) : __builtin_bswap64(u);
+				T v;
+				memcpy(&v, &u, sizeof(T));
+				dest[i] = v;
+			}
+		}
+	}
+
+	bool H5CytoFrame::direct_read = true;
+
+	bool H5CytoFrame::read_data_direct(const uvec & col_idx, EVENT_DATA_VEC & data) const
+	{
+		if(!direct_read || is_remote_path(filename_) || H5Pget_driver(access_plist_.getId()) != H5FD_SEC2)
+			return false;
+		hsize_t nrow = n_rows();
+		bool is_ordered = is_strictly_sorted(col_idx);
+		uvec cols = is_ordered ? col_idx : unique(col_idx);
+		if(cols.size() > 0 && cols[cols.size() - 1] >= dims[0])
+			return false;//leave it to h5 to report the error
+		hsize_t chunk_dims[2];
+		size_t esize;
+		bool is_swap, is_float;
+		vector<RawChunk> chunks;
+		unique_ptr<H5RawRead> raw_read;//keeps the writers from modifying the chunks until they are read
+		{
+			auto h5 = get_h5_handle();
+			if(h5->flags() != H5F_ACC_RDONLY)
+				h5->file().flush(H5F_SCOPE_LOCAL);//the raw data may still be in the chunk cache
+			if(h5->file().getCreatePlist().getUserblock() > 0)
+				return false;//the chunk addresses are relative to the end of the user block
+			auto dataset = h5->dataset(DATASET_NAME);
+			DataType dtype = dataset.getDataType();
+			bool is_le = dtype == PredType::IEEE_F32LE || dtype == PredType::IEEE_F64LE;
+			bool is_be = dtype == PredType::IEEE_F32BE || dtype == PredType::IEEE_F64BE;
+			if(!is_le && !is_be)
+				return false;
+			esize = dtype.getSize();
+			is_float = esize == sizeof(float);
+			is_swap = is_be != is_host_big_endian();
+
+			DSetCreatPropList plist = dataset.getCreatePlist();
+			int shuffle_idx = -1, deflate_idx = -1;
+			for(int i = 0; i < plist.getNfilters(); i++)
+			{
+				unsigned flags, filter_config;
+				size_t cd_nelmts = 0;
+				H5Z_filter_t filter = H5Pget_filter2(plist.getId(), i, &flags, &cd_nelmts, NULL, 0, NULL, &filter_config);
+				if(filter == H5Z_FILTER_SHUFFLE)
+					shuffle_idx = i;
+#ifdef H5_HAVE_FILTER_DEFLATE
+				else if(filter == H5Z_FILTER_DEFLATE)
+					deflate_idx = i;
+#endif
+				else
+					return false;//the other filters are decoded by h5
+			}
+			auto layout = plist.getLayout();
+			if(layout == H5D_CONTIGUOUS)
+			{
+				haddr_t addr = H5Dget_offset(dataset.getId());
+				if(addr == HADDR_UNDEF)
+					return false;
+				//each column is treated as a chunk
+				chunk_dims[0] = 1;
+				chunk_dims[1] = nrow;
+				for(auto c : cols)
+					chunks.push_back(RawChunk{c, 0, addr + c * nrow * esize, nrow * esize, false, false});
+			}
+			else if(layout == H5D_CHUNKED)
+			{
+#if H5_VERSION_GE(1, 10, 5)
+				plist.getChunk(2, chunk_dims);
+				for(unsigned i = 0; i < cols.size(); i++)
+				{
+					hsize_t c0 = cols[i] / chunk_dims[0] * chunk_dims[0];
+					if(chunks.size() > 0 && chunks.back().col == c0)
+						continue;//the chunk of the previous column
+					for(hsize_t r0 = 0; r0 < nrow; r0 += chunk_dims[1])
+					{
+						hsize_t offset[] = {c0, r0};
+						unsigned filter_mask;
+						haddr_t addr;
+						hsize_t nbytes;
+						if(H5Dget_chunk_info_by_coord(dataset.getId(), offset, &filter_mask, &addr, &nbytes) < 0 || addr == HADDR_UNDEF)
+							return false;
+						//the filters skipped for the chunk are flagged in filter_mask
+						bool is_shuffled = shuffle_idx >= 0 && !(filter_mask & (1u << shuffle_idx));
+						bool is_deflated = deflate_idx >= 0 && !(filter_mask & (1u << deflate_idx));
+						chunks.push_back(RawChunk{c0, r0, addr, nbytes, is_shuffled, is_deflated});
+					}
+				}
+#else
+				return false;//the chunk query is not available
+#endif
+			}
+			else
+				return false;
+			raw_read.reset(new H5RawRead(filename_));
+		}
+		/*
+		 * the h5 lock is released from here, the chunks are read and decoded (inflated and unshuffled) concurrently
+		 */
+		size_t chunk_bytes = chunk_dims[0] * chunk_dims[1] * esize;
+		ifstream in(filename_, ios::in|ios::binary);
+		if(!in.is_open())
+			return false;
+		EVENT_DATA_VEC buf(nrow, cols.size());
+		vector<char> raw(chunk_bytes), unshuffled(chunk_bytes), deflated;
+		unsigned k = 0;//the first column (within cols) of the current chunk
+		for(const auto & chunk : chunks)
+		{
+			if(chunk.is_deflated)
+			{
+#ifdef H5_HAVE_FILTER_DEFLATE
+				deflated.resize(chunk.nbytes);
+				in.seekg(chunk.addr);
+				in.read(deflated.data(), chunk.nbytes);
+				if(static_cast<hsize_t>(in.gcount()) != chunk.nbytes)
+					return false;
+				uLongf nbytes = chunk_bytes;
+				if(uncompress(reinterpret_cast<Bytef *>(raw.data()), &nbytes, reinterpret_cast<const Bytef *>(deflated.data()), chunk.nbytes) != Z_OK
+						|| nbytes != chunk_bytes)
+					return false;
+#else
+				return false;
+#endif
+			}
+			else
+			{
+				if(chunk.nbytes != chunk_bytes)
+					return false;
+				in.seekg(chunk.addr);
+				in.read(raw.data(), chunk_bytes);
+				if(static_cast<size_t>(in.gcount()) != chunk_bytes)
+					return false;
+			}
+			const char * src = raw.data();
+			if(chunk.is_shuffled)
+			{
+				unshuffle(src, unshuffled.data(), chunk_bytes / esize, esize);
+				src = unshuffled.data();
+			}
+			while(k < cols.size() && cols[k] < chunk.col)
+				k++;
+			hsize_t n = min(chunk_dims[1], nrow - chunk.row);
+			//the rows of each column are contiguous within the chunk
+			for(unsigned j = k; j < cols.size() && cols[j] < chunk.col + chunk_dims[0]; j++)
+			{
+				const char * col_src = src + (cols[j] - chunk.col) * chunk_dims[1] * esize;
+				EVENT_DATA_TYPE * dest = buf.colptr(j) + chunk.row;
+				if(is_float)
+					convert_raw<float, uint32_t>(col_src, n, is_swap, dest);
+				else
+					convert_raw<double, uint64_t>(col_src, n, is_swap, dest);
+			}
+		}
+		if(is_ordered)
+			data = buf;
+		else
+		{
+			data.set_size(nrow, col_idx.size());
+			for(unsigned i = 0; i < col_idx.size(); i++)
+				data.col(i) = buf.col(lower_bound(cols.begin(), cols.end(), col_idx[i]) - cols.begin());
+		}
+		return true;
+	}
+
 	EVENT_DATA_VEC H5CytoFrame::read_data(uvec col_idx) const
 	{
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
-		auto dataset = file.openDataSet(DATASET_NAME);
+		EVENT_DATA_VEC data;
+		if(read_data_direct(col_idx, data))
+			return data;
+
+		auto h5 = get_h5_handle();
+		auto dataset = h5->dataset(DATASET_NAME);
 		auto dataspace = dataset.getSpace();
 
 		unsigned nrow = n_rows();
 		unsigned ncol = col_idx.size();
+		data.set_size(nrow, ncol);
+		if(ncol == 0 || nrow == 0)
+			return data;
 		/*
-		 * Define the memory dataspace.
+		 * h5 always transfers the union selection in the order of the file,
+		 * so the unsorted or duplicated columns are read as the sorted unique ones first and then rearranged
 		 */
-		hsize_t dimsm[] = {ncol, nrow};
-		DataSpace memspace(2,dimsm);
-		hsize_t      offset_mem[2];
-		hsize_t      count_mem[2];
-		EVENT_DATA_VEC data(nrow, ncol);
-		//reach one col at a time
-		for(unsigned i = 0; i < ncol; i++)
+		bool is_ordered = is_strictly_sorted(col_idx);
+		uvec cols = is_ordered ? col_idx : unique(col_idx);
+		/*
+		 * select the union of the contiguous runs of columns so that all of them are read by one H5Dread
+		 */
+		auto col_runs = split_runs(cols, 0);
+		for(unsigned i = 0; i < col_runs.size(); i++)
 		{
-			//select slab for h5 data space
-			unsigned idx = col_idx[i];
-			hsize_t      offset[] = {idx, 0};   // hyperslab offset in the file
-			hsize_t      count[] = {1, nrow};    // size of the hyperslab in the file
-			dataspace.selectHyperslab( H5S_SELECT_SET, count, offset );
-
-			//select slab for mem
-			offset_mem[0] = i;
-			offset_mem[1] = 0;
-			count_mem[0]  = 1;
-			count_mem[1]  = nrow;
-			memspace.selectHyperslab( H5S_SELECT_SET, count_mem, offset_mem );
-
+			hsize_t      offset[] = {col_runs[i].first, 0};   // hyperslab offset in the file
+			hsize_t      count[] = {col_runs[i].second, nrow};    // size of the hyperslab in the file
+			dataspace.selectHyperslab(i == 0 ? H5S_SELECT_SET : H5S_SELECT_OR, count, offset);
+		}
+		/*
+		 * the col-major arma matrix is exactly the row-major (col, row) layout of the h5 dataset
+		 */
+		hsize_t dimsm[] = {cols.size(), nrow};
+		DataSpace memspace(2,dimsm);
+		if(is_ordered)
 			dataset.read(data.memptr(), h5_datatype_data(DataTypeLocation::MEM) ,memspace, dataspace);
+		else
+		{
+			EVENT_DATA_VEC buf(nrow, cols.size());
+			dataset.read(buf.memptr(), h5_datatype_data(DataTypeLocation::MEM) ,memspace, dataspace);
+			for(unsigned i = 0; i < ncol; i++)
+			{
+				unsigned k = lower_bound(cols.begin(), cols.end(), col_idx[i]) - cols.begin();
+				data.col(i) = buf.col(k);
+			}
 		}
 
 		return data;
 	}
 
+	vector<pair<hsize_t, hsize_t>> H5CytoFrame::row_read_runs(const uvec & rows, hsize_t nrow)
+	{
+		RUNS runs = split_runs(rows, H5_ROW_GAP);
+		hsize_t nread = 0;
+		for(const auto & r : runs)
+			nread += r.second;
+		if(nread > nrow * H5_ROW_SUBSET_RATIO)
+		{
+			//read the entire span of the selected rows instead
+			runs = RUNS(1, make_pair(rows[0], rows[rows.size() - 1] - rows[0] + 1));
+		}
+		return runs;
+	}
+
+	EVENT_DATA_VEC H5CytoFrame::read_data(uvec col_idx, uvec row_idx) const
+	{
+		unsigned nrow = n_rows();
+		if(col_idx.size() == 0 || row_idx.size() == 0)
+			return EVENT_DATA_VEC(row_idx.size(), col_idx.size());
+
+		uvec rows = is_strictly_sorted(row_idx) ? row_idx : unique(row_idx);
+		if(rows[rows.size() - 1] >= nrow)
+			throw(domain_error("The row index exceeds the number of events: " + to_string(rows[rows.size() - 1])));
+		uvec cols = is_strictly_sorted(col_idx) ? col_idx : unique(col_idx);
+		auto col_runs = split_runs(cols, 0);
+		RUNS row_runs = row_read_runs(rows, nrow);
+		vector<hsize_t> run_offset(row_runs.size());//the position of each run within the rows to be read
+		hsize_t nread = 0;
+		for(unsigned i = 0; i < row_runs.size(); i++)
+		{
+			run_offset[i] = nread;
+			nread += row_runs[i].second;
+		}
+
+		auto h5 = get_h5_handle();
+		auto dataset = h5->dataset(DATASET_NAME);
+		auto dataspace = dataset.getSpace();
+		EVENT_DATA_VEC buf(nread, cols.size());
+		//the col-major buffer is the row-major (col, row) layout of the h5 dataset
+		hsize_t dimsm[] = {cols.size(), nread};
+		DataSpace memspace(2,dimsm);
+		/*
+		 * read by batches of the row runs so that each selection stays within H5_MAX_SELECT_BLOCKS
+		 * instead of merging the runs (which would read the unselected rows across the large gaps)
+		 */
+		size_t batch = max<size_t>(1, H5_MAX_SELECT_BLOCKS / col_runs.size());
+		for(size_t b = 0; b < row_runs.size(); b += batch)
+		{
+			size_t e = min(b + batch, row_runs.size());
+			bool is_first = true;
+			for(const auto & c : col_runs)
+				for(size_t k = b; k < e; k++)
+				{
+					hsize_t      offset[] = {c.first, row_runs[k].first};
+					hsize_t      count[] = {c.second, row_runs[k].second};
+					dataspace.selectHyperslab(is_first ? H5S_SELECT_SET : H5S_SELECT_OR, count, offset);
+					is_first = false;
+				}
+			//the rows of the batch are contiguous within the buffer
+			hsize_t      offset_m[] = {0, run_offset[b]};
+			hsize_t      count_m[] = {cols.size(), (e < row_runs.size() ? run_offset[e] : nread) - run_offset[b]};
+			memspace.selectHyperslab(H5S_SELECT_SET, count_m, offset_m);
+			dataset.read(buf.memptr(), h5_datatype_data(DataTypeLocation::MEM) ,memspace, dataspace);
+		}
+
+		//locate the requested rows and cols within the buffer
+		uvec rpos(row_idx.size());
+		for(unsigned i = 0; i < row_idx.size(); i++)
+		{
+			auto it = upper_bound(row_runs.begin(), row_runs.end(), row_idx[i]
+								, [](uword r, const pair<hsize_t, hsize_t> & run){return r < run.first;});
+			auto k = it - row_runs.begin() - 1;
+			rpos[i] = run_offset[k] + row_idx[i] - row_runs[k].first;
+		}
+		uvec cpos(col_idx.size());
+		for(unsigned i = 0; i < col_idx.size(); i++)
+			cpos[i] = lower_bound(cols.begin(), cols.end(), col_idx[i]) - cols.begin();
+		return buf.submat(rpos, cpos);
+	}
+
 
 	/*
 	 * for simplicity, we don't want to handle the object that has all the h5 handler closed
@@ -64,10 +430,10 @@ namespace cytolib
 	void H5CytoFrame::flush_params()
 	{
 		check_write_permission();
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
+		auto h5 = get_h5_handle();
 
 		CompType param_type = get_h5_datatype_params(DataTypeLocation::MEM);
-		DataSet ds = file.openDataSet("params");
+		DataSet ds = h5->dataset("params");
 		hsize_t size[1] = {params.size()};
 		ds.extend(size);
 		auto params_char = params_c_str();
@@ -80,9 +446,10 @@ namespace cytolib
 	void H5CytoFrame::flush_keys()
 	{
 		check_write_permission();
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
+		ensure_keys_loaded();//flush the full set rather than an empty cache
+		auto h5 = get_h5_handle();
 		CompType key_type = get_h5_datatype_keys();
-		DataSet ds = file.openDataSet("keywords");
+		DataSet ds = h5->dataset("keywords");
 		auto keyVec = to_kw_vec<KEY_WORDS>(keys_);
 
 		hsize_t size[1] = {keyVec.size()};
@@ -95,9 +462,10 @@ namespace cytolib
 	void H5CytoFrame::flush_pheno_data()
 	{
 		check_write_permission();
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
+		ensure_pheno_data_loaded();//flush the full set rather than an empty cache
+		auto h5 = get_h5_handle();
 		CompType key_type = get_h5_datatype_keys();
-		DataSet ds = file.openDataSet("pdata");
+		DataSet ds = h5->dataset("pdata");
 
 		auto keyVec = to_kw_vec<PDATA>(pheno_data_);
 		hsize_t size[1] = {keyVec.size()};
@@ -115,8 +483,20 @@ namespace cytolib
 	 * abandon the changes to the meta data in cache by reloading them from disk
 	 */
 	void H5CytoFrame::load_meta(){
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
-		DataSet ds_param = file.openDataSet("params");
+		auto h5 = get_h5_handle();
+		load_params();
+		is_keys_loaded = false;
+		is_dirty_keys = false;
+		is_pdata_loaded = false;
+		is_dirty_pdata = false;
+	}
+
+	void H5CytoFrame::load_params(){
+		auto h5 = get_h5_handle();
+		auto dataset = h5->dataset(DATASET_NAME);
+		dataset.getSpace().getSimpleExtentDims(dims);
+
+		DataSet ds_param = h5->dataset("params");
 	//	DataType param_type = ds_param.getDataType();
 
 		hsize_t dim_param[1];
@@ -175,64 +555,204 @@ namespace cytolib
 		}
 		CytoFrame::set_params(params);
 		is_dirty_params = false;
-		/*
-		 * read keywords
-		 */
-		struct key_t{
-				char * key;
-				char * value;
-	//			key_t(const char * k, const char * v):key(k),value(v){};
-			};
-		CompType key_type(sizeof(key_t));
-		key_type.insertMember("key", HOFFSET(key_t, key), str_type);
-		key_type.insertMember("value", HOFFSET(key_t, value), str_type);
-
-
-		DataSet ds_key = file.openDataSet( "keywords");
-		DataSpace dsp_key = ds_key.getSpace();
-		hsize_t dim_key[1];
-		dsp_key.getSimpleExtentDims(dim_key);
-		int nKey = dim_key[0];
-
-		vector<key_t> keyVec(nKey);
-		ds_key.read(keyVec.data(), key_type);
-		for(auto i = 0; i < nKey; i++)
+	}
+
+	void H5CytoFrame::ensure_keys_loaded() const
+	{
+		if(is_keys_loaded)
+			return;
+		auto h5 = get_h5_handle();
+		if(!is_keys_loaded)//may have been loaded by another thread while waiting for the lock
 		{
-			keys_[keyVec[i].key] = keyVec[i].value;
-			delete [] keyVec[i].key;
-			delete [] keyVec[i].value;
-
-//			keys[i].first = keyVec[i].key;
-//			delete [] keyVec[i].key;
-//			keys[i].second = keyVec[i].value;
-//			delete [] keyVec[i].value;
+			//the cache of keywords is filled in place, which is not considered as the modification of the frame
+			auto & self = const_cast<H5CytoFrame &>(*this);
+			self.keys_ = read_h5_kw<KEY_WORDS>(h5->dataset("keywords"));
+			self.is_dirty_keys = false;
+			is_keys_loaded = true;
 		}
-		is_dirty_keys = false;
-		/*
-		 *
-		 * read pdata
-		 */
-		DataSet ds_pd = file.openDataSet( "pdata");
-		DataSpace dsp_pd = ds_pd.getSpace();
-		hsize_t dim_pd[1];
-		dsp_pd.getSimpleExtentDims(dim_pd);
-		int nPd = dim_pd[0];
-
-		keyVec.resize(nPd);
-		ds_pd.read(keyVec.data(), key_type);
-		for(auto i = 0; i < nPd; i++)
+	}
+
+	void H5CytoFrame::ensure_pheno_data_loaded() const
+	{
+		if(is_pdata_loaded)
+			return;
+		auto h5 = get_h5_handle();
+		if(!is_pdata_loaded)
 		{
-			pheno_data_[keyVec[i].key] = keyVec[i].value;
-			delete [] keyVec[i].key;
-			delete [] keyVec[i].value;
+			auto & self = const_cast<H5CytoFrame &>(*this);
+			self.pheno_data_ = read_h5_kw<PDATA>(h5->dataset("pdata"));
+			self.is_dirty_pdata = false;
+			is_pdata_loaded = true;
 		}
-		is_dirty_pdata = false;
+	}
+
+
 
+
+
+	void H5CytoFrame::set_columns(uvec col_idx, const EVENT_DATA_VEC & cols)
+	{
+		check_write_permission();
+		unsigned nrow = n_rows();
+		unsigned ncol = col_idx.size();
+		if(cols.n_cols != ncol || cols.n_rows != nrow)
+			throw(domain_error("The size of the input columns is different from the cytoframe!"));
+		if(ncol == 0 || nrow == 0)
+			return;
+		//the selection is transferred in the order of the file, thus sort the input columns accordingly
+		bool is_ordered = is_strictly_sorted(col_idx);
+		EVENT_DATA_VEC sorted_cols;
+		if(!is_ordered)
+		{
+			uvec ord = sort_index(col_idx);
+			col_idx = col_idx(ord);
+			if(!is_strictly_sorted(col_idx))
+				throw(domain_error("Duplicated column index!"));
+			sorted_cols = cols.cols(ord);
+		}
+		if(col_idx[ncol - 1] >= dims[0])
+			throw(domain_error("The column index exceeds the number of columns: " + to_string(col_idx[ncol - 1])));
+
+		auto h5 = get_h5_handle();
+		H5FileCache::wait_raw_reads(filename_);//the chunks may be moved or overwritten
+		auto dataset = h5->dataset(DATASET_NAME);
+		auto dataspace = dataset.getSpace();
+		auto col_runs = split_runs(col_idx, 0);
+		for(unsigned i = 0; i < col_runs.size(); i++)
+		{
+			hsize_t      offset[] = {col_runs[i].first, 0};
+			hsize_t      count[] = {col_runs[i].second, nrow};
+			dataspace.selectHyperslab(i == 0 ? H5S_SELECT_SET : H5S_SELECT_OR, count, offset);
+		}
+		hsize_t dimsm[] = {ncol, nrow};
+		DataSpace memspace(2,dimsm);
+		dataset.write(is_ordered ? cols.memptr() : sorted_cols.memptr(), h5_datatype_data(DataTypeLocation::MEM), memspace, dataspace);
+		dataset.flush(H5F_SCOPE_LOCAL);
 	}
 
+	void H5CytoFrame::append_data_columns(const EVENT_DATA_VEC & new_cols)
+	{
+		check_write_permission();
+		unsigned nrow = n_rows();
+		if(new_cols.n_rows != nrow)
+			throw(domain_error("The number of rows of the new columns is different from the cytoframe!"));
+		if(new_cols.n_cols == 0)
+			return;
+		auto h5 = get_h5_handle();
+		H5FileCache::wait_raw_reads(filename_);//the chunks may be moved or overwritten
+		auto dataset = h5->dataset(DATASET_NAME);
+		hsize_t ncol_old = dims[0];
+		hsize_t dims_data[2] = {ncol_old + new_cols.n_cols, nrow};
+		dataset.extend(dims_data);
+		auto dataspace = dataset.getSpace();
+		dataspace.getSimpleExtentDims(dims);
+		if(nrow == 0)
+			return;
+
+		hsize_t      offset[] = {ncol_old, 0};
+		hsize_t      count[] = {new_cols.n_cols, nrow};
+		dataspace.selectHyperslab(H5S_SELECT_SET, count, offset);
+		DataSpace memspace(2, count);
+		dataset.write(new_cols.memptr(), h5_datatype_data(DataTypeLocation::MEM), memspace, dataspace);
+		dataset.flush(H5F_SCOPE_LOCAL);
+	}
 
+	size_t H5CytoFrame::copy_buffer_size = 64 * 1024 * 1024;
 
+	H5WriteOptions H5CytoFrame::get_write_options() const
+	{
+		H5WriteOptions opts;
+		auto h5 = get_h5_handle();
+		auto dataset = h5->dataset(DATASET_NAME);
+		opts.double_precision = dataset.getDataType().getSize() == sizeof(double);
+		auto plist = dataset.getCreatePlist();
+		if(plist.getLayout() == H5D_CHUNKED)
+		{
+			hsize_t chunk_dims[2];
+			plist.getChunk(2, chunk_dims);
+			opts.chunk_cols = chunk_dims[0];
+			opts.chunk_rows = chunk_dims[1] >= dims[1] ? 0 : chunk_dims[1];
+			for(int i = 0, n = plist.getNfilters(); i < n; i++)
+			{
+				unsigned flags, filter_config, cd_values[1] = {6};
+				size_t cd_nelmts = 1;
+				char name[1];
+				H5Z_filter_t filter = plist.getFilter(i, flags, cd_nelmts, cd_values, 1, name, filter_config);
+				if(filter == H5Z_FILTER_SHUFFLE)
+					opts.shuffle = true;
+				else if(filter == H5Z_FILTER_DEFLATE)
+					opts.deflate_level = cd_values[0];
+			}
+		}
+		return opts;
+	}
 
+	void H5CytoFrame::copy_subset(const string & h5_filename, const uvec & row_idx, const uvec & col_idx, const H5WriteOptions & h5_write_opts) const
+	{
+		if(fs::exists(h5_filename) && fs::equivalent(fs::path(h5_filename), fs::path(filename_)))
+		{
+			//realizing in place has to load the events before truncating the source file
+			MemCytoFrame fr(*this);
+			fr.copy(row_idx, col_idx)->write_h5(h5_filename, h5_write_opts);
+			return;
+		}
+		hsize_t nrow = row_idx.size();
+		hsize_t ncol = col_idx.size();
+		for(auto j : col_idx)
+			if(j >= n_cols())
+				throw(domain_error("The column index exceeds the number of parameters: " + to_string(j)));
+		//meta data of the subset, which never reads the events
+		H5CytoFrame meta(*this);
+		meta.subset_parameters(col_idx);
+		meta.dims[0] = ncol;
+		meta.dims[1] = nrow;
+
+		lock_guard<recursive_mutex> guard(H5FileCache::h5_mutex());
+		H5FileCache::release(h5_filename);//the cached handle would block the truncation
+		H5File file(h5_filename, H5F_ACC_TRUNC);
+		meta.write_h5_params(file);
+		meta.write_h5_keys(file);
+		meta.write_h5_pheno_data(file);
+		DataSet dataset = create_h5_dataset(file, ncol, nrow, h5_write_opts);
+		if(nrow > 0 && ncol > 0)
+		{
+			auto dataspace = dataset.getSpace();
+			hsize_t nblock = max<hsize_t>(1, copy_buffer_size / (sizeof(EVENT_DATA_TYPE) * ncol));
+			for(hsize_t start = 0, n; start < nrow; start += n)
+			{
+				/*
+				 * the rows read from disk for the block (see row_read_runs) can be many more than its output rows
+				 * when they are scattered, so the block is halved until those fit in the buffer as well
+				 */
+				n = min(nblock, nrow - start);
+				while(n > 1)
+				{
+					uvec rows = unique(row_idx.subvec(start, start + n - 1));
+					hsize_t nread = 0;
+					for(const auto & r : row_read_runs(rows, n_rows()))
+						nread += r.second;
+					if(nread <= nblock)
+						break;
+					n /= 2;
+				}
+				EVENT_DATA_VEC block = read_data(col_idx, row_idx.subvec(start, start + n - 1));
+				//(n, ncol) col-major block is the (ncol, n) hyperslab of the file
+				hsize_t      offset[] = {0, start};
+				hsize_t      count[] = {ncol, n};
+				dataspace.selectHyperslab(H5S_SELECT_SET, count, offset);
+				DataSpace memspace(2, count);
+				dataset.write(block.memptr(), h5_datatype_data(DataTypeLocation::MEM), memspace, dataspace);
+			}
+		}
+		auto rn = get_rownames();
+		if(rn.size() > 0)
+		{
+			vector<string> rn_new(nrow);
+			for(unsigned i = 0; i < nrow; i++)
+				rn_new[i] = rn[row_idx[i]];
+			meta.write_h5_rownames(file, rn_new);
+		}
+	}
 
 	/**
 	 * copy setter
@@ -240,15 +760,16 @@ namespace cytolib
 	 */
 	void H5CytoFrame::set_data(const EVENT_DATA_VEC & _data)
 	{
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
 		check_write_permission();
+		auto h5 = get_h5_handle();
+		H5FileCache::wait_raw_reads(filename_);//the chunks may be moved or overwritten
 		hsize_t dims_data[2] = {_data.n_cols, _data.n_rows};
 
 		// For the case that the data matrix has been re-sized
 		dims[0] = _data.n_cols;
 		dims[1] = _data.n_rows;
 
-		auto dataset = file.openDataSet(DATASET_NAME);
+		auto dataset = h5->dataset(DATASET_NAME);
 
 		dataset.extend(dims_data);
 		//refresh data space and dims
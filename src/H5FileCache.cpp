@@ -0,0 +1,249 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/H5FileCache.hpp>
+#include <list>
+#include <sys/stat.h>
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
+
+namespace cytolib
+{
+	namespace
+	{
+		/*
+		 * identity of the file on disk, which detects the file that has been replaced
+		 * (e.g. removed and re-created at the same path) behind the cache
+		 */
+		struct FileId{
+			bool valid;
+			dev_t dev;
+			ino_t ino;
+			bool operator==(const FileId & other) const{
+				return valid == other.valid && dev == other.dev && ino == other.ino;
+			}
+		};
+		FileId get_file_id(const string & path, bool is_remote)
+		{
+			FileId id = {false, 0, 0};
+			struct stat st;
+			if(!is_remote && stat(path.c_str(), &st) == 0)
+			{
+				id.valid = true;
+				id.dev = st.st_dev;
+				id.ino = st.st_ino;
+			}
+			return id;
+		}
+		struct CacheEntry{
+			string key;
+			FileId id;
+			H5FileHandlePtr handle;
+		};
+		/*
+		 * the entries are ordered by the recent use, with the most recent one at front
+		 */
+		struct LRUCache{
+			list<CacheEntry> entries;
+			unordered_map<string, list<CacheEntry>::iterator> index;
+			size_t capacity = 64;
+			//raw data chunk cache of each dataset, which holds the row-block chunks across the channels
+			size_t chunk_cache_bytes = 8 * 1024 * 1024;
+			size_t chunk_cache_slots = 4099;//prime number as suggested by h5
+			mutex mtx;
+			void erase(list<CacheEntry>::iterator it){
+				index.erase(it->key);
+				entries.erase(it);
+			}
+			void shrink(){
+				while(entries.size() > capacity)
+					erase(prev(entries.end()));
+			}
+		};
+		LRUCache & get_cache()
+		{
+			static LRUCache cache;
+			return cache;
+		}
+		/*
+		 * the number of the ongoing raw reads of each file
+		 */
+		struct RawReads{
+			unordered_map<string, unsigned> count;
+			mutex mtx;
+			condition_variable done;
+		};
+		RawReads & get_raw_reads()
+		{
+			static RawReads reads;
+			return reads;
+		}
+		/*
+		 * whether the file key is the path itself or under the directory path
+		 */
+		bool is_under_path(const string & k, const string & key)
+		{
+			if(k == key)
+				return true;
+			return k.size() > key.size() && k.compare(0, key.size(), key) == 0
+					&& (k[key.size()] == '/' || k[key.size()] == '\\');
+		}
+		string normalize_path(const string & path, bool is_remote)
+		{
+			if(is_remote)
+				return path;
+			auto p = fs::absolute(fs::path(path)).lexically_normal();
+			if(p.filename_is_dot())//trailing separator of the directory
+				p = p.parent_path();
+			return p.string();
+		}
+	}
+
+	DataSet H5FileHandle::dataset(const string & name)
+	{
+		lock_guard<recursive_mutex> h5_guard(H5FileCache::h5_mutex());
+		lock_guard<mutex> guard(mtx_);
+		auto it = datasets_.find(name);
+		if(it == datasets_.end())
+		{
+			size_t nbytes, nslots;
+			H5FileCache::get_chunk_cache(nbytes, nslots);
+			DSetAccPropList dapl;
+			dapl.setChunkCache(nslots, nbytes, H5D_CHUNK_CACHE_W0_DEFAULT);
+			it = datasets_.emplace(name, file_.openDataSet(name, dapl)).first;
+		}
+		return it->second;
+	}
+
+	H5FileHandle::~H5FileHandle()
+	{
+		//close the file under the lock since the last holder can be any thread
+		lock_guard<recursive_mutex> guard(H5FileCache::h5_mutex());
+		datasets_.clear();
+		file_.close();
+	}
+
+	H5FileHandlePtr H5FileCache::open(const string & filename, unsigned flags, const FileAccPropList & access_plist)
+	{
+		lock_guard<recursive_mutex> h5_guard(h5_mutex());
+		auto & cache = get_cache();
+		bool is_remote = is_remote_path(filename);
+		auto key = normalize_path(filename, is_remote);
+		lock_guard<mutex> guard(cache.mtx);
+		if(cache.capacity == 0)
+			return H5FileHandlePtr(new H5FileHandle(filename, flags, access_plist));
+
+		auto id = get_file_id(key, is_remote);
+		auto it = cache.index.find(key);
+		if(it != cache.index.end())
+		{
+			auto eit = it->second;
+			bool is_compatible = flags == H5F_ACC_RDONLY || eit->handle->flags() == flags;
+			if(is_compatible && eit->id == id)
+			{
+				cache.entries.splice(cache.entries.begin(), cache.entries, eit);
+				return eit->handle;
+			}
+			//drop the stale or read-only handle before reopening
+			cache.erase(eit);
+		}
+		H5FileHandlePtr handle(new H5FileHandle(filename, flags, access_plist));
+		cache.entries.push_front(CacheEntry{key, id, handle});
+		cache.index[key] = cache.entries.begin();
+		cache.shrink();
+		return handle;
+	}
+	void H5FileCache::release(const string & path)
+	{
+		lock_guard<recursive_mutex> h5_guard(h5_mutex());
+		auto & cache = get_cache();
+		auto key = normalize_path(path, is_remote_path(path));
+		//the file is about to be replaced or removed
+		wait_raw_reads(path);
+		lock_guard<mutex> guard(cache.mtx);
+		for(auto it = cache.entries.begin(); it != cache.entries.end();)
+		{
+			auto cur = it++;
+			if(is_under_path(cur->key, key))
+				cache.erase(cur);
+		}
+	}
+	void H5FileCache::clear()
+	{
+		lock_guard<recursive_mutex> h5_guard(h5_mutex());
+		auto & cache = get_cache();
+		lock_guard<mutex> guard(cache.mtx);
+		cache.index.clear();
+		cache.entries.clear();
+	}
+	void H5FileCache::set_capacity(size_t n)
+	{
+		//the evicted handles are closed under h5 lock, which has to be taken before cache.mtx as the other entries do
+		lock_guard<recursive_mutex> h5_guard(h5_mutex());
+		auto & cache = get_cache();
+		lock_guard<mutex> guard(cache.mtx);
+		cache.capacity = n;
+		cache.shrink();
+	}
+	size_t H5FileCache::get_capacity()
+	{
+		auto & cache = get_cache();
+		lock_guard<mutex> guard(cache.mtx);
+		return cache.capacity;
+	}
+	void H5FileCache::set_chunk_cache(size_t nbytes, size_t nslots)
+	{
+		auto & cache = get_cache();
+		lock_guard<mutex> guard(cache.mtx);
+		cache.chunk_cache_bytes = nbytes;
+		cache.chunk_cache_slots = nslots;
+	}
+	void H5FileCache::get_chunk_cache(size_t & nbytes, size_t & nslots)
+	{
+		auto & cache = get_cache();
+		lock_guard<mutex> guard(cache.mtx);
+		nbytes = cache.chunk_cache_bytes;
+		nslots = cache.chunk_cache_slots;
+	}
+	size_t H5FileCache::size()
+	{
+		auto & cache = get_cache();
+		lock_guard<mutex> guard(cache.mtx);
+		return cache.entries.size();
+	}
+	recursive_mutex & H5FileCache::h5_mutex()
+	{
+		static recursive_mutex mtx;
+		return mtx;
+	}
+	void H5FileCache::begin_raw_read(const string & filename)
+	{
+		auto key = normalize_path(filename, is_remote_path(filename));
+		auto & reads = get_raw_reads();
+		lock_guard<mutex> guard(reads.mtx);
+		reads.count[key]++;
+	}
+	void H5FileCache::end_raw_read(const string & filename)
+	{
+		auto key = normalize_path(filename, is_remote_path(filename));
+		auto & reads = get_raw_reads();
+		{
+			lock_guard<mutex> guard(reads.mtx);
+			auto it = reads.count.find(key);
+			if(it != reads.count.end() && --it->second == 0)
+				reads.count.erase(it);
+		}
+		reads.done.notify_all();
+	}
+	void H5FileCache::wait_raw_reads(const string & path)
+	{
+		auto key = normalize_path(path, is_remote_path(path));
+		auto & reads = get_raw_reads();
+		unique_lock<mutex> lock(reads.mtx);
+		reads.done.wait(lock, [&reads, &key](){
+			for(const auto & it : reads.count)
+				if(is_under_path(it.first, key))
+					return false;
+			return true;
+		});
+	}
+};
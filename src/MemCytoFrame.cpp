@@ -78,7 +78,23 @@ namespace cytolib
 
 	}
 
-	void MemCytoFrame::string_to_keywords(string txt, bool emptyValue){
+	/*
+	 * trim the white spaces of a raw token
+	 * the delimiter is never trimmed since it can only be part of an escaped double delimiter within the token
+	 */
+	static boost::string_view trim_token(boost::string_view token, char delimiter)
+	{
+		auto is_trimmed = [delimiter](char c){return c != delimiter && isspace(static_cast<unsigned char>(c));};
+		while(!token.empty() && is_trimmed(token.front()))
+			token.remove_prefix(1);
+		while(!token.empty() && is_trimmed(token.back()))
+			token.remove_suffix(1);
+		return token;
+	}
+
+	void MemCytoFrame::string_to_keywords(boost::string_view txt, bool emptyValue){
+		if(txt.empty())
+			return;
 		/*
 		 * get the first character as delimiter
 		 */
@@ -87,77 +103,77 @@ namespace cytolib
 		/*
 		 * check if string ends with delimiter
 		 */
-		bool isDelimiterEnd = txt[txt.size()-1] == delimiter;
-
-
-
-		std::string doubleDelimiter,magicString;
-		doubleDelimiter.push_back(delimiter);
-		doubleDelimiter.push_back(delimiter);
-		//search for the first unused odd char as replacememnt for double delimiter
-		//FCS 3.1 states only 0-126 ASCII are legal delimiter, but we can't assume the file always follows the standard
-		//also the TEXT main contain some special characters , thus we want to make sure the replacement char is not used anywhere in FCS TEXT
-		unsigned char oddChar = 127;
-		for(; oddChar < 255; oddChar++)
-		{
-
-			if(oddChar==delimiter||txt.find(oddChar)!=std::string::npos)
-				continue;
-			else
-				break;
-		}
-		if(oddChar==255)
-			throw(domain_error("Can't find the unused odd character from ASCII(127-255) in FSC TEXT section!"));
+		bool isDelimiterEnd = txt.back() == delimiter;
 
-		std::string soddChar;
-		soddChar.push_back(oddChar);
 		/*
-		 *	when empty value is allowed, we have to take the assumption that there is no double delimiters in any keys or values,
+		 * single pass over the TEXT, where each token is emitted as soon as the next delimiter is found.
+		 * The double delimiters (scanned from left to right) are treated as the escaped delimiter within the token
+		 * unless empty value is allowed, in which case we have to take the assumption that
+		 * there is no double delimiters in any keys or values.
+		 * The very last token is held back until the end since it is skipped when TEXT ends with delimiter.
 		 */
-		if(!emptyValue)//replace the double delimiter with the odd char
-			boost::replace_all(txt, doubleDelimiter, soddChar);
-		std::vector<std::string> tokens;
-		boost::split(tokens, txt, [delimiter](char c){return c == delimiter;});
-//		PRINT( txt + "\n");
-
-		unsigned j = isDelimiterEnd?tokens.size()-2:tokens.size()-1;//last token, skip the last empty one when end with delimiter
-		string key;
-		for(unsigned i = 1; i <= j; i++){//counter, start with 1 to skip the first empty tokens
-			std::string token = tokens[i];
-			boost::trim(token);
-//				PRINT( token + " ");
-			if(!emptyValue){
-				/*
-				 * restore double delimiter when needed
-				 * (this slows down things quite a bit, but still a lot faster than R version,
-				 *  and this double delimiter logic is not normally invoked anyway)
-				 */
-
-				boost::replace_all(token, soddChar, string(1, delimiter));//unescape the double delimiter to single one
-	//				std::PRINT( token;
-			}
-//				PRINT("\n");
-
-			if((i)%2 == 1)
+		string key, value;
+		unsigned i = 0;//token counter, the first (empty) token is skipped
+		auto set_token = [&](boost::string_view raw, bool hasEscape){
+			if(i > 0)
 			{
-				if(token.empty())
-					// Rcpp::stop (temporarily switch from stop to range_error due to a bug in Rcpp 0.12.8)
-					throw std::range_error("Empty keyword name detected!If it is due to the double delimiters in keyword value, please set emptyValue to FALSE and try again!");
+				raw = trim_token(raw, delimiter);
+				string & token = (i%2 == 1)?key:value;
+				if(hasEscape)
+				{
+					//unescape the double delimiter to single one
+					token.clear();
+					for(size_t k = 0; k < raw.size(); k++)
+					{
+						token.push_back(raw[k]);
+						if(raw[k] == delimiter)
+							k++;
+					}
+				}
+				else
+					token.assign(raw.data(), raw.size());
 
-				key = token;//set key
-			}
-			else{
-				keys_[key] = token;//set value
-//				PRINT( token + " ");
+				if((i)%2 == 1)
+				{
+					if(key.empty())
+						// Rcpp::stop (temporarily switch from stop to range_error due to a bug in Rcpp 0.12.8)
+						throw std::range_error("Empty keyword name detected!If it is due to the double delimiters in keyword value, please set emptyValue to FALSE and try again!");
+				}
+				else
+					keys_[key] = value;//set value
 			}
+			i++;
+		};
 
-
+		size_t n = txt.size();
+		size_t start = 0;
+		bool hasEscape = false;
+		for(size_t pos = 0; pos < n; pos++)
+		{
+			if(txt[pos] == delimiter)
+			{
+				if(!emptyValue && pos + 1 < n && txt[pos + 1] == delimiter)
+				{
+					hasEscape = true;
+					pos++;
+				}
+				else
+				{
+					set_token(txt.substr(start, pos - start), hasEscape);
+					start = pos + 1;
+					hasEscape = false;
+				}
+			}
 		}
+		//last token, skip the last empty one when end with delimiter
+		if(!isDelimiterEnd)
+			set_token(txt.substr(start), hasEscape);
 
 		/*
 		 * check if kw and value are paired
 		 */
-		 if(j%2 == 1){
+		unsigned j = i - 1;
+		 if(i > 0 && j%2 == 1){
 			 std::string serror = "uneven number of tokens: ";
 		     serror.append(boost::lexical_cast<std::string>(j));
 		     PRINT(serror + "\n");
@@ -178,12 +194,12 @@ namespace cytolib
 	//	    txt <- readBin(con,"raw", offsets["textend"]-offsets["textstart"]+1)
 	//	    txt <- iconv(rawToChar(txt), "", "latin1", sub="byte")
 		 int nTxt = header_.textend - header_.textstart + 1;
-		 char * tmp = new char[nTxt + 1];
-		 in.read(tmp, nTxt);//can't use in.get since it will stop at newline '\n' which could be present in FCS TXT
-		 tmp[nTxt]='\0';//make it as c_string
-		 string txt(tmp);
-		 delete [] tmp;
-		 boost::trim_right_if(txt, boost::is_any_of(" \t\r\n"));
+		 vector<char> buf(nTxt);
+		 in.read(buf.data(), nTxt);//can't use in.get since it will stop at newline '\n' which could be present in FCS TXT
+		 //the TEXT is treated as c_string, i.e. ends at the first null char
+		 boost::string_view txt(buf.data(), find(buf.begin(), buf.end(), '\0') - buf.begin());
+		 while(!txt.empty() && (txt.back() == ' ' || txt.back() == '\t' || txt.back() == '\r' || txt.back() == '\n'))
+			 txt.remove_suffix(1);
 	     string_to_keywords(txt, emptyValue);
 
 		if(keys_.find("FCSversion")==keys_.end())
@@ -247,11 +263,12 @@ namespace cytolib
 	void MemCytoFrame::convertToPb(pb::CytoFrame & fr_pb
 			, const string & h5_filename
 			, CytoFileOption h5_opt
-			, const CytoCtx & ctx) const
+			, const CytoCtx & ctx
+			, const H5WriteOptions & h5_write_opts) const
 	{
 		fr_pb.set_is_h5(false);
 		if(h5_opt != CytoFileOption::skip)
-			write_h5(h5_filename);
+			write_h5(h5_filename, h5_write_opts);
 	}
 
 	unsigned MemCytoFrame::n_rows() const{
@@ -277,17 +294,9 @@ namespace cytolib
 		in_.close();
 	}
 
-	/**
-	 * parse the data segment of FCS
-	 *
-	 * @param in (input) file stream object opened from FCS file
-	 * @param config (input) the parsing arguments for data
-	 */
-	void MemCytoFrame::read_fcs_data(ifstream &in, const FCS_READ_DATA_PARAM & config)
+	FCSDataDecoder MemCytoFrame::init_data_decoder(const FCS_READ_DATA_PARAM & config)
 	{
-		if(g_loglevel>=GATING_HIERARCHY_LEVEL)
-			PRINT("Parsing FCS data section \n");
-
+		FCSDataDecoder decoder;
 		//## transform or scale data?
 		  bool fcsPnGtransform = false, isTransformation = false, scale = false;
 		  if(config.transform == TransformType::linearize)
@@ -353,24 +362,6 @@ namespace cytolib
 		if(dattype!="I"&&multiSize)
 			throw(domain_error("Sorry, Numeric data type expects the same bitwidth for all parameters!"));
 
-//		bool splitInt;
-//		if(dattype=="I"){
-//
-//		  if(multiSize)
-//			splitInt = false;
-//		  else
-//			  splitInt = params[0].PnB == 32;
-//
-//
-//		}
-//		else
-//		{
-//		  splitInt = false;
-//
-//		}
-
-
-
 		if(!multiSize){
 		  if(params[0].PnB ==10){
 			  string sys = keys_["$SYS"];
@@ -385,101 +376,13 @@ namespace cytolib
 		  }
 		}
 
-//		bool isSigned;
-//		if(multiSize){
-//
-//		  isSigned = false; // #dummy. not used in mutliSize logic.
-//		}else{
-//
-//
-//		  //# since signed = FALSE is not supported by readBin when size > 2
-//		  //# we set it to TRUE automatically then to avoid warning flooded by readBin
-//		  //# It shouldn't cause data clipping since we haven't found any use case where datatype is unsigned integer with size > 16bits
-//		 isSigned = !(params[0].PnB == 8 ||params[0].PnB == 16);
-//		}
-//
+		for(auto & p : params)
+			if(p.PnB/8 > static_cast<int>(sizeof(uint64_t)))
+				throw std::range_error("unsupported byte width :" + std::to_string(p.PnB/8));
 
-
-	  in.seekg(header_.datastart);
-
-	  auto nBytes = header_.dataend - header_.datastart + 1;
-
-
-	//	vector<BYTE>bytes(nBytes);
-	//	in.read((char *)&bytes[0], nBytes);
-	//
-	//	if(dattype != "i")
-	//	  throw(domain_error("we don't support different bitwdiths for numeric data type!"));
-		//total bits for each row
-	  	size_t nRowSize = accumulate(params.begin(), params.end(), 0, [](size_t i, cytoParam p){return i + p.PnB;});
-
-	  	auto nrow = nBytes * 8/nRowSize;
-
-	  	auto which_lines = config.which_lines;
-	  	auto nSelected = which_lines.size();
-	  	//randomly sample the data if the given lines are of size 1
-	  	if(nSelected == 1)
-	  	{
-	  		nSelected = which_lines[0];
-	  		which_lines.resize(nSelected);
-	  		std::default_random_engine generator(config.seed);
-	  		std::uniform_int_distribution<int64_t> distribution(0, nrow - 1);
-	  		for(uint64_t i = 0; i < nSelected; i++)
-	  		{
-	  			which_lines[i] = distribution(generator);
-	  		}
-	  	}
-	  	if(nSelected>0){
-	  		if(nSelected >= nrow)
-	  			throw(domain_error("total number of which.lines exceeds the total number of events: " + to_string(nrow)));
-
-	  		sort(which_lines.begin(), which_lines.end());
-	  		nrow = nSelected;
-	  		nBytes = nrow * nRowSize/8;
-	  	}
-	  	unique_ptr<char []> buf(new char[nBytes]);//we need to rearrange dat from row-major to col-major thus need a separate buf anyway (even for float)
-	  	char * bufPtr = buf.get();
-	  	if(nSelected>0)
-	  	{
-	  		char * thisBufPtr = bufPtr;
-	  		auto nRowSizeBytes = nRowSize/8;
-	  		for(auto i : which_lines)
-	  		{
-	  			int64_t pos =  header_.datastart + i * nRowSizeBytes;
-	  			if(pos > header_.dataend || pos < header_.datastart)
-	  				throw(domain_error("the index of which.lines exceeds the data boundary: " + to_string(i)));
-	  			in.seekg(pos);
-	  			in.read(thisBufPtr, nRowSizeBytes);
-	  			thisBufPtr += nRowSizeBytes;
-	  		}
-	  	}
-	  	else
-	  	{
-	  		//load entire data section with one disk IO
-
-			in.read(bufPtr, nBytes); //load the bytes from file
-			uint64_t events_read = (in.gcount() * 8 / nRowSize);
-			uint64_t events_expected = boost::lexical_cast<uint64_t>(keys_["$TOT"]);
-			if(events_read != events_expected)//can't use nBytes derived from FCS header as the check point since it may have extra bytes than needed
-			{
-				throw(domain_error("file " + filename_+ " seems to be corrupted. \n The actual number of cells in data section ("
-		                 + to_string(events_read) + ") is not consistent with keyword '$TOT' (" + to_string(events_expected) + ")"));
-			}
-
-	  	}
-	//	nEvents = nrow;
-		//how many element to return
-	  	auto nElement = nrow * nCol;
-
-	  	data_.resize(nrow, nCol);
-
-	//	char *p = buf.get();//pointer to the current beginning byte location of the processing data element in the byte stream
-		float decade = pow(10, config.decades);
 		/*
-		 * mixed endian parsing could be more efficiently
-		 * integrated into the subsequent main loop of data parsing
-		 * but since it is a rare case (legacy data), we do the separate simple
-		 * preprocessing here to avoid adding extra overhead into the main loop
+		 * mixed endian parsing is done by permuting the bytes of each element
+		 * before the regular byte swapping
 		 */
 		if(endian == endianType::mixed)
 		{
@@ -493,204 +396,57 @@ namespace cytolib
 			  if(params[0].PnB/8 != elementSize)
 				throw(domain_error("Byte order is not consistent with bidwidths!"));
 
-			  vector<int> iByteOrd(elementSize);
+			  decoder.iByteOrd.resize(elementSize);
 			  for(auto i = 0; i < elementSize; i++)
 			  {
-				  iByteOrd[i] = boost::lexical_cast<int>(byteOrd[i])-1;
+				  decoder.iByteOrd[i] = boost::lexical_cast<int>(byteOrd[i])-1;
 			  }
-			  char * tmp = new char[elementSize];
-			  for(size_t ind = 0; ind < nElement; ind++){
-
-				  memcpy(tmp, bufPtr + ind * elementSize, elementSize);
-
-			     for(auto i = 0; i < elementSize; i++){
-			       auto j = iByteOrd[i];
-
-//			       auto pos_old = ind * elementSize + i;
-			       auto pos_new = ind * elementSize + j;
-			 //       if(ind<=10)
-			 //         Rcpp::Rcout << pos_old <<":" << pos_new << std::endl;
-
-
-			       bufPtr[pos_new] = tmp[i];
-
-			     }
-
-			   }
-			  	delete [] tmp;
 
 			    endian = endianType::small;
 		}
 
-		bool isbyteswap = false;
-
-		if((is_host_big_endian()&&endian==endianType::small)||(!is_host_big_endian()&&endian==endianType::big))
-			isbyteswap = true;
-
-		/**
-		 * cp raw bytes(row-major) to a 2d mat (col-major) represented as 1d array(with different byte width for each elements)
-		 */
-	//	double start = omp_get_wtime();//clock();
-	#ifdef _OPENMP
-		omp_set_num_threads(config.num_threads);
-	#endif
+		decoder.isbyteswap = (is_host_big_endian()&&endian==endianType::small)||(!is_host_big_endian()&&endian==endianType::big);
+		decoder.is_int = dattype == "I";
+		decoder.params = params;
+		decoder.nRowSize = 0;
+		for(auto & p : params)
+		{
+			decoder.bits_offset.push_back(decoder.nRowSize);
+			decoder.nRowSize += p.PnB;
+		}
+		decoder.isTransformation = isTransformation;
+		decoder.scale = scale;
+		decoder.fcsPnGtransform = fcsPnGtransform;
+		decoder.transDefinedinKeys = transDefinedinKeys;
+		decoder.truncate_max_range = config.truncate_max_range;
+		decoder.truncate_min_val = config.truncate_min_val;
+		decoder.min_limit = config.min_limit;
+		decoder.decade = pow(10, config.decades);
+		decoder.num_threads = config.num_threads;
+		decoder.use_simd = config.use_simd && is_simd_supported();
+		return decoder;
+	}
 
-	    #pragma omp parallel for
-		for(auto c = 0; c < nCol; c++)
-		 {
-			string pid = to_string(c+1);
-			EVENT_DATA_TYPE realMin = numeric_limits<EVENT_DATA_TYPE>::max();
-//			size_t element_offset = nrow * c;
-			size_t bits_offset = accumulate(params.begin(), params.begin() + c, 0, [](size_t i, cytoParam p){return i + p.PnB;});
+	void MemCytoFrame::finalize_data_decoder(const FCSDataDecoder & decoder, const FCS_READ_DATA_PARAM & config, const vector<EVENT_DATA_TYPE> & realMin)
+	{
+		bool isTransformation = decoder.isTransformation;
+		bool scale = decoder.scale;
+		bool fcsPnGtransform = decoder.fcsPnGtransform;
+		float decade = decoder.decade;
+		bool isCustom = keys_.find("transformation")!=keys_.end() &&  keys_["transformation"] == "custom";
+		for(unsigned c = 0; c < params.size(); c++)
+		{
 			cytoParam & param = params[c];
-			int usedBits = ceil(log2(param.max));
-		    uint64_t base = static_cast<uint64_t>(1)<<usedBits;
-//		    auto thisSize = params[c-1].PnB;
-			for(size_t r = 0; r < nrow; r++)
-		    {
-		      //convert each element
-				  auto thisSize = param.PnB;
-//				  size_t idx = element_offset + r;
-				  EVENT_DATA_TYPE & outElement = data_.at(r, c);
-				  size_t idx_bits = r * nRowSize + bits_offset;
-				  char *p = bufPtr + idx_bits/8;
-				  thisSize/=8;
-				  if(isbyteswap)
-					  std::reverse(p, p + thisSize);
-
-				  if(dattype == "I")
-				  {
-					  switch(thisSize)
-					  {
-					  case sizeof(BYTE)://1 byte
-						{
-						  outElement = static_cast<EVENT_DATA_TYPE>(*p);
-						}
-
-						  break;
-					  case sizeof(unsigned short): //2 bytes
-						{
-
-						  outElement = static_cast<EVENT_DATA_TYPE>(*reinterpret_cast<unsigned short *>(p));
-						}
-
-						break;
-					  case sizeof(unsigned)://4 bytes
-						{
-						  outElement = static_cast<EVENT_DATA_TYPE>(*reinterpret_cast<unsigned *>(p));
-						}
-
-						break;
-					  case sizeof(uint64_t)://8 bytes
-						{
-						  outElement = static_cast<EVENT_DATA_TYPE>(*reinterpret_cast<uint64_t *>(p));
-						}
-
-					  break;
-					  default:
-						  {
-							  std::string serror = "unsupported byte width :";
-							  serror.append(std::to_string(thisSize));
-							  throw std::range_error(serror.c_str());
-						  }
-					  }
-					  // apply bitmask for integer data
-
-					 if(param.max > 0)
-					 {
-
-					   if(usedBits < param.PnB)
-						   outElement = static_cast<uint64_t>(outElement) % base;
-					}
-
-
-				}
-				else
-				{
-				  switch(thisSize)
-				  {
-				  case sizeof(float):
-					{
-					  outElement = *reinterpret_cast<float *>(p);
-					}
-
-					break;
-				  case sizeof(double):
-					{
-					  outElement = static_cast<EVENT_DATA_TYPE>(*reinterpret_cast<double *>(p));
-					}
-
-					break;
-				  default:
-					std::string serror ="Unsupported bitwidths for numerical data type:";
-					serror.append(std::to_string(thisSize));
-					throw std::range_error(serror.c_str());
-				  }
-				}
-
-			  // truncate data at range
-				if(!transDefinedinKeys)
-				{
-					if(config.truncate_max_range&&outElement > param.max)
-						outElement = param.max;
-
-					if(config.truncate_min_val&&outElement < config.min_limit)
-						outElement = config.min_limit;
-				}
-
-
-
-	//				## Transform or scale if necessary
-	//				# J.Spidlen, Nov 13, 2013: added the flowCore_fcsPnGtransform keyword, which is
-	//				# set to "linearize-with-PnG-scaling" when transformation="linearize-with-PnG-scaling"
-	//				# in read.FCS(). This does linearization for log-stored parameters and also division by
-	//				# gain ($PnG value) for linearly stored parameters. This is how the channel-to-scale
-	//				# transformation should be done according to the FCS specification (and according to
-	//				# Gating-ML 2.0), but lots of software tools are ignoring the $PnG division. I added it
-	//				# so that it is only done when specifically asked for so that read.FCS remains backwards
-	//				# compatible with previous versions.
-
-
-				if(isTransformation)
-				{
-
-
-				  if(param.PnE[0] > 0)
-				  {
-					 outElement = pow(10,outElement/param.max * param.PnE[0]) * param.PnE[1];
-				  }
-				  else if (fcsPnGtransform && param.PnG != 1) {
-					  outElement = outElement / param.PnG;
-				  }
-				}
-				if(scale)
-				{
-					if(param.PnE[0] > 0)
-					{
-						outElement = decade*((outElement-1)/(param.max-1));
-					}
-					else
-					{
-						outElement = decade*((outElement)/(param.max));
-					}
-				}
-				realMin = realMin > outElement?outElement:realMin;
-
-		    }
-
-			if(keys_.find("transformation")!=keys_.end() &&  keys_["transformation"] == "custom")
-				param.min = boost::lexical_cast<EVENT_DATA_TYPE>(keys_["flowCore_$P" + pid + "Rmin"]);
+			if(isCustom)
+				param.min = boost::lexical_cast<EVENT_DATA_TYPE>(keys_["flowCore_$P" + to_string(c+1) + "Rmin"]);
 			else
 			{
 
 				auto zeroVals = param.PnE[1];
-				param.min = min(zeroVals, max(config.min_limit, realMin));
+				param.min = min(zeroVals, max(config.min_limit, realMin[c]));
 
 			}
-
-		 }
-	//	 cout << (std::clock() - start) / (double)(CLOCKS_PER_SEC / 1000) << endl;
-	//	 cout << (omp_get_wtime() - start) / (double)(CLOCKS_PER_SEC / 1000) << endl;
+		}
 
 		//update params
 		for(auto &p : params)
@@ -764,6 +520,121 @@ namespace cytolib
 
 	}
 
+	/**
+	 * parse the data segment of FCS
+	 *
+	 * @param in (input) file stream object opened from FCS file
+	 * @param config (input) the parsing arguments for data
+	 */
+	void MemCytoFrame::read_fcs_data(ifstream &in, const FCS_READ_DATA_PARAM & config)
+	{
+		if(g_loglevel>=GATING_HIERARCHY_LEVEL)
+			PRINT("Parsing FCS data section \n");
+
+		FCSDataDecoder decoder = init_data_decoder(config);
+
+		auto nBytes = header_.dataend - header_.datastart + 1;
+
+	  	size_t nRowSize = decoder.nRowSize;
+	  	auto nRowSizeBytes = decoder.row_bytes();
+
+	  	auto nrow = nBytes * 8/nRowSize;
+
+	  	auto which_lines = config.which_lines;
+	  	bool is_subset = which_lines.size() > 0;
+	  	auto nSelected = which_lines.size();
+	  	if(is_subset){
+		  	//randomly sample the data if the given lines are of size 1
+		  	if(nSelected == 1)
+		  	{
+		  		if(which_lines[0] >= nrow)
+		  			throw(domain_error("total number of which.lines exceeds the total number of events: " + to_string(nrow)));
+		  		which_lines = sample_fcs_rows(nrow, which_lines[0], config.sample_type, config.seed);
+		  		nSelected = which_lines.size();
+		  	}
+		  	else
+		  	{
+		  		if(nSelected >= nrow)
+		  			throw(domain_error("total number of which.lines exceeds the total number of events: " + to_string(nrow)));
+
+		  		sort(which_lines.begin(), which_lines.end());
+		  	}
+	  		nrow = nSelected;
+	  	}
+	  	bool use_mmap = config.use_mmap && is_mmap_supported();
+	  	/*
+	  	 * in mmap mode the events are decoded straight from the mapped DATA segment
+	  	 * so that only the decoded (col-major) copy of data is held in memory,
+	  	 * otherwise we need to rearrange dat from row-major to col-major thus need a separate buf anyway (even for float)
+	  	 */
+	  	unique_ptr<MappedFileRange> mapped;
+	  	unique_ptr<char []> buf;
+	  	const char * bufPtr;
+	  	if(use_mmap)
+	  	{
+	  		mapped.reset(new MappedFileRange(filename_, header_.datastart, nBytes, !is_subset));
+	  		bufPtr = mapped->data();
+	  	}
+	  	if(is_subset)
+	  	{
+	  		buf.reset(new char[nrow * nRowSizeBytes]);
+	  		if(use_mmap)
+	  		{
+		  		char * thisBufPtr = buf.get();
+		  		for(auto i : which_lines)
+		  		{
+		  			int64_t pos =  header_.datastart + i * nRowSizeBytes;
+		  			if(pos > header_.dataend || pos < header_.datastart)
+		  				throw(domain_error("the index of which.lines exceeds the data boundary: " + to_string(i)));
+	  				if(static_cast<size_t>((i + 1) * nRowSizeBytes) > mapped->size())
+	  					throw(domain_error("the index of which.lines exceeds the data boundary: " + to_string(i)));
+	  				memcpy(thisBufPtr, mapped->data() + i * nRowSizeBytes, nRowSizeBytes);
+		  			thisBufPtr += nRowSizeBytes;
+		  		}
+	  		}
+	  		else//coalesce the selected rows into a few large reads
+	  			read_fcs_rows(filename_, header_.datastart, header_.dataend, nRowSizeBytes, which_lines
+	  							, config.which_lines_gap, buf.get(), config.num_threads);
+	  		bufPtr = buf.get();
+	  		mapped.reset();
+	  	}
+	  	else
+	  	{
+	  		uint64_t bytes_read;
+	  		if(use_mmap)
+	  		{
+	  			bytes_read = mapped->size();
+	  			//never decode beyond the end of the mapping
+	  			nrow = min<uint64_t>(nrow, bytes_read / nRowSizeBytes);
+	  		}
+	  		else
+	  		{
+		  		//load entire data section with one disk IO
+		  		buf.reset(new char[nBytes]);
+		  		in.seekg(header_.datastart);
+		  		in.read(buf.get(), nBytes); //load the bytes from file
+		  		bytes_read = in.gcount();
+		  		bufPtr = buf.get();
+	  		}
+			uint64_t events_read = (bytes_read * 8 / nRowSize);
+			uint64_t events_expected = boost::lexical_cast<uint64_t>(keys_["$TOT"]);
+			if(events_read != events_expected)//can't use nBytes derived from FCS header as the check point since it may have extra bytes than needed
+			{
+				throw(domain_error("file " + filename_+ " seems to be corrupted. \n The actual number of cells in data section ("
+		                 + to_string(events_read) + ") is not consistent with keyword '$TOT' (" + to_string(events_expected) + ")"));
+			}
+
+	  	}
+
+	  	data_.resize(nrow, decoder.n_cols());
+
+		vector<EVENT_DATA_TYPE> realMin;
+		decoder.decode(bufPtr, nrow, data_.memptr(), nrow, realMin);
+
+		finalize_data_decoder(decoder, config, realMin);
+
+	}
+
 	void MemCytoFrame::read_fcs_header()
 	{
 		open_fcs_file();
@@ -910,27 +781,37 @@ namespace cytolib
 		 KEY_WORDS::iterator it;
 		unordered_map<string, queue<int>> chnls;
 		bool isDuplicate = false;
+		it = keys_.find("transformation");
+		bool isCustom = it!=keys_.end() && it->second == "custom";
+		//the $Pn keywords are looked up through a reused buffer of "$Pn" followed by the suffix
+		string pkey;
+		auto get_pkey = [&pkey](const string & pid, const char * suffix) -> const string &{
+			pkey.assign("$P");
+			pkey.append(pid);
+			pkey.append(suffix);
+			return pkey;
+		};
 		for(int i = 1; i <= nrpar; i++)
 		{
 			string pid = to_string(i);
 			string range_str;
-			if( keys_.find("transformation")!=keys_.end() &&  keys_["transformation"] == "custom")
+			if(isCustom)
 				range_str = "flowCore_$P" + pid + "Rmax";
 			else
-				range_str = "$P" + pid + "R";
+				range_str = get_pkey(pid, "R");
 			it = keys_.find(range_str);
 			if(it==keys_.end())
 				throw(domain_error(range_str + " not contained in Text section!"));
 			else
 				params[i-1].max = boost::lexical_cast<EVENT_DATA_TYPE>(it->second);
 
-			if(range_str == "flowCore_$P" + pid + "Rmax")
+			if(isCustom)
 				params[i-1].max += 1;
 
 
-			params[i-1].PnB = stoi(keys_["$P" + pid + "B"]);
+			params[i-1].PnB = stoi(keys_[get_pkey(pid, "B")]);
 
-			it = keys_.find("$P" + pid + "E");
+			it = keys_.find(get_pkey(pid, "E"));
 			if(it==keys_.end()||dattype != "I")
 			{
 				params[i-1].PnE[0] = 0;
@@ -946,7 +827,7 @@ namespace cytolib
 					params[i-1].PnE[1] = 1;
 			}
 
-			it = keys_.find("$P" + pid + "G");
+			it = keys_.find(get_pkey(pid, "G"));
 			if(it==keys_.end())
 				params[i-1].PnG = 1;
 			else
@@ -955,7 +836,7 @@ namespace cytolib
 				params[i-1].PnG = boost::lexical_cast<EVENT_DATA_TYPE>(it->second);
 			}
 
-			params[i-1].channel = keys_["$P" + pid + "N"];
+			params[i-1].channel = keys_[get_pkey(pid, "N")];
 			if(config.is_fix_slash_in_channel_name)
 				boost::replace_all(params[i-1].channel, "/", "_");
 
@@ -969,9 +850,9 @@ namespace cytolib
 				found->second.push(i-1);
 			}
 
-			it = keys_.find("$P" + pid + "S");
+			it = keys_.find(get_pkey(pid, "S"));
 			if(it!=keys_.end())
-				params[i-1].marker = keys_["$P" + pid + "S"];
+				params[i-1].marker = it->second;
 
 		}
 		
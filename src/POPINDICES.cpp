@@ -36,48 +36,55 @@ void unpackFromBytes(vector <bool> & x, const vector<unsigned char>& x_bytes){
 }
 
 
-	BOOLINDICES::BOOLINDICES(vector <unsigned> _ind, unsigned _nEvent){
-		nEvents = _nEvent;
-		x.resize(nEvents);
-		for(auto i : _ind)
-			x[i] = true;
-	}
-	BOOLINDICES::BOOLINDICES(vector <bool> _ind){
-		x=_ind;
-		nEvents=_ind.size();
-
-	}
-	vector<unsigned> BOOLINDICES::getIndices_u(){
-		vector<unsigned> res;
-
-		for(unsigned i = 0; i < x.size(); i++){
-			if(x[i])
-				res.push_back(i);
-		}
-		return res;
-	}
-
+	/*
+	 * the bit i of the mask is the bit i % 8 of the byte i / 8 in the archive,
+	 * i.e. the little-endian bytes of the mask words
+	 */
 	void BOOLINDICES::convertToPb(pb::POPINDICES & ind_pb){
 		ind_pb.set_indtype(pb::BOOL);
-		unsigned nBits=x.size();
-		unsigned nBytes=ceil(float(nBits)/8);
-		vector<unsigned char> bytes(nBytes,0);
-		packToBytes(x, bytes);
+		unsigned nBytes=(x.size() + 7) / 8;
 		string * byte_pb = ind_pb.mutable_bind();
-		for(unsigned i = 0; i < bytes.size(); i++){
-			unsigned char byte = bytes[i];
-			byte_pb->append(string(1, byte));
-		}
+		byte_pb->resize(nBytes);
+		const EVENT_BITSET::WORD * words = x.data();
+		for(unsigned i = 0; i < nBytes; i++)
+			(*byte_pb)[i] = char((words[i / 8] >> (8 * (i % 8))) & 0xff);
 		ind_pb.set_nevents(nEvents);
 	}
 	BOOLINDICES::BOOLINDICES(const pb::POPINDICES & ind_pb){
 		nEvents = ind_pb.nevents();
-		//fetch byte stream from pb
-		vector<unsigned char> bytes(ind_pb.bind().begin(),ind_pb.bind().end());
-		//convert it to bit vector
-		x.resize(nEvents,false);
-		unpackFromBytes(x, bytes);
+		//fetch byte stream from pb and convert it to bit vector
+		const string & bytes = ind_pb.bind();
+		x = EVENT_BITSET(nEvents);
+		EVENT_BITSET::WORD * words = x.data();
+		unsigned nBytes = min<size_t>((nEvents + 7) / 8, bytes.size());
+		for(unsigned i = 0; i < nBytes; i++)
+			words[i / 8] |= EVENT_BITSET::WORD((unsigned char)bytes[i]) << (8 * (i % 8));
+		//drop any stray bits beyond nEvents
+		unsigned r = nEvents % EVENT_BITSET::WORD_BITS;
+		if(r)
+			words[x.n_words() - 1] &= (EVENT_BITSET::WORD(1) << r) - 1;
+	}
+
+	void ROARINGINDICES::convertToPb(pb::POPINDICES & ind_pb){
+		if(g_compress_indices)
+		{
+			string bytes;
+			x.serialize(bytes);
+			if(bytes.size() < legacy_bytes(nEvents))
+			{
+				ind_pb.set_indtype(pb::BOOL);
+				ind_pb.set_bind(bytes);
+				ind_pb.set_nevents(nEvents);
+				return;
+			}
+		}
+		//the legacy layout that every reader can load
+		if(sizeof(unsigned) * size_t(x.count()) < nEvents / 8)
+			INTINDICES(x.to_indices(), nEvents).convertToPb(ind_pb);
+		else
+			BOOLINDICES(x.to_mask()).convertToPb(ind_pb);
 	}
+	ROARINGINDICES::ROARINGINDICES(const pb::POPINDICES & ind_pb):POPINDICES(ind_pb.nevents()),x(ind_pb.bind(), ind_pb.nevents()){}
 
 	INTINDICES::INTINDICES(vector <bool> _ind){
 
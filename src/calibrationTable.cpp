@@ -82,6 +82,13 @@ namespace cytolib
 		spline_eval(imeth,input, nSize, x, y, b, c, d);
 
 	}
+	void calibrationTable::transforming(float * input, int nSize){
+
+		int imeth=2;
+
+		spline_eval(imeth,input, nSize, x, y, b, c, d);
+
+	}
 
 
 	void calibrationTable::convertToPb(pb::calibrationTable & cal_pb){
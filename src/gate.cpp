@@ -167,6 +167,15 @@ namespace cytolib
 
 		return res;
 	}
+	void rangeGate::gating(MemCytoFrame & fdata, const EVENT_BITSET & parentMask, EVENT_BITSET & childMask){
+		if(parentMask.size() != fdata.n_rows())
+			throw(domain_error("the size of the parent mask does not match the number of events!"));
+		const EVENT_DATA_TYPE * data_1d = fdata.get_data_memptr(param.getName(), ColType::channel);
+		const EVENT_DATA_TYPE vMin = param.getMin(), vMax = param.getMax();
+		gate_mask(parentMask, neg, childMask, [data_1d, vMin, vMax](unsigned i){
+			return (data_1d[i] <= vMax) & (data_1d[i] >= vMin);
+		});
+	}
 
 	void rangeGate::extend(MemCytoFrame & fdata,float extend_val){
 		string pName=param.getName();
@@ -219,6 +228,7 @@ namespace cytolib
 			isGained=true;
 		}
 	}
+	unsigned polygonGate::grid_min_vertices = 16;
 /*
 	 * when the original gate vertices are at the threshold
 	 * it is likely that the gates were truncated in flowJo xml
@@ -255,6 +265,7 @@ namespace cytolib
 			}
 		}
 		param.setVertices(v);
+		reset_grid();
 	}
 
 	void polygonGate::extend(float extend_val, float extend_to){
@@ -284,6 +295,7 @@ namespace cytolib
 			}
 		}
 		param.setVertices(v);
+		reset_grid();
 	}
 	void polygonGate::gain(map<string,float> & gains){
 
@@ -324,6 +336,7 @@ namespace cytolib
 				if(g_loglevel>=POPULATION_LEVEL)
 					PRINT("\n");
 				param.setVertices(vertices);
+				reset_grid();
 				isGained=true;
 			}
 
@@ -338,6 +351,7 @@ namespace cytolib
 			vertices[i].y += shift[1];
 		}
 		param.setVertices(vertices);
+		reset_grid();
 	}
 
 	 /*
@@ -366,7 +380,19 @@ namespace cytolib
 		vector<cytolib::CYTO_POINT> points(nVert);
 		for(unsigned i = 0; i < nVert; i++)
 			points[i] = vertices[i];
-		cytolib::in_polygon(xdata, ydata, points, parentInd, neg, res);
+		if(nVert >= grid_min_vertices)
+		{
+			auto grid = atomic_load(&grid_);
+			//the derived gates may also replace the vertices without resetting the grid (e.g. toPolygon)
+			if(!grid||!grid->is_built_from(points))
+			{
+				grid = make_shared<const POLYGON_GRID>(points);
+				atomic_store(&grid_, grid);
+			}
+			cytolib::in_polygon(xdata, ydata, *grid, parentInd, neg, res);
+		}
+		else
+			cytolib::in_polygon(xdata, ydata, points, parentInd, neg, res);
 		return res;
 	}
 
@@ -428,6 +454,7 @@ namespace cytolib
 			if(g_loglevel>=POPULATION_LEVEL)
 				PRINT("\n");
 			param.setVertices(vertices);
+			reset_grid();
 			isTransformed=true;
 		}
 	}
@@ -443,6 +470,33 @@ namespace cytolib
 	}
 
 
+	void rectGate::gating(MemCytoFrame & fdata, const EVENT_BITSET & parentMask, EVENT_BITSET & childMask){
+		vector<coordinate> vertices=param.getVertices();
+		if(vertices.size()!=2)
+			throw(domain_error("invalid number of vertices for rectgate!"));
+		if(parentMask.size() != fdata.n_rows())
+			throw(domain_error("the size of the parent mask does not match the number of events!"));
+		const EVENT_DATA_TYPE xMin=vertices[0].x, yMin=vertices[0].y;
+		const EVENT_DATA_TYPE xMax=vertices[1].x, yMax=vertices[1].y;
+		//same as the indices version, only complain when there is any event to gate
+		if((xMin>xMax||yMin>yMax) && parentMask.any())
+			throw(domain_error("invalid vertices for rectgate!"));
+		const EVENT_DATA_TYPE * xdata = fdata.get_data_memptr(param.xName(), ColType::channel);
+		const EVENT_DATA_TYPE * ydata = fdata.get_data_memptr(param.yName(), ColType::channel);
+		/*
+		 * the open edges of the quadrants so that the edge cells are not counted multiple times
+		 */
+		bool x_lo_open = is_quad && quadrant == Q2;
+		bool x_hi_open = is_quad && quadrant == Q4;
+		bool y_lo_open = is_quad && quadrant == Q1;
+		bool y_hi_open = is_quad && quadrant == Q3;
+		gate_mask(parentMask, neg, childMask, [=](unsigned i){
+			EVENT_DATA_TYPE x = xdata[i], y = ydata[i];
+			bool inX = (x_lo_open ? x > xMin : x >= xMin) & (x_hi_open ? x < xMax : x <= xMax);
+			bool inY = (y_lo_open ? y > yMin : y >= yMin) & (y_hi_open ? y < yMax : y <= yMax);
+			return inX & inY;
+		});
+	}
 	void rectGate::convertToPb(pb::gate & gate_pb)
 	{
 		polygonGate::convertToPb(gate_pb);
@@ -703,25 +757,20 @@ namespace cytolib
 		d = cov[1].y;
 
 		EVENT_DATA_TYPE det = a* d - b* c;
-		EVENT_DATA_TYPE aa, bb, cc, dd;
-		aa = d/det;
-		bb = -b/det;
-		cc = -c/det;
-		dd = a/det;
+		ELLIPSE_FORM form;
+		form.aa = d/det;
+		form.bb = -b/det;
+		form.cc = -c/det;
+		form.dd = a/det;
+		form.mu_x = mu.x;
+		form.mu_y = mu.y;
+		form.rhs = pow(dist, 2);
 
 		// if inside of the ellipse
 		int nEvents=parentInd.size();
 		INDICE_TYPE res;
 		res.reserve(nEvents);
-		for(auto i : parentInd){
-			//center the data
-
-			EVENT_DATA_TYPE x = xdata[i] - mu.x;
-			EVENT_DATA_TYPE y = ydata[i] - mu.y;
-			bool isIn = (x * x * aa + x* y * cc + x* y * bb + y * y * dd) <= pow(dist, 2);
-			if(isIn != neg)
-			res.push_back(i);
-		}
+		in_ellipse(xdata, ydata, form, parentInd, neg, res);
 
 		return res;
 	}
@@ -865,10 +914,114 @@ namespace cytolib
 		ellipseGate::convertToPb(gate_pb);
 			gate_pb.set_type(pb::ELLIPSOID_GATE);
 	}
-	ellipsoidGate::ellipsoidGate(const pb::gate & gate_pb):ellipseGate(gate_pb){
+	ellipsoidGate::ellipsoidGate(const pb::gate & gate_pb):ellipseGate(gate_pb), has_form(false), is_data_scale_set(false), analytic(true){
 		//deal with legacy archive that did not interpolate ellipsoidGate
 		if(param.getVertices().size() == 0)
 			toPolygon(100);
+		computeForm();
+	}
+
+	void ellipsoidGate::computeForm(){
+		vector<float> x, y;
+		for(auto & i : antipodal_vertices)
+		{
+			x.push_back(i.x);
+			y.push_back(i.y);
+		}
+		ellipse_parsed res = parseEllipse(x, y);
+		//leave the degenerated ellipse (whose polygon is a line) to polygonGate
+		has_form = res.a > 0 && res.b > 0;
+		if(has_form)
+			form_256 = ellipse_form(res.mu_x, res.mu_y, res.a, res.b, res.alpha);
+	}
+
+	void ellipsoidGate::setDataScale(const trans_local & trans){
+		is_data_scale_set = true;
+		to_raw_x.reset();
+		to_raw_y.reset();
+		to_256_x.reset();
+		to_256_y.reset();
+		if(!has_form)
+			return;
+		TransPtr trans_x = trans.getTran(param.xName());
+		TransPtr trans_y = trans.getTran(param.yName());
+		if(!trans_x||!trans_y)
+			return;
+		TransPtr raw_x, raw_y;
+		try
+		{
+			raw_x = trans_x->getInverseTransformation();
+			raw_y = trans_y->getInverseTransformation();
+		}
+		catch(const domain_error &)
+		{
+			return;//fall back to the polygon when the inverse is not available
+		}
+		//the trans object that was used by flowJo to transform ellipsoid gate to 256 scale
+		TransPtr gate_x = trans_x->clone();
+		TransPtr gate_y = trans_y->clone();
+		gate_x->setTransformedScale(256);
+		gate_y->setTransformedScale(256);
+
+		/*
+		 * the interpolated polygon has to map back onto the ellipse (within 1% of the form for the round trip of the transformations),
+		 * which is not the case for the gates shifted in the data scale or transformed by the other transformations
+		 */
+		vertices_vector v = param.toVector();
+		int n = v.x.size();
+		if(n == 0)
+			return;
+		raw_x->transforming(&v.x[0], n);
+		gate_x->transforming(&v.x[0], n);
+		raw_y->transforming(&v.y[0], n);
+		gate_y->transforming(&v.y[0], n);
+		for(int i = 0; i < n; i++)
+		{
+			double dx = v.x[i] - form_256.mu_x, dy = v.y[i] - form_256.mu_y;
+			double q = dx * dx * form_256.aa + dx * dy * (form_256.bb + form_256.cc) + dy * dy * form_256.dd;
+			if(!(fabs(q - form_256.rhs) <= 0.01))
+				return;
+		}
+		to_raw_x = raw_x;
+		to_raw_y = raw_y;
+		to_256_x = gate_x;
+		to_256_y = gate_y;
+	}
+
+	INDICE_TYPE ellipsoidGate::gating(MemCytoFrame & fdata, INDICE_TYPE & parentInd){
+		if(!analytic||!to_256_x||!to_256_y)
+			return polygonGate::gating(fdata, parentInd);
+
+		EVENT_DATA_TYPE * xdata = fdata.get_data_memptr(param.xName(), ColType::channel);
+		EVENT_DATA_TYPE * ydata = fdata.get_data_memptr(param.yName(), ColType::channel);
+		int nEvents=parentInd.size();
+		INDICE_TYPE res;
+		res.reserve(nEvents);
+		/*
+		 * map the events back to 256 scale by blocks (inverse transform to raw and transform to 256 scale)
+		 */
+		const unsigned block_size = 4096;
+		vector<EVENT_DATA_TYPE> x(block_size), y(block_size);
+		vector<unsigned char> isIn(block_size);
+		for(int start = 0; start < nEvents; start += block_size)
+		{
+			int n = min<int>(block_size, nEvents - start);
+			for(int j = 0; j < n; j++)
+			{
+				auto i = parentInd[start + j];
+				x[j] = xdata[i];
+				y[j] = ydata[i];
+			}
+			to_raw_x->transforming(&x[0], n);
+			to_256_x->transforming(&x[0], n);
+			to_raw_y->transforming(&y[0], n);
+			to_256_y->transforming(&y[0], n);
+			in_ellipse(&x[0], &y[0], n, form_256, &isIn[0]);
+			for(int j = 0; j < n; j++)
+				if(bool(isIn[j]) != neg)
+					res.push_back(parentInd[start + j]);
+		}
+		return res;
 	}
 	/*
 	 *
@@ -937,6 +1090,11 @@ namespace cytolib
 			polygonGate::transforming(trans_x, trans_y);
 
 			isTransformed=true;
+
+			/*
+			 * keep the way back from the data scale to 256 scale for gating the events against the ellipse
+			 */
+			setDataScale(trans);
 		}
 
 	}
@@ -951,6 +1109,17 @@ namespace cytolib
 			i.x += shift[0];
 			i.y += shift[1];
 		}
+		/*
+		 * the ellipse in 256 scale no longer matches the interpolated points shifted in data scale,
+		 * which is left to setDataScale to check on the next gating, the same way as for the gates loaded from the archive
+		 */
+		if(shift[0] != 0 || shift[1] != 0)
+		{
+			computeForm();
+			is_data_scale_set = false;
+			to_256_x.reset();
+			to_256_y.reset();
+		}
 	}
 
 	void boolGate::convertToPb(pb::gate & gate_pb){
@@ -17,8 +17,26 @@ namespace cytolib
 {
 	bool my_throw_on_error = true;
 	unsigned short g_loglevel = 0;
+	bool g_compress_indices = false;
 	vector<string> spillover_keys = {"SPILL", "spillover", "$SPILLOVER"};
+	//the PrintBuffer of the current thread if any
+	thread_local PrintBuffer * cur_print_buffer = nullptr;
+	PrintBuffer::PrintBuffer(vector<string> & _msgs):msgs(_msgs),prev(cur_print_buffer){
+		cur_print_buffer = this;
+	}
+	PrintBuffer::~PrintBuffer(){
+		cur_print_buffer = prev;
+	}
+	void flush_prints(const vector<string> & msgs){
+		for(const auto & a : msgs)
+			PRINT(a);
+	}
 	void PRINT(string a){
+	 if(cur_print_buffer)
+	 {
+		 cur_print_buffer->append(a);
+		 return;
+	 }
 	#ifdef ROUT
 	 Rprintf(a.c_str());
 	#else
@@ -27,12 +45,7 @@ namespace cytolib
 
 	}
 	void PRINT(const char * a){
-	#ifdef ROUT
-	 Rprintf(a);
-	#else
-	 cout << a;
-	#endif
-
+	 PRINT(string(a));
 	}
 	string s3_to_http(string uri)
 	{
@@ -0,0 +1,105 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/in_ellipse.hpp>
+#include <cytolib/readFCSdata.hpp>
+//the vectorized kernels work on double precision lanes (see readFCSdata.cpp)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(CYTOLIB_FLOAT_EVENTS)
+#define CYTOLIB_AVX2_KERNELS
+#define CYTOLIB_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+namespace cytolib
+{
+namespace
+{
+#ifdef CYTOLIB_AVX2_KERNELS
+	/*
+	 * AVX2 version of the quadratic form test, 4 events at a time with the same operations in the same order
+	 * (thus bit-exact with the scalar loop), whose comparison mask is expanded to isIn.
+	 * The remaining events are left to the scalar loop.
+	 * @return the number of the events tested
+	 */
+	CYTOLIB_TARGET_AVX2 size_t in_ellipse_avx2(const EVENT_DATA_TYPE * xdata, const EVENT_DATA_TYPE * ydata, size_t n, const ELLIPSE_FORM & form, unsigned char * isIn)
+	{
+		const __m256d mu_x = _mm256_set1_pd(form.mu_x), mu_y = _mm256_set1_pd(form.mu_y);
+		const __m256d aa = _mm256_set1_pd(form.aa), bb = _mm256_set1_pd(form.bb), cc = _mm256_set1_pd(form.cc), dd = _mm256_set1_pd(form.dd);
+		const __m256d rhs = _mm256_set1_pd(form.rhs);
+		size_t nvec = n / 4 * 4;
+		for(size_t i = 0; i < nvec; i += 4)
+		{
+			__m256d x = _mm256_sub_pd(_mm256_loadu_pd(xdata + i), mu_x);
+			__m256d y = _mm256_sub_pd(_mm256_loadu_pd(ydata + i), mu_y);
+			__m256d xy = _mm256_mul_pd(x, y);
+			//((x * x * aa + x * y * cc) + x * y * bb) + y * y * dd
+			__m256d q = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(x, x), aa), _mm256_mul_pd(xy, cc));
+			q = _mm256_add_pd(q, _mm256_mul_pd(xy, bb));
+			q = _mm256_add_pd(q, _mm256_mul_pd(_mm256_mul_pd(y, y), dd));
+			int mask = _mm256_movemask_pd(_mm256_cmp_pd(q, rhs, _CMP_LE_OQ));
+			for(unsigned k = 0; k < 4; k++)
+				isIn[i + k] = (mask >> k) & 1;
+		}
+		return nvec;
+	}
+#endif
+}
+
+ELLIPSE_FORM ellipse_form(double mu_x, double mu_y, double a, double b, double alpha)
+{
+	//Q = R * diag(1/a^2, 1/b^2) * R'
+	double ca = cos(alpha);
+	double sa = sin(alpha);
+	double ia2 = 1 / (a * a);
+	double ib2 = 1 / (b * b);
+	ELLIPSE_FORM form;
+	form.mu_x = mu_x;
+	form.mu_y = mu_y;
+	form.aa = ca * ca * ia2 + sa * sa * ib2;
+	form.bb = form.cc = ca * sa * (ia2 - ib2);
+	form.dd = sa * sa * ia2 + ca * ca * ib2;
+	form.rhs = 1;
+	return form;
+}
+
+void in_ellipse(const EVENT_DATA_TYPE * xdata, const EVENT_DATA_TYPE * ydata, size_t n, const ELLIPSE_FORM & form, unsigned char * isIn)
+{
+	//local copies since isIn may alias the form
+	const EVENT_DATA_TYPE mu_x = form.mu_x, mu_y = form.mu_y;
+	const EVENT_DATA_TYPE aa = form.aa, bb = form.bb, cc = form.cc, dd = form.dd;
+	const double rhs = form.rhs;
+	size_t i = 0;
+#ifdef CYTOLIB_AVX2_KERNELS
+	if(is_simd_supported())
+		i = in_ellipse_avx2(xdata, ydata, n, form, isIn);
+#endif
+	for(; i < n; i++)
+	{
+		//center the data
+		EVENT_DATA_TYPE x = xdata[i] - mu_x;
+		EVENT_DATA_TYPE y = ydata[i] - mu_y;
+		isIn[i] = (x * x * aa + x* y * cc + x* y * bb + y * y * dd) <= rhs;
+	}
+}
+
+void in_ellipse(const EVENT_DATA_TYPE * xdata, const EVENT_DATA_TYPE * ydata, const ELLIPSE_FORM & form, const INDICE_TYPE & parentInd, bool is_negated, INDICE_TYPE &res)
+{
+	const unsigned block_size = 1024;
+	EVENT_DATA_TYPE bx[block_size], by[block_size];
+	unsigned char isIn[block_size];
+	auto nEvents = parentInd.size();
+	for(size_t start = 0; start < nEvents; start += block_size)
+	{
+		unsigned n = min<size_t>(block_size, nEvents - start);
+		for(unsigned j = 0; j < n; j++)
+		{
+			auto i = parentInd[start + j];
+			bx[j] = xdata[i];
+			by[j] = ydata[i];
+		}
+		in_ellipse(bx, by, n, form, isIn);
+		for(unsigned j = 0; j < n; j++)
+			if(bool(isIn[j]) != is_negated)
+				res.push_back(parentInd[start + j]);
+	}
+}
+
+}
@@ -1,78 +1,375 @@
 // Copyright 2019 Fred Hutchinson Cancer Research Center
 // See the included LICENSE file for details on the licence that is granted to the user of this software.
 #include <cytolib/in_polygon.hpp>
+#include <cytolib/readFCSdata.hpp>
+//the vectorized kernels work on double precision lanes (see readFCSdata.cpp)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(CYTOLIB_FLOAT_EVENTS)
+#define CYTOLIB_AVX2_KERNELS
+#define CYTOLIB_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
 namespace cytolib
 {
+namespace
+{
+	const unsigned block_size = 256;
+	/*
+	 * one step of the crossing-number test against edge e
+	 * returns true when the event lies on the edge (which means "in")
+	 */
+	inline bool cross_edge(EVENT_DATA_TYPE x, EVENT_DATA_TYPE y, const POLYGON_EDGES & edges, unsigned e, unsigned & counter)
+	{
+		if(y >= edges.y_bottom[e] && y < edges.y_top[e] && x <= edges.x_right[e])
+		{
+			EVENT_DATA_TYPE xinters = (y - edges.y1[e]) * edges.dx[e] / edges.dy[e] + edges.x1[e];
+			if(xinters == x)
+				return true;
+			if(xinters > x)
+				counter++;
+		}
+		return false;
+	}
+	bool cross_edges(EVENT_DATA_TYPE x, EVENT_DATA_TYPE y, const POLYGON_EDGES & edges, const unsigned * begin, const unsigned * end)
+	{
+		unsigned counter = 0;
+		for(auto it = begin; it != end; it++)
+			if(cross_edge(x, y, edges, *it, counter))
+				return true;
+		return counter % 2 != 0;
+	}
+	bool cross_edges(EVENT_DATA_TYPE x, EVENT_DATA_TYPE y, const POLYGON_EDGES & edges)
+	{
+		unsigned counter = 0;
+		for(unsigned e = 0; e < edges.size(); e++)
+			if(cross_edge(x, y, edges, e, counter))
+				return true;
+		return counter % 2 != 0;
+	}
+	/*
+	 * the crossing-number test of the gathered events [begin, n) against all the edges by a branch-free loop
+	 */
+	void cross_block(const EVENT_DATA_TYPE * bx, const EVENT_DATA_TYPE * by, unsigned begin, unsigned n, const POLYGON_EDGES & edges, bool * isIn)
+	{
+		unsigned counter[block_size];//number of the edges passed by the ray
+		unsigned char on_edge[block_size];//whether the event lies on the boundary
+		std::fill(counter + begin, counter + n, 0);
+		std::fill(on_edge + begin, on_edge + n, 0);
+		for(size_t e = 0; e < edges.size(); e++)
+		{
+			const EVENT_DATA_TYPE y_bottom = edges.y_bottom[e];
+			const EVENT_DATA_TYPE y_top = edges.y_top[e];
+			const EVENT_DATA_TYPE x_right = edges.x_right[e];
+			const EVENT_DATA_TYPE x1 = edges.x1[e];
+			const EVENT_DATA_TYPE y1 = edges.y1[e];
+			const EVENT_DATA_TYPE dx = edges.dx[e];
+			const EVENT_DATA_TYPE dy = edges.dy[e];
+			for(unsigned j = begin; j < n; j++)
+			{
+				/*if horizontal ray is in y range of vertex find the x coordinate where
+				ray and vertex intersect*/
+				EVENT_DATA_TYPE xinters = (by[j] - y1) * dx / dy + x1;
+				bool is_cross = (by[j] >= y_bottom) & (by[j] < y_top) & (bx[j] <= x_right);
+				counter[j] += is_cross & (xinters > bx[j]);
+				/*if intersection x coordinate == point x coordinate it lies on the
+				  boundary of the polygon, which means "in"*/
+				on_edge[j] |= is_cross & (xinters == bx[j]);
+			}
+		}
+		/*uneven number of vertices passed means "in"*/
+		for(unsigned j = begin; j < n; j++)
+			isIn[j] = on_edge[j] || (counter[j] % 2) != 0;
+	}
+#ifdef CYTOLIB_AVX2_KERNELS
+	/*
+	 * AVX2 version of cross_block, which tests 4 events at a time with the same operations in the same order
+	 * (thus bit-exact with the scalar loop) and only keeps the parity of the crossings.
+	 * The remaining events are left to cross_block.
+	 * @return the number of the events tested
+	 */
+	CYTOLIB_TARGET_AVX2 unsigned cross_block_avx2(const EVENT_DATA_TYPE * bx, const EVENT_DATA_TYPE * by, unsigned n, const POLYGON_EDGES & edges, bool * isIn)
+	{
+		unsigned nvec = n / 4 * 4;
+		for(unsigned j = 0; j < nvec; j += 4)
+		{
+			const __m256d x = _mm256_loadu_pd(bx + j);
+			const __m256d y = _mm256_loadu_pd(by + j);
+			__m256d is_odd = _mm256_setzero_pd();
+			__m256d on_edge = _mm256_setzero_pd();
+			for(size_t e = 0; e < edges.size(); e++)
+			{
+				__m256d xinters = _mm256_sub_pd(y, _mm256_set1_pd(edges.y1[e]));
+				xinters = _mm256_mul_pd(xinters, _mm256_set1_pd(edges.dx[e]));
+				xinters = _mm256_div_pd(xinters, _mm256_set1_pd(edges.dy[e]));
+				xinters = _mm256_add_pd(xinters, _mm256_set1_pd(edges.x1[e]));
+				//the ordered comparisons are false on NaN like the scalar ones
+				__m256d is_cross = _mm256_and_pd(_mm256_cmp_pd(y, _mm256_set1_pd(edges.y_bottom[e]), _CMP_GE_OQ)
+												, _mm256_cmp_pd(y, _mm256_set1_pd(edges.y_top[e]), _CMP_LT_OQ));
+				is_cross = _mm256_and_pd(is_cross, _mm256_cmp_pd(x, _mm256_set1_pd(edges.x_right[e]), _CMP_LE_OQ));
+				is_odd = _mm256_xor_pd(is_odd, _mm256_and_pd(is_cross, _mm256_cmp_pd(xinters, x, _CMP_GT_OQ)));
+				on_edge = _mm256_or_pd(on_edge, _mm256_and_pd(is_cross, _mm256_cmp_pd(xinters, x, _CMP_EQ_OQ)));
+			}
+			int mask = _mm256_movemask_pd(_mm256_or_pd(is_odd, on_edge));
+			for(unsigned k = 0; k < 4; k++)
+				isIn[j + k] = (mask >> k) & 1;
+		}
+		return nvec;
+	}
+#endif
+}
+
+POLYGON_EDGES::POLYGON_EDGES(const vector<CYTO_POINT> & vertices)
+{
+	auto nVert = vertices.size();
+	is_top_edge = false;
+	top_left = top_right = 0;
+	y_max = box_x_max = box_y_min = box_y_max = 0;
+	if(nVert == 0)
+		return;
+	//find max py
+	y_max = max_element(vertices.begin(), vertices.end(),[](const cytolib::CYTO_POINT & v1, const cytolib::CYTO_POINT & v2){return v1.y < v2.y;})->y;
+
+	auto inf = numeric_limits<EVENT_DATA_TYPE>::infinity();
+	box_x_max = -inf;
+	box_y_min = inf;
+	box_y_max = -inf;
+	for(unsigned i = 0; i < nVert; i++)
+	{
+		const CYTO_POINT & p1 = vertices[i];
+		const CYTO_POINT & p2 = vertices[(i + 1) % nVert];//the last vertice must "loop around"
+		const CYTO_POINT * p_bottom = &p1;
+		const CYTO_POINT * p_top = &p2;
+		if(p_bottom->y > p_top->y)
+			swap(p_bottom, p_top);
+
+		const CYTO_POINT * p_left = p_bottom;
+		const CYTO_POINT * p_right = p_top;
+		if(p_left->x > p_right->x)
+			swap(p_left, p_right);
+
+		if(i == 0&&p_top->y == y_max)//one end of the first edge reaches the same y as top
+		{
+			is_top_edge = true;
+			if(p_bottom->y == y_max)//horizontal top edge
+			{
+				top_left = p_left->x;
+				top_right = p_right->x;
+			}
+			else//on the top vertex
+				top_left = top_right = p_top->x;
+			box_x_max = max(box_x_max, top_right);
+		}
+		//edges that can never hold y_bottom <= y < y_top (horizontal or NaN) are not crossed by the ray
+		if(p_bottom->y < p_top->y)
+		{
+			y_bottom.push_back(p_bottom->y);
+			y_top.push_back(p_top->y);
+			x_right.push_back(p_right->x);
+			x1.push_back(p1.x);
+			y1.push_back(p1.y);
+			dx.push_back(p2.x - p1.x);
+			dy.push_back(p2.y - p1.y);
+			box_x_max = max(box_x_max, p_right->x);
+			box_y_min = min(box_y_min, p_bottom->y);
+			box_y_max = max(box_y_max, p_top->y);
+		}
+	}
+}
 
 void in_polygon(EVENT_DATA_TYPE * xdata, EVENT_DATA_TYPE * ydata, const vector<cytolib::CYTO_POINT> & vertices, INDICE_TYPE & parentInd, bool is_negated, INDICE_TYPE &res)
 {
-	unsigned counter;
-	EVENT_DATA_TYPE xinters;
-	 //find max py
-	double p_y_max = max_element(vertices.begin(), vertices.end(),[](const cytolib::CYTO_POINT & v1, const cytolib::CYTO_POINT & v2){return v1.y < v2.y;})->y;
-	//TODO: potentially we can speed up by caching pre-calculated p_bottom,top,left,right here to avoid repeated computation within the loop
-	for(auto i : parentInd)
-	{//iterate over points
-		vector<cytolib::CYTO_POINT>::const_iterator p1;
-		vector<cytolib::CYTO_POINT>::const_iterator p2;
-		counter=0;
-		for(p1  = vertices.begin(), p2 = p1 + 1; p1 < vertices.end(); p1++,p2++)
-		{// iterate over vertices
+	in_polygon(xdata, ydata, POLYGON_EDGES(vertices), parentInd, is_negated, res);
+}
 
-			if (p2 == vertices.end())
-			{//the last vertice must "loop around"
-				p2 = vertices.begin();
+void in_polygon(const EVENT_DATA_TYPE * xdata, const EVENT_DATA_TYPE * ydata, const POLYGON_EDGES & edges, const INDICE_TYPE & parentInd, bool is_negated, INDICE_TYPE &res)
+{
+	//the events that pass the bounding box prefilter are gathered into the contiguous buffers
+	EVENT_DATA_TYPE bx[block_size], by[block_size];
+	unsigned pos[block_size];
+	bool isCandIn[block_size];
+	bool isIn[block_size];
+#ifdef CYTOLIB_AVX2_KERNELS
+	bool use_simd = is_simd_supported();
+#endif
+	auto nEvents = parentInd.size();
+	for(size_t start = 0; start < nEvents; start += block_size)
+	{
+		unsigned n = min<size_t>(block_size, nEvents - start);
+		unsigned nCand = 0;
+		for(unsigned j = 0; j < n; j++)
+		{
+			auto i = parentInd[start + j];
+			EVENT_DATA_TYPE x = xdata[i];
+			EVENT_DATA_TYPE y = ydata[i];
+			isIn[j] = false;
+			if(y == edges.y_max)//handle cell that is at the same y-level as the top vertex/edge
+				isIn[j] = edges.is_top_edge&&x >= edges.top_left && x <= edges.top_right;
+			else if(y >= edges.box_y_min && y < edges.box_y_max && x <= edges.box_x_max)
+			{
+				bx[nCand] = x;
+				by[nCand] = y;
+				pos[nCand] = j;
+				nCand++;
 			}
+		}
 
-		  /*if horizontal ray is in y range of vertex find the x coordinate where
-			ray and vertex intersect*/
-			const cytolib::CYTO_POINT *  p_bottom = &(*p1);
-			const cytolib::CYTO_POINT *  p_top = &(*p2);
-			if(p_bottom->y > p_top->y)
-				swap(p_bottom, p_top);
+		unsigned nTested = 0;
+#ifdef CYTOLIB_AVX2_KERNELS
+		if(use_simd)
+			nTested = cross_block_avx2(bx, by, nCand, edges, isCandIn);
+#endif
+		cross_block(bx, by, nTested, nCand, edges, isCandIn);
+		for(unsigned j = 0; j < nCand; j++)
+			isIn[pos[j]] = isCandIn[j];
 
-			const cytolib::CYTO_POINT *  p_left = p_bottom;
-			const cytolib::CYTO_POINT *  p_right = p_top;
-			if(p_left->x > p_right->x)
-				swap(p_left, p_right);
+		for(unsigned j = 0; j < n; j++)
+			if(isIn[j] != is_negated)
+				res.push_back(parentInd[start + j]);
+	}
 
-			if(ydata[i] >= p_bottom->y && ydata[i] < p_top->y &&xdata[i] <= p_right->x && p2->y != p1->y)
-			{
-				xinters = (ydata[i]-p1->y)*(p2->x-p1->x)/(p2->y-p1->y)+p1->x;
-			  /*if intersection x coordinate == point x coordinate it lies on the
-				  boundary of the polygon, which means "in"*/
-				if(xinters==xdata[i])
-				{
-				  counter=1;
-				  break;
-				}
-				/*count how many vertices are passed by the ray*/
-				if (xinters > xdata[i])counter++;
-			 }
-			 else if(ydata[i] == p_y_max)//handle cell that is at the same y-level as the top vertex/edge
-			 {
-				if(p_top->y == ydata[i])//one end of edge reach the same y as top
-				{
-				  if(p_bottom->y == ydata[i])//horizontal top edge
-				  {
-					  counter = xdata[i] >= p_left->x && xdata[i] <= p_right->x;//whether on the edge
+}
 
-				  }
-				  else//check if on the top vertex
-					  counter = xdata[i] == p_top->x;
-				}
-				break;
-			  }
+POLYGON_GRID::POLYGON_GRID(const vector<CYTO_POINT> & _vertices, unsigned grid_size):vertices(_vertices), edges(_vertices)
+{
+	nx = ny = 0;
+	x0 = y0 = cell_w = cell_h = margin = 0;
+	auto nVert = vertices.size();
+	if(nVert == 0)
+		return;
+	double x1 = vertices[0].x, y1 = vertices[0].y;
+	x0 = x1;
+	y0 = y1;
+	for(const auto & v : vertices)
+	{
+		//leave the polygons with NaN or infinite vertices to the edge table
+		if(!isfinite(v.x)||!isfinite(v.y))
+			return;
+		x0 = min<double>(x0, v.x);
+		x1 = max<double>(x1, v.x);
+		y0 = min<double>(y0, v.y);
+		y1 = max<double>(y1, v.y);
+	}
+	if(x1 == x0||y1 == y0)
+		return;
+	if(grid_size == 0)
+		grid_size = min(256u, max(4u, unsigned(4 * ceil(sqrt(nVert)))));
+	nx = ny = grid_size;
+	cell_w = (x1 - x0) / nx;
+	cell_h = (y1 - y0) / ny;
+	//generous bound of the rounding errors of the intersections and the cell indexing
+	double scale = max(max(fabs(x0), fabs(x1)), max(fabs(y0), fabs(y1))) + (x1 - x0) + (y1 - y0);
+	margin = 64 * numeric_limits<EVENT_DATA_TYPE>::epsilon() * scale;
 
+	/*
+	 * mark the cells touched by the edges (including the horizontal ones) row by row
+	 */
+	states.resize(nx * ny, OUTSIDE);
+	auto row_idx = [&](double y){return unsigned(min<double>(ny - 1, max<double>(0, floor((y - y0) / cell_h))));};
+	auto col_idx = [&](double x){return unsigned(min<double>(nx - 1, max<double>(0, floor((x - x0) / cell_w))));};
+	for(unsigned i = 0; i < nVert; i++)
+	{
+		const CYTO_POINT & p1 = vertices[i];
+		const CYTO_POINT & p2 = vertices[(i + 1) % nVert];
+		double ey0 = min<double>(p1.y, p2.y), ey1 = max<double>(p1.y, p2.y);
+		for(unsigned r = row_idx(ey0 - margin); r <= row_idx(ey1 + margin); r++)
+		{
+			//the x extent of the edge within the row band
+			double band0 = max(ey0, y0 + r * cell_h - margin);
+			double band1 = min(ey1, y0 + (r + 1) * cell_h + margin);
+			double ex0, ex1;
+			if(p1.y == p2.y)
+			{
+				ex0 = min<double>(p1.x, p2.x);
+				ex1 = max<double>(p1.x, p2.x);
 			}
-			/*uneven number of vertices passed means "in"*/
-
-			 bool isIn =((counter % 2) != 0);
-			 if(isIn != is_negated)
-				res.push_back(i);
+			else
+			{
+				double slope = (double(p2.x) - p1.x) / (double(p2.y) - p1.y);
+				double xa = p1.x + (band0 - p1.y) * slope;
+				double xb = p1.x + (band1 - p1.y) * slope;
+				ex0 = min(xa, xb);
+				ex1 = max(xa, xb);
+			}
+			for(unsigned c = col_idx(ex0 - margin); c <= col_idx(ex1 + margin); c++)
+				states[r * nx + c] = BOUNDARY;
+		}
 	}
+	/*
+	 * the boundary cells keep the edges that may pass the crossing test within them,
+	 * the others are classified by their centers since no edge separates the events of the same cell
+	 */
+	cell_start.resize(nx * ny + 1);
+	for(unsigned r = 0; r < ny; r++)
+	{
+		double cy0 = y0 + r * cell_h - margin;
+		double cy1 = y0 + (r + 1) * cell_h + margin;
+		for(unsigned c = 0; c < nx; c++)
+		{
+			auto cell = r * nx + c;
+			cell_start[cell] = cell_edges.size();
+			if(states[cell] == BOUNDARY)
+			{
+				double cx0 = x0 + c * cell_w - margin;
+				for(unsigned e = 0; e < edges.size(); e++)
+					if(edges.y_bottom[e] < cy1 && edges.y_top[e] > cy0 && edges.x_right[e] >= cx0)
+						cell_edges.push_back(e);
+			}
+			else
+			{
+				EVENT_DATA_TYPE cx = x0 + (c + 0.5) * cell_w;
+				EVENT_DATA_TYPE cy = y0 + (r + 0.5) * cell_h;
+				states[cell] = cross_edges(cx, cy, edges) ? INSIDE : OUTSIDE;
+			}
+		}
+	}
+	cell_start[nx * ny] = cell_edges.size();
+}
 
+bool POLYGON_GRID::is_built_from(const vector<CYTO_POINT> & _vertices) const
+{
+	return vertices.size() == _vertices.size() && equal(vertices.begin(), vertices.end(), _vertices.begin()
+			, [](const CYTO_POINT & v1, const CYTO_POINT & v2){return v1.x == v2.x && v1.y == v2.y;});
+}
 
+void in_polygon(const EVENT_DATA_TYPE * xdata, const EVENT_DATA_TYPE * ydata, const POLYGON_GRID & grid, const INDICE_TYPE & parentInd, bool is_negated, INDICE_TYPE &res)
+{
+	const POLYGON_EDGES & edges = grid.edges;
+	if(grid.nx == 0)
+	{
+		in_polygon(xdata, ydata, edges, parentInd, is_negated, res);
+		return;
+	}
+	for(auto i : parentInd)
+	{
+		EVENT_DATA_TYPE x = xdata[i];
+		EVENT_DATA_TYPE y = ydata[i];
+		bool isIn = false;
+		if(y == edges.y_max)//handle cell that is at the same y-level as the top vertex/edge
+			isIn = edges.is_top_edge&&x >= edges.top_left && x <= edges.top_right;
+		else if(y >= edges.box_y_min && y < edges.box_y_max && x <= edges.box_x_max)
+		{
+			double col = (x - grid.x0) / grid.cell_w;
+			if(col < 0)//the ray from the left of the polygon passes an even number of edges unless it starts on one
+				isIn = x >= grid.x0 - grid.margin && cross_edges(x, y, edges);
+			else
+			{
+				unsigned c = min<double>(grid.nx - 1, col);
+				unsigned r = min<double>(grid.ny - 1, (y - grid.y0) / grid.cell_h);
+				auto cell = r * grid.nx + c;
+				switch(grid.states[cell])
+				{
+				case POLYGON_GRID::INSIDE:
+					isIn = true;
+					break;
+				case POLYGON_GRID::OUTSIDE:
+					break;
+				default:
+					isIn = cross_edges(x, y, edges, grid.cell_edges.data() + grid.cell_start[cell], grid.cell_edges.data() + grid.cell_start[cell + 1]);
+				}
+			}
+		}
+		if(isIn != is_negated)
+			res.push_back(i);
+	}
 }
 
 }
@@ -29,7 +29,10 @@ namespace cytolib
 			const pb::POPINDICES & ind_pb = np_pb.indices();
 			switch(ind_pb.indtype()){
 			case pb::BOOL:
-				indices.reset(new BOOLINDICES(ind_pb));
+				if(ROARINGINDICES::is_compressed(ind_pb))
+					indices.reset(new ROARINGINDICES(ind_pb));
+				else//compress the legacy packed bits
+					indices.reset(new ROARINGINDICES(BOOLINDICES(ind_pb).getMask()));
 				break;
 			case pb::INT:
 				indices.reset(new INTINDICES(ind_pb));
@@ -210,33 +213,29 @@ namespace cytolib
 				throw(domain_error("trying to get Indices for unGated node!"));
 			return indices->getIndices_u();
 			}
+	EVENT_BITSET nodeProperties::getMask(){
+			if(!this->isGated())
+				throw(domain_error("trying to get Indices for unGated node!"));
+			return indices->getMask();
+			}
 
 	/**
 	 * update the node with the new indices
 	 *
 	 */
 	void nodeProperties::setIndices(vector<bool> _ind){
-		unsigned nEvents=count(_ind.begin(),_ind.end(),true);
-		unsigned nSizeInt=sizeof(unsigned)*nEvents;
-		unsigned nSizeBool=_ind.size()/8;
-
-		if(nSizeInt<nSizeBool)
-			indices.reset(new INTINDICES(_ind));
-		else
-			indices.reset(new BOOLINDICES(_ind));
-
+		setIndices(EVENT_BITSET(_ind));
 	}
 
 	void nodeProperties::setIndices(INDICE_TYPE _ind, unsigned nTotal){
-		unsigned nEvents=_ind.size();;
-		unsigned nSizeInt=sizeof(unsigned)*nEvents;
-		unsigned nSizeBool=nTotal/8;
-
-		if(nSizeInt<nSizeBool)
-			indices.reset(new INTINDICES(_ind, nTotal));
-		else
-			indices.reset(new BOOLINDICES(_ind, nTotal));
-
+		setIndices(EVENT_BITSET(_ind, nTotal));
+	}
+	/*
+	 * the compressed containers are never larger than the packed bits (by more than a few bytes per 64k events)
+	 * nor than the int indices, so they are used for all the gated populations
+	 */
+	void nodeProperties::setIndices(const EVENT_BITSET & _ind){
+		indices.reset(new ROARINGINDICES(_ind));
 	}
 	/**
 	 * calculate the cell count for the current population.
@@ -0,0 +1,817 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/readFCSdata.hpp>
+#include <cstring>
+#include <random>
+#include <type_traits>
+//the vectorized kernels produce double precision lanes
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(CYTOLIB_FLOAT_EVENTS)
+#define CYTOLIB_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace cytolib
+{
+	namespace
+	{
+	/*
+	 * compile-time specialized decode kernels
+	 *
+	 * The decoding of a column is split into two branch-free passes over a small chunk of rows,
+	 * i.e. loading the raw values (data type, byte width, byte swapping and bitmask) and
+	 * post-processing the loaded values in place (truncation, transformation and scaling),
+	 * so that the number of instantiations stays small while none of the per-element settings is checked within the loops.
+	 * The kernels for each column are resolved only once per decode call
+	 */
+	const size_t DECODE_CHUNK_SIZE = 1024;//rows per pass, chosen to keep the chunk in L1
+	const size_t DECODE_BLOCK_BYTES = 256 * 1024;//raw bytes per block of rows decoded at a time, chosen to keep the block in L2
+	const size_t MIN_DECODE_BLOCK_SIZE = 64;
+	const long DECODE_TASKS_PER_THREAD = 4;//the minimum number of tasks per thread for load balancing
+
+	enum class LinearizeMode{none, log, PnG};
+	enum class ScaleMode{none, log, linear};
+
+	template<typename T> inline T byteswap_value(T v)
+	{
+		char * p = reinterpret_cast<char *>(&v);
+		std::reverse(p, p + sizeof(T));
+		return v;
+	}
+#if defined(__GNUC__)
+	template<> inline unsigned short byteswap_value(unsigned short v){return __builtin_bswap16(v);}
+	template<> inline unsigned byteswap_value(unsigned v){return __builtin_bswap32(v);}
+	template<> inline uint64_t byteswap_value(uint64_t v){return __builtin_bswap64(v);}
+	template<> inline float byteswap_value(float v)
+	{
+		uint32_t i;
+		memcpy(&i, &v, sizeof(i));
+		i = __builtin_bswap32(i);
+		memcpy(&v, &i, sizeof(i));
+		return v;
+	}
+	template<> inline double byteswap_value(double v)
+	{
+		uint64_t i;
+		memcpy(&i, &v, sizeof(i));
+		i = __builtin_bswap64(i);
+		memcpy(&v, &i, sizeof(i));
+		return v;
+	}
+#endif
+
+	struct ColumnKernelArgs{
+		size_t stride;//bytes per row
+		uint64_t base;//bitmask modulus
+		EVENT_DATA_TYPE max, min_limit, PnE0, PnE1, PnG;
+		float decade;
+	};
+
+	typedef void (*LoadKernel)(const char * src, size_t nrow, EVENT_DATA_TYPE * out, const ColumnKernelArgs & args);
+	typedef EVENT_DATA_TYPE (*PostKernel)(EVENT_DATA_TYPE * out, size_t nrow, EVENT_DATA_TYPE colMin, const ColumnKernelArgs & args);
+
+	/*
+	 * the 1-byte integer is loaded as char to be consistent with the previous per-element decoder
+	 */
+	template<typename T, bool isbyteswap, bool ismask>
+	void load_column(const char * src, size_t nrow, EVENT_DATA_TYPE * out, const ColumnKernelArgs & args)
+	{
+		for(size_t r = 0; r < nrow; r++, src += args.stride)
+		{
+			T v;
+			memcpy(&v, src, sizeof(T));
+			if(isbyteswap)
+				v = byteswap_value(v);
+			if(ismask)
+			{
+				//values of the width up to 32 bits are exactly representable thus the mask can be done on the integer
+				if(std::is_unsigned<T>::value && sizeof(T) <= sizeof(unsigned))
+					out[r] = static_cast<EVENT_DATA_TYPE>(static_cast<uint64_t>(v) % args.base);
+				else
+					out[r] = static_cast<uint64_t>(static_cast<EVENT_DATA_TYPE>(v)) % args.base;
+			}
+			else
+				out[r] = static_cast<EVENT_DATA_TYPE>(v);
+		}
+	}
+
+	template<bool truncate_max, bool truncate_min, LinearizeMode linearize, ScaleMode scale>
+	EVENT_DATA_TYPE post_column(EVENT_DATA_TYPE * out, size_t nrow, EVENT_DATA_TYPE colMin, const ColumnKernelArgs & args)
+	{
+		for(size_t r = 0; r < nrow; r++)
+		{
+			EVENT_DATA_TYPE outElement = out[r];
+			if(truncate_max && outElement > args.max)
+				outElement = args.max;
+			if(truncate_min && outElement < args.min_limit)
+				outElement = args.min_limit;
+
+			if(linearize == LinearizeMode::log)
+				outElement = pow(10,outElement/args.max * args.PnE0) * args.PnE1;
+			else if(linearize == LinearizeMode::PnG)
+				outElement = outElement / args.PnG;
+
+			if(scale == ScaleMode::log)
+				outElement = args.decade*((outElement-1)/(args.max-1));
+			else if(scale == ScaleMode::linear)
+				outElement = args.decade*((outElement)/(args.max));
+
+			out[r] = outElement;
+			colMin = colMin > outElement?outElement:colMin;
+		}
+		return colMin;
+	}
+
+#ifdef CYTOLIB_AVX2_KERNELS
+	/*
+	 * AVX2 kernels
+	 *
+	 * Each kernel gathers the column of consecutive rows from the row-major buffer into vector registers,
+	 * byteswaps with shuffles, applies the bitmask, converts to double and stores them contiguously.
+	 * The remaining rows are handed to the scalar kernels of the same instantiation,
+	 * which keeps the results bit-exact with the scalar path.
+	 * They are compiled with the target attribute and only selected when the cpu supports AVX2 (see is_simd_supported)
+	 */
+#define CYTOLIB_TARGET_AVX2 __attribute__((target("avx2")))
+
+	/*
+	 * 16-bit and 32-bit integers and float32, which are all gathered as 32-bit words
+	 */
+	template<typename T, bool isbyteswap, bool ismask>
+	CYTOLIB_TARGET_AVX2 void load_column_avx2_32(const char * src, size_t nrow, EVENT_DATA_TYPE * out, const ColumnKernelArgs & args)
+	{
+		const bool is16 = sizeof(T) == sizeof(unsigned short);
+		const __m256i vidx = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(static_cast<int>(args.stride)));
+		//the shuffle for 16-bit values also clears the two upper bytes of each word
+		const __m256i vswap = is16?_mm256_setr_epi8(1, 0, -1, -1, 5, 4, -1, -1, 9, 8, -1, -1, 13, 12, -1, -1
+													, 1, 0, -1, -1, 5, 4, -1, -1, 9, 8, -1, -1, 13, 12, -1, -1)
+									:_mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+													, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+		const __m256i vlow = _mm256_set1_epi32(0xFFFF);
+		const __m256i vmask = _mm256_set1_epi32(static_cast<int>(args.base - 1));
+		const __m128i vsign = _mm_set1_epi32(numeric_limits<int>::min());
+		const __m256d voffset = _mm256_set1_pd(2147483648.0);
+		//the word gathered for a 16-bit value spans 2 bytes beyond it, thus the last row is always left to the scalar kernel
+		size_t nvec = is16?(nrow > 0?(nrow - 1) / 8 * 8:0):nrow / 8 * 8;
+		size_t r = 0;
+		for(; r < nvec; r += 8, src += 8 * args.stride)
+		{
+			__m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int *>(src), vidx, 1);
+			if(isbyteswap)
+				v = _mm256_shuffle_epi8(v, vswap);
+			else if(is16)
+				v = _mm256_and_si256(v, vlow);
+			if(ismask)
+				v = _mm256_and_si256(v, vmask);
+
+			if(std::is_same<T, float>::value)
+			{
+				__m256 f = _mm256_castsi256_ps(v);
+				_mm256_storeu_pd(out + r, _mm256_cvtps_pd(_mm256_castps256_ps128(f)));
+				_mm256_storeu_pd(out + r + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(f, 1)));
+			}
+			else if(is16)
+			{
+				_mm256_storeu_pd(out + r, _mm256_cvtepi32_pd(_mm256_castsi256_si128(v)));
+				_mm256_storeu_pd(out + r + 4, _mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1)));
+			}
+			else
+			{
+				//unsigned 32-bit values are converted by offsetting them into the signed range
+				__m128i lo = _mm_xor_si128(_mm256_castsi256_si128(v), vsign);
+				__m128i hi = _mm_xor_si128(_mm256_extracti128_si256(v, 1), vsign);
+				_mm256_storeu_pd(out + r, _mm256_add_pd(_mm256_cvtepi32_pd(lo), voffset));
+				_mm256_storeu_pd(out + r + 4, _mm256_add_pd(_mm256_cvtepi32_pd(hi), voffset));
+			}
+		}
+		load_column<T, isbyteswap, ismask>(src, nrow - r, out + r, args);
+	}
+
+	template<bool isbyteswap>
+	CYTOLIB_TARGET_AVX2 void load_column_avx2_f64(const char * src, size_t nrow, EVENT_DATA_TYPE * out, const ColumnKernelArgs & args)
+	{
+		const __m128i vidx = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(static_cast<int>(args.stride)));
+		const __m256i vswap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8
+												, 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+		size_t nvec = nrow / 4 * 4;
+		size_t r = 0;
+		for(; r < nvec; r += 4, src += 4 * args.stride)
+		{
+			__m256i v = _mm256_i32gather_epi64(reinterpret_cast<const long long *>(src), vidx, 1);
+			if(isbyteswap)
+				v = _mm256_shuffle_epi8(v, vswap);
+			_mm256_storeu_pd(out + r, _mm256_castsi256_pd(v));
+		}
+		load_column<double, isbyteswap, false>(src, nrow - r, out + r, args);
+	}
+
+	/*
+	 * the layouts without the AVX2 kernel, i.e. 1-byte and 64-bit integers
+	 */
+	template<typename T, bool isbyteswap, bool ismask>
+	struct Avx2LoadKernel{
+		static LoadKernel get(){return nullptr;}
+	};
+	template<bool isbyteswap, bool ismask>
+	struct Avx2LoadKernel<unsigned short, isbyteswap, ismask>{
+		static LoadKernel get(){return load_column_avx2_32<unsigned short, isbyteswap, ismask>;}
+	};
+	template<bool isbyteswap, bool ismask>
+	struct Avx2LoadKernel<unsigned, isbyteswap, ismask>{
+		static LoadKernel get(){return load_column_avx2_32<unsigned, isbyteswap, ismask>;}
+	};
+	template<bool isbyteswap>
+	struct Avx2LoadKernel<float, isbyteswap, false>{
+		static LoadKernel get(){return load_column_avx2_32<float, isbyteswap, false>;}
+	};
+	template<bool isbyteswap>
+	struct Avx2LoadKernel<double, isbyteswap, false>{
+		static LoadKernel get(){return load_column_avx2_f64<isbyteswap>;}
+	};
+
+	/*
+	 * the log linearization is never dispatched here since it relies on the scalar pow
+	 */
+	template<bool truncate_max, bool truncate_min, LinearizeMode linearize, ScaleMode scale>
+	CYTOLIB_TARGET_AVX2 EVENT_DATA_TYPE post_column_avx2(EVENT_DATA_TYPE * out, size_t nrow, EVENT_DATA_TYPE colMin, const ColumnKernelArgs & args)
+	{
+		const __m256d vmax = _mm256_set1_pd(args.max);
+		const __m256d vmin_limit = _mm256_set1_pd(args.min_limit);
+		const __m256d vPnG = _mm256_set1_pd(args.PnG);
+		const __m256d vdecade = _mm256_set1_pd(args.decade);
+		const __m256d vone = _mm256_set1_pd(1);
+		__m256d vcolMin = _mm256_set1_pd(colMin);
+		size_t nvec = nrow / 4 * 4;
+		size_t r = 0;
+		for(; r < nvec; r += 4)
+		{
+			__m256d v = _mm256_loadu_pd(out + r);
+			if(truncate_max)
+				v = _mm256_blendv_pd(v, vmax, _mm256_cmp_pd(v, vmax, _CMP_GT_OQ));
+			if(truncate_min)
+				v = _mm256_blendv_pd(v, vmin_limit, _mm256_cmp_pd(v, vmin_limit, _CMP_LT_OQ));
+
+			if(linearize == LinearizeMode::PnG)
+				v = _mm256_div_pd(v, vPnG);
+
+			if(scale == ScaleMode::log)
+				v = _mm256_mul_pd(vdecade, _mm256_div_pd(_mm256_sub_pd(v, vone), _mm256_sub_pd(vmax, vone)));
+			else if(scale == ScaleMode::linear)
+				v = _mm256_mul_pd(vdecade, _mm256_div_pd(v, vmax));
+
+			_mm256_storeu_pd(out + r, v);
+			vcolMin = _mm256_blendv_pd(vcolMin, v, _mm256_cmp_pd(v, vcolMin, _CMP_LT_OQ));
+		}
+		EVENT_DATA_TYPE lanes[4];
+		_mm256_storeu_pd(lanes, vcolMin);
+		for(auto e : lanes)
+			colMin = colMin > e?e:colMin;
+		return post_column<truncate_max, truncate_min, linearize, scale>(out + r, nrow - r, colMin, args);
+	}
+#endif
+
+	template<typename T, bool isbyteswap, bool ismask>
+	LoadKernel load_kernel(bool use_simd)
+	{
+#ifdef CYTOLIB_AVX2_KERNELS
+		if(use_simd)
+		{
+			LoadKernel k = Avx2LoadKernel<T, isbyteswap, ismask>::get();
+			if(k)
+				return k;
+		}
+#else
+		(void)use_simd;
+#endif
+		return load_column<T, isbyteswap, ismask>;
+	}
+
+	template<typename T>
+	LoadKernel select_load_kernel(bool isbyteswap, bool ismask, bool use_simd)
+	{
+		if(isbyteswap)
+			return ismask?load_kernel<T, true, true>(use_simd):load_kernel<T, true, false>(use_simd);
+		else
+			return ismask?load_kernel<T, false, true>(use_simd):load_kernel<T, false, false>(use_simd);
+	}
+
+	template<bool truncate_max, bool truncate_min, LinearizeMode linearize, ScaleMode scale>
+	PostKernel post_kernel(bool use_simd)
+	{
+#ifdef CYTOLIB_AVX2_KERNELS
+		if(use_simd && linearize != LinearizeMode::log)
+			return post_column_avx2<truncate_max, truncate_min, linearize, scale>;
+#else
+		(void)use_simd;
+#endif
+		return post_column<truncate_max, truncate_min, linearize, scale>;
+	}
+
+	template<bool truncate_max, bool truncate_min, LinearizeMode linearize>
+	PostKernel select_post_kernel(ScaleMode scale, bool use_simd)
+	{
+		switch(scale)
+		{
+		case ScaleMode::log:
+			return post_kernel<truncate_max, truncate_min, linearize, ScaleMode::log>(use_simd);
+		case ScaleMode::linear:
+			return post_kernel<truncate_max, truncate_min, linearize, ScaleMode::linear>(use_simd);
+		default:
+			return post_kernel<truncate_max, truncate_min, linearize, ScaleMode::none>(use_simd);
+		}
+	}
+
+	template<bool truncate_max, bool truncate_min>
+	PostKernel select_post_kernel(LinearizeMode linearize, ScaleMode scale, bool use_simd)
+	{
+		switch(linearize)
+		{
+		case LinearizeMode::log:
+			return select_post_kernel<truncate_max, truncate_min, LinearizeMode::log>(scale, use_simd);
+		case LinearizeMode::PnG:
+			return select_post_kernel<truncate_max, truncate_min, LinearizeMode::PnG>(scale, use_simd);
+		default:
+			return select_post_kernel<truncate_max, truncate_min, LinearizeMode::none>(scale, use_simd);
+		}
+	}
+
+	PostKernel select_post_kernel(bool truncate_max, bool truncate_min, LinearizeMode linearize, ScaleMode scale, bool use_simd)
+	{
+		if(truncate_max)
+			return truncate_min?select_post_kernel<true, true>(linearize, scale, use_simd):select_post_kernel<true, false>(linearize, scale, use_simd);
+		else
+			return truncate_min?select_post_kernel<false, true>(linearize, scale, use_simd):select_post_kernel<false, false>(linearize, scale, use_simd);
+	}
+
+	/*
+	 * the legacy mixed endian layout permutes the bytes of each element before the regular byte swapping
+	 */
+	template<typename T>
+	void load_column_permuted(const char * src, size_t nrow, EVENT_DATA_TYPE * out, const ColumnKernelArgs & args
+								, const vector<int> & iByteOrd, bool isbyteswap, bool ismask)
+	{
+		for(size_t r = 0; r < nrow; r++, src += args.stride)
+		{
+			char p[sizeof(T)];
+			for(unsigned i = 0; i < sizeof(T); i++)
+				p[iByteOrd[i]] = src[i];
+			if(isbyteswap)
+				std::reverse(p, p + sizeof(T));
+			T v;
+			memcpy(&v, p, sizeof(T));
+			out[r] = static_cast<EVENT_DATA_TYPE>(v);
+			if(ismask)
+				out[r] = static_cast<uint64_t>(out[r]) % args.base;
+		}
+	}
+
+	/*
+	 * the kernels and their arguments of one column, resolved once per decode call
+	 */
+	struct ColumnKernel{
+		LoadKernel load;
+		PostKernel post;
+		ColumnKernelArgs args;
+		size_t offset;//byte offset of the column within a row
+		unsigned width;//byte width
+		bool ismask;
+	};
+
+	ColumnKernel resolve_column_kernel(const FCSDataDecoder & decoder, unsigned c)
+	{
+		const cytoParam & param = decoder.params[c];
+		bool is_int = decoder.is_int;
+		bool isbyteswap = decoder.isbyteswap;
+		auto thisSize = param.PnB/8;
+		ColumnKernel kernel;
+		kernel.offset = decoder.bits_offset[c]/8;
+		kernel.width = thisSize;
+		ColumnKernelArgs & args = kernel.args;
+		args.stride = decoder.row_bytes();
+		args.max = param.max;
+		args.min_limit = decoder.min_limit;
+		args.PnE0 = param.PnE[0];
+		args.PnE1 = param.PnE[1];
+		args.PnG = param.PnG;
+		args.decade = decoder.decade;
+		args.base = 0;
+		// apply bitmask for integer data
+		bool & ismask = kernel.ismask;
+		ismask = false;
+		if(is_int && param.max > 0)
+		{
+			int usedBits = ceil(log2(param.max));
+			if(usedBits < param.PnB)
+			{
+				ismask = true;
+				args.base = static_cast<uint64_t>(1)<<usedBits;
+			}
+		}
+
+		//the gather offsets of 8 rows must fit into 32-bit integers
+		bool simd = decoder.use_simd && args.stride <= static_cast<size_t>(numeric_limits<int>::max()) / 8;
+		LoadKernel & load = kernel.load;
+		if(is_int)
+		{
+			switch(thisSize)
+			{
+			case sizeof(BYTE)://1 byte
+				load = select_load_kernel<char>(isbyteswap, ismask, simd);
+				break;
+			case sizeof(unsigned short): //2 bytes
+				load = select_load_kernel<unsigned short>(isbyteswap, ismask, simd);
+				break;
+			case sizeof(unsigned)://4 bytes
+				load = select_load_kernel<unsigned>(isbyteswap, ismask, simd);
+				break;
+			case sizeof(uint64_t)://8 bytes
+				load = select_load_kernel<uint64_t>(isbyteswap, ismask, simd);
+				break;
+			default:
+				{
+				  std::string serror = "unsupported byte width :";
+				  serror.append(std::to_string(thisSize));
+				  throw std::range_error(serror.c_str());
+				}
+			}
+		}
+		else
+		{
+			switch(thisSize)
+			{
+			case sizeof(float):
+				load = select_load_kernel<float>(isbyteswap, false, simd);
+				break;
+			case sizeof(double):
+				load = select_load_kernel<double>(isbyteswap, false, simd);
+				break;
+			default:
+				std::string serror ="Unsupported bitwidths for numerical data type:";
+				serror.append(std::to_string(thisSize));
+				throw std::range_error(serror.c_str());
+			}
+		}
+
+		// truncate data at range
+		bool truncate_max = !decoder.transDefinedinKeys && decoder.truncate_max_range;
+		bool truncate_min = !decoder.transDefinedinKeys && decoder.truncate_min_val;
+//				## Transform or scale if necessary
+//				# J.Spidlen, Nov 13, 2013: added the flowCore_fcsPnGtransform keyword, which is
+//				# set to "linearize-with-PnG-scaling" when transformation="linearize-with-PnG-scaling"
+//				# in read.FCS(). This does linearization for log-stored parameters and also division by
+//				# gain ($PnG value) for linearly stored parameters. This is how the channel-to-scale
+//				# transformation should be done according to the FCS specification (and according to
+//				# Gating-ML 2.0), but lots of software tools are ignoring the $PnG division. I added it
+//				# so that it is only done when specifically asked for so that read.FCS remains backwards
+//				# compatible with previous versions.
+		LinearizeMode linearize = LinearizeMode::none;
+		if(decoder.isTransformation)
+		{
+			if(param.PnE[0] > 0)
+				linearize = LinearizeMode::log;
+			else if(decoder.fcsPnGtransform && param.PnG != 1)
+				linearize = LinearizeMode::PnG;
+		}
+		ScaleMode scalemode = ScaleMode::none;
+		if(decoder.scale)
+			scalemode = param.PnE[0] > 0?ScaleMode::log:ScaleMode::linear;
+		kernel.post = select_post_kernel(truncate_max, truncate_min, linearize, scalemode, simd);
+		return kernel;
+	}
+
+	/*
+	 * decode one column of a contiguous block of rows in chunks
+	 */
+	void run_column_kernel(const FCSDataDecoder & decoder, const ColumnKernel & kernel, const char * src, size_t nrow, EVENT_DATA_TYPE * out, EVENT_DATA_TYPE & colMin)
+	{
+		const ColumnKernelArgs & args = kernel.args;
+		const vector<int> & iByteOrd = decoder.iByteOrd;
+		bool is_int = decoder.is_int;
+		bool isbyteswap = decoder.isbyteswap;
+		bool ismask = kernel.ismask;
+		src += kernel.offset;
+		for(size_t r = 0; r < nrow; r += DECODE_CHUNK_SIZE)
+		{
+			size_t n = min(DECODE_CHUNK_SIZE, nrow - r);
+			const char * chunk = src + r * args.stride;
+			if(iByteOrd.size() > 0)
+			{
+				//mixed endian only applies to the uniform bitwidth
+				switch(kernel.width)
+				{
+				case sizeof(unsigned short):
+					load_column_permuted<unsigned short>(chunk, n, out + r, args, iByteOrd, isbyteswap, ismask);
+					break;
+				case sizeof(unsigned):
+					if(is_int)
+						load_column_permuted<unsigned>(chunk, n, out + r, args, iByteOrd, isbyteswap, ismask);
+					else
+						load_column_permuted<float>(chunk, n, out + r, args, iByteOrd, isbyteswap, false);
+					break;
+				case sizeof(uint64_t):
+					if(is_int)
+						load_column_permuted<uint64_t>(chunk, n, out + r, args, iByteOrd, isbyteswap, ismask);
+					else
+						load_column_permuted<double>(chunk, n, out + r, args, iByteOrd, isbyteswap, false);
+					break;
+				default:
+					load_column_permuted<char>(chunk, n, out + r, args, iByteOrd, isbyteswap, ismask);
+				}
+			}
+			else
+				kernel.load(chunk, n, out + r, args);
+			colMin = kernel.post(out + r, n, colMin, args);
+		}
+	}
+	};
+
+	void FCSDataDecoder::decode_column(unsigned c, const char * src, size_t nrow, EVENT_DATA_TYPE * out, EVENT_DATA_TYPE & colMin) const
+	{
+		run_column_kernel(*this, resolve_column_kernel(*this, c), src, nrow, out, colMin);
+	}
+
+	/**
+	 * cp raw bytes(row-major) to a 2d mat (col-major) represented as 1d array(with different byte width for each elements)
+	 *
+	 * The rows are processed in cache-sized blocks, i.e. all the columns of a block are decoded
+	 * while its raw bytes are still in cache, instead of streaming the entire buffer once for each column.
+	 * The work is scheduled as (row block, column group) tasks. The columns are only split into groups
+	 * when there are not enough row blocks to keep all the threads busy (e.g. small files or subsets).
+	 * Each thread keeps its own running minimums across its tasks, which are merged at the end.
+	 */
+	void FCSDataDecoder::decode(const char * src, size_t nrow, EVENT_DATA_TYPE * dest, size_t ld, vector<EVENT_DATA_TYPE> & realMin) const
+	{
+		int nCol = params.size();
+		if(realMin.size() != params.size())
+			realMin.resize(nCol, numeric_limits<EVENT_DATA_TYPE>::max());
+		if(nCol == 0)
+			return;
+		//resolve all kernels before entering the parallel region so that errors are thrown from here
+		vector<ColumnKernel> kernels;
+		for(auto c = 0; c < nCol; c++)
+			kernels.push_back(resolve_column_kernel(*this, c));
+
+		size_t nRowSizeBytes = row_bytes();
+		size_t blockSize = nRowSizeBytes > 0?DECODE_BLOCK_BYTES / nRowSizeBytes:DECODE_CHUNK_SIZE;
+		blockSize = max(min(blockSize, DECODE_CHUNK_SIZE), MIN_DECODE_BLOCK_SIZE);
+		long nBlock = (nrow + blockSize - 1) / blockSize;
+
+		long nColGroup = 1;
+		long nTaskMin = max(num_threads, 1) * DECODE_TASKS_PER_THREAD;
+		if(num_threads > 1 && nBlock > 0 && nBlock < nTaskMin)
+			nColGroup = min<long>(nCol, (nTaskMin + nBlock - 1) / nBlock);
+		long colGroupSize = (nCol + nColGroup - 1) / nColGroup;
+		nColGroup = (nCol + colGroupSize - 1) / colGroupSize;
+		long nTask = nBlock * nColGroup;
+	#ifdef _OPENMP
+		omp_set_num_threads(num_threads);
+	#endif
+
+		#pragma omp parallel
+		{
+			vector<EVENT_DATA_TYPE> localMin(realMin);
+			#pragma omp for schedule(dynamic)
+			for(long t = 0; t < nTask; t++)
+			{
+				long b = t / nColGroup;
+				long cStart = t % nColGroup * colGroupSize;
+				long cEnd = min<long>(cStart + colGroupSize, nCol);
+				size_t start = b * blockSize;
+				size_t n = min(blockSize, nrow - start);
+				const char * block = src + start * nRowSizeBytes;
+				for(auto c = cStart; c < cEnd; c++)
+					run_column_kernel(*this, kernels[c], block, n, dest + c * ld + start, localMin[c]);
+			}
+			#pragma omp critical
+			for(auto c = 0; c < nCol; c++)
+				realMin[c] = realMin[c] > localMin[c]?localMin[c]:realMin[c];
+		}
+	}
+
+	vector<int64_t> sample_fcs_rows(int64_t nrow, int64_t nSample, SampleType type, int seed)
+	{
+		vector<int64_t> which_lines;
+		std::default_random_engine generator(seed);
+		switch(type)
+		{
+		case SampleType::reservoir:
+			{
+				//Algorithm L, which skips over the rows geometrically instead of drawing for each row
+				which_lines.resize(nSample);
+				std::iota(which_lines.begin(), which_lines.end(), 0);
+				if(nSample == 0)
+					break;
+				std::uniform_real_distribution<double> unif(0, 1);
+				std::uniform_int_distribution<int64_t> slot(0, nSample - 1);
+				//draw from (0, 1] to avoid log(0)
+				auto u = [&](){return 1 - unif(generator);};
+				double w = exp(log(u())/nSample);
+				int64_t i = nSample - 1;
+				while(true)
+				{
+					double skip = floor(log(u())/log1p(-w));
+					if(!(skip < nrow - i))//also guards against the overflow when w is close to 0
+						break;
+					i += static_cast<int64_t>(skip) + 1;
+					if(i >= nrow)
+						break;
+					which_lines[slot(generator)] = i;
+					w *= exp(log(u())/nSample);
+				}
+			}
+			break;
+		case SampleType::bernoulli:
+			{
+				if(nSample == 0)
+					break;
+				//the gaps between the selected rows follow the geometric distribution
+				std::geometric_distribution<int64_t> gap(static_cast<double>(nSample) / nrow);
+				for(int64_t i = gap(generator); i < nrow; i += gap(generator) + 1)
+					which_lines.push_back(i);
+			}
+			break;
+		default:
+			{
+				which_lines.resize(nSample);
+				std::uniform_int_distribution<int64_t> distribution(0, nrow - 1);
+				for(int64_t i = 0; i < nSample; i++)
+				{
+					which_lines[i] = distribution(generator);
+				}
+			}
+		}
+		sort(which_lines.begin(), which_lines.end());
+		return which_lines;
+	}
+
+	namespace
+	{
+	const int64_t MAX_RUN_BYTES = 16 * 1024 * 1024;//upper bound of the buffer of each run
+
+	/*
+	 * the contiguous rows [first, last] covering which_lines[sel_start, sel_end)
+	 */
+	struct RowRun{
+		int64_t first, last;
+		size_t sel_start, sel_end;
+	};
+	};
+
+	void read_fcs_rows(const string & filename, int64_t datastart, int64_t dataend, size_t nRowSizeBytes
+						, const vector<int64_t> & which_lines, int64_t gap_bytes, char * dest, int num_threads)
+	{
+		int64_t rowBytes = nRowSizeBytes;
+		int64_t gapRows = max<int64_t>(gap_bytes, 0) / rowBytes;
+		int64_t maxRunRows = max<int64_t>(MAX_RUN_BYTES / rowBytes, 1);
+		vector<RowRun> runs;
+		for(size_t s = 0; s < which_lines.size(); s++)
+		{
+			int64_t i = which_lines[s];
+			int64_t pos =  datastart + i * rowBytes;
+			if(pos > dataend || pos < datastart)
+				throw(domain_error("the index of which.lines exceeds the data boundary: " + to_string(i)));
+			if(runs.size() > 0 && i - runs.back().last <= gapRows + 1 && i - runs.back().first < maxRunRows)
+			{
+				runs.back().last = i;
+				runs.back().sel_end = s + 1;
+			}
+			else
+				runs.push_back({i, i, s, s + 1});
+		}
+
+		int nRun = runs.size();
+		string err;
+#ifndef _WIN32
+		int fd = open(filename.c_str(), O_RDONLY);
+		if(fd < 0)
+			throw(domain_error("can't open the file: " + filename));
+	#ifdef _OPENMP
+		omp_set_num_threads(num_threads);
+	#endif
+		#pragma omp parallel
+		{
+			vector<char> buf;
+			#pragma omp for schedule(dynamic)
+			for(int r = 0; r < nRun; r++)
+			{
+				const RowRun & run = runs[r];
+				size_t nBytes = (run.last - run.first + 1) * rowBytes;
+				buf.resize(nBytes);
+				size_t nRead = 0;
+				while(nRead < nBytes)
+				{
+					ssize_t n = pread(fd, buf.data() + nRead, nBytes - nRead, datastart + run.first * rowBytes + nRead);
+					if(n <= 0)
+						break;
+					nRead += n;
+				}
+				if(nRead < nBytes)
+				{
+					#pragma omp critical
+					err = "the index of which.lines exceeds the data boundary: " + to_string(which_lines[run.sel_end - 1]);
+					continue;
+				}
+				for(size_t s = run.sel_start; s < run.sel_end; s++)
+					memcpy(dest + s * rowBytes, buf.data() + (which_lines[s] - run.first) * rowBytes, rowBytes);
+			}
+		}
+		close(fd);
+#else
+		ifstream in(filename, ios::in|ios::binary);
+		if(!in.is_open())
+			throw(domain_error("can't open the file: " + filename));
+		vector<char> buf;
+		for(int r = 0; r < nRun; r++)
+		{
+			const RowRun & run = runs[r];
+			size_t nBytes = (run.last - run.first + 1) * rowBytes;
+			buf.resize(nBytes);
+			in.seekg(datastart + run.first * rowBytes);
+			in.read(buf.data(), nBytes);
+			if(static_cast<size_t>(in.gcount()) < nBytes)
+			{
+				err = "the index of which.lines exceeds the data boundary: " + to_string(which_lines[run.sel_end - 1]);
+				break;
+			}
+			for(size_t s = run.sel_start; s < run.sel_end; s++)
+				memcpy(dest + s * rowBytes, buf.data() + (which_lines[s] - run.first) * rowBytes, rowBytes);
+		}
+#endif
+		if(!err.empty())
+			throw(domain_error(err));
+	}
+
+	bool is_simd_supported()
+	{
+#ifdef CYTOLIB_AVX2_KERNELS
+		static const bool avx2 = __builtin_cpu_supports("avx2");
+		return avx2;
+#else
+		return false;
+#endif
+	}
+
+#ifndef _WIN32
+	bool is_mmap_supported(){return true;}
+
+	MappedFileRange::MappedFileRange(const string & filename, int64_t offset, size_t len, bool is_sequential):addr_(nullptr),map_len_(0),data_(nullptr),len_(0)
+	{
+		int fd = open(filename.c_str(), O_RDONLY);
+		if(fd < 0)
+			throw(domain_error("can't open the file: " + filename));
+		struct stat st;
+		if(fstat(fd, &st) != 0)
+		{
+			close(fd);
+			throw(domain_error("can't stat the file: " + filename));
+		}
+		int64_t fsize = st.st_size;
+		//clamp to the file size to avoid SIGBUS when the DATA segment is truncated
+		if(offset >= fsize)
+			len = 0;
+		else if(offset + static_cast<int64_t>(len) > fsize)
+			len = fsize - offset;
+
+		if(len > 0)
+		{
+			//mmap offset must be aligned to the page size
+			int64_t page_size = sysconf(_SC_PAGESIZE);
+			int64_t aligned_offset = offset / page_size * page_size;
+			size_t delta = offset - aligned_offset;
+			map_len_ = len + delta;
+			addr_ = mmap(nullptr, map_len_, PROT_READ, MAP_PRIVATE, fd, aligned_offset);
+			if(addr_ == MAP_FAILED)
+			{
+				addr_ = nullptr;
+				close(fd);
+				throw(domain_error("failed to mmap the file: " + filename));
+			}
+			madvise(addr_, map_len_, is_sequential?MADV_SEQUENTIAL:MADV_RANDOM);
+			data_ = static_cast<const char *>(addr_) + delta;
+			len_ = len;
+		}
+		//the mapping stays valid after the descriptor is closed
+		close(fd);
+	}
+
+	MappedFileRange::~MappedFileRange()
+	{
+		if(addr_)
+			munmap(addr_, map_len_);
+	}
+#else
+	bool is_mmap_supported(){return false;}
+
+	MappedFileRange::MappedFileRange(const string & filename, int64_t offset, size_t len, bool is_sequential):addr_(nullptr),map_len_(0),data_(nullptr),len_(0)
+	{
+		throw(domain_error("memory-mapped FCS reading is not supported on this platform!"));
+	}
+	MappedFileRange::~MappedFileRange(){}
+#endif
+};
+
@@ -0,0 +1,374 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/roaring_bitmap.hpp>
+#include <algorithm>
+
+namespace cytolib
+{
+	typedef EVENT_BITSET::WORD MASK_WORD;
+	const unsigned WORD_BITS = EVENT_BITSET::WORD_BITS;
+	/*
+	 * set the bits [s, e] of the block
+	 */
+	static void set_range(MASK_WORD * block, unsigned s, unsigned e)
+	{
+		unsigned ws = s / WORD_BITS, we = e / WORD_BITS;
+		MASK_WORD ms = ~MASK_WORD(0) << (s % WORD_BITS);
+		MASK_WORD me = ~MASK_WORD(0) >> (WORD_BITS - 1 - e % WORD_BITS);
+		if(ws == we)
+			block[ws] |= ms & me;
+		else
+		{
+			block[ws] |= ms;
+			for(unsigned k = ws + 1; k < we; k++)
+				block[k] = ~MASK_WORD(0);
+			block[we] |= me;
+		}
+	}
+	static bool contains(const ROARING_BITMAP::CONTAINER & c, uint16_t v)
+	{
+		switch(c.type)
+		{
+		case ROARING_BITMAP::ARRAY:
+			return binary_search(c.values.begin(), c.values.end(), v);
+		case ROARING_BITMAP::RUN:
+		{
+			//the last run starting at or before v
+			size_t lo = 0, hi = c.values.size() / 2;
+			while(lo < hi)
+			{
+				size_t mid = (lo + hi) / 2;
+				if(c.values[2 * mid] <= v)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			return lo > 0 && v - c.values[2 * (lo - 1)] <= c.values[2 * (lo - 1) + 1];
+		}
+		default:
+			return (c.bits[v / WORD_BITS] >> (v % WORD_BITS)) & 1;
+		}
+	}
+
+	unsigned ROARING_BITMAP::block_words(unsigned key) const{
+		unsigned nWords = (nBits + WORD_BITS - 1) / WORD_BITS;
+		unsigned base = key * BLOCK_WORDS;
+		return nWords - base < BLOCK_WORDS ? nWords - base : BLOCK_WORDS;
+	}
+	/*
+	 * append the block as the smallest container, skipping the empty block
+	 */
+	void ROARING_BITMAP::push_block(unsigned key, const MASK_WORD * block){
+		unsigned nw = block_words(key);
+		unsigned c = 0, nRuns = 0;
+		MASK_WORD carry = 0;
+		for(unsigned k = 0; k < nw; k++)
+		{
+			MASK_WORD w = block[k];
+			c += popcount64(w);
+			//the first bits of the runs
+			nRuns += popcount64(w & ~((w << 1) | carry));
+			carry = w >> (WORD_BITS - 1);
+		}
+		if(c == 0)
+			return;
+
+		CONTAINER ct;
+		ct.key = key;
+		ct.card = c;
+		size_t array_bytes = c <= ARRAY_MAX ? 2 * size_t(c) : size_t(-1);
+		size_t run_bytes = 4 * size_t(nRuns);
+		size_t bitmap_bytes = 8 * size_t(nw);
+		if(array_bytes <= run_bytes && array_bytes <= bitmap_bytes)
+		{
+			ct.type = ARRAY;
+			ct.values.reserve(c);
+			for(unsigned k = 0; k < nw; k++)
+				for(MASK_WORD w = block[k]; w; w &= w - 1)
+					ct.values.push_back(k * WORD_BITS + ctz64(w));
+		}
+		else if(run_bytes <= bitmap_bytes)
+		{
+			ct.type = RUN;
+			ct.values.reserve(2 * nRuns);
+			carry = 0;
+			unsigned start = 0;
+			for(unsigned k = 0; k < nw; k++)
+			{
+				MASK_WORD w = block[k];
+				MASK_WORD next = k + 1 < nw ? block[k + 1] : 0;
+				MASK_WORD starts = w & ~((w << 1) | carry);
+				MASK_WORD ends = w & ~((w >> 1) | (next << (WORD_BITS - 1)));
+				carry = w >> (WORD_BITS - 1);
+				//the starts and the ends alternate (a single event run starts and ends at the same bit)
+				while(starts | ends)
+				{
+					if(starts && (!ends || ctz64(starts) <= ctz64(ends)))
+					{
+						start = k * WORD_BITS + ctz64(starts);
+						starts &= starts - 1;
+					}
+					else
+					{
+						unsigned end = k * WORD_BITS + ctz64(ends);
+						ct.values.push_back(start);
+						ct.values.push_back(end - start);
+						ends &= ends - 1;
+					}
+				}
+			}
+		}
+		else
+		{
+			ct.type = BITMAP;
+			ct.bits.assign(block, block + nw);
+		}
+		card += c;
+		containers.push_back(std::move(ct));
+	}
+	void ROARING_BITMAP::expand(const CONTAINER & c, MASK_WORD * block) const{
+		fill(block, block + block_words(c.key), MASK_WORD(0));
+		switch(c.type)
+		{
+		case ARRAY:
+			for(auto v : c.values)
+				block[v / WORD_BITS] |= MASK_WORD(1) << (v % WORD_BITS);
+			break;
+		case RUN:
+			for(size_t r = 0; r < c.values.size(); r += 2)
+				set_range(block, c.values[r], c.values[r] + c.values[r + 1]);
+			break;
+		default:
+			copy(c.bits.begin(), c.bits.end(), block);
+		}
+	}
+
+	ROARING_BITMAP::ROARING_BITMAP(const EVENT_BITSET & mask):nBits(mask.size()),card(0){
+		unsigned nWords = mask.n_words();
+		for(unsigned key = 0; key * BLOCK_WORDS < nWords; key++)
+			push_block(key, mask.data() + key * BLOCK_WORDS);
+	}
+	EVENT_BITSET ROARING_BITMAP::to_mask() const{
+		EVENT_BITSET res(nBits);
+		for(const auto & c : containers)
+			expand(c, res.data() + c.key * BLOCK_WORDS);
+		return res;
+	}
+	vector<unsigned> ROARING_BITMAP::to_indices() const{
+		vector<unsigned> res;
+		res.reserve(card);
+		for(const auto & c : containers)
+		{
+			unsigned base = c.key * BLOCK_BITS;
+			switch(c.type)
+			{
+			case ARRAY:
+				for(auto v : c.values)
+					res.push_back(base + v);
+				break;
+			case RUN:
+				for(size_t r = 0; r < c.values.size(); r += 2)
+					for(unsigned i = 0; i <= c.values[r + 1]; i++)
+						res.push_back(base + c.values[r] + i);
+				break;
+			default:
+				for(unsigned k = 0; k < c.bits.size(); k++)
+					for(MASK_WORD w = c.bits[k]; w; w &= w - 1)
+						res.push_back(base + k * WORD_BITS + ctz64(w));
+			}
+		}
+		return res;
+	}
+	ROARING_BITMAP & ROARING_BITMAP::operator&=(const ROARING_BITMAP & other){
+		if(nBits != other.nBits)
+			throw(domain_error("the sizes of the event masks do not match!"));
+		ROARING_BITMAP res;
+		res.nBits = nBits;
+		vector<MASK_WORD> a(BLOCK_WORDS), b(BLOCK_WORDS);
+		auto i = containers.cbegin(), j = other.containers.cbegin();
+		while(i != containers.end() && j != other.containers.end())
+		{
+			if(i->key < j->key)
+				i++;
+			else if(j->key < i->key)
+				j++;
+			else
+			{
+				if(i->type == ARRAY || j->type == ARRAY)
+				{
+					//filter the array by the other container
+					const CONTAINER & arr = i->type == ARRAY ? *i : *j;
+					const CONTAINER & c = i->type == ARRAY ? *j : *i;
+					CONTAINER ct;
+					ct.key = arr.key;
+					ct.type = ARRAY;
+					for(auto v : arr.values)
+						if(contains(c, v))
+							ct.values.push_back(v);
+					ct.card = ct.values.size();
+					if(ct.card)
+					{
+						res.card += ct.card;
+						res.containers.push_back(std::move(ct));
+					}
+				}
+				else
+				{
+					unsigned nw = block_words(i->key);
+					expand(*i, a.data());
+					expand(*j, b.data());
+					for(unsigned k = 0; k < nw; k++)
+						a[k] &= b[k];
+					res.push_block(i->key, a.data());
+				}
+				i++;
+				j++;
+			}
+		}
+		*this = std::move(res);
+		return *this;
+	}
+	ROARING_BITMAP & ROARING_BITMAP::operator|=(const ROARING_BITMAP & other){
+		if(nBits != other.nBits)
+			throw(domain_error("the sizes of the event masks do not match!"));
+		ROARING_BITMAP res;
+		res.nBits = nBits;
+		vector<MASK_WORD> a(BLOCK_WORDS), b(BLOCK_WORDS);
+		auto i = containers.cbegin(), j = other.containers.cbegin();
+		while(i != containers.end() || j != other.containers.end())
+		{
+			if(j == other.containers.end() || (i != containers.end() && i->key < j->key))
+			{
+				res.card += i->card;
+				res.containers.push_back(*i++);
+			}
+			else if(i == containers.end() || j->key < i->key)
+			{
+				res.card += j->card;
+				res.containers.push_back(*j++);
+			}
+			else
+			{
+				unsigned nw = block_words(i->key);
+				expand(*i, a.data());
+				expand(*j, b.data());
+				for(unsigned k = 0; k < nw; k++)
+					a[k] |= b[k];
+				res.push_block(i->key, a.data());
+				i++;
+				j++;
+			}
+		}
+		*this = std::move(res);
+		return *this;
+	}
+
+	void ROARING_BITMAP::serialize(string & bytes) const{
+		bytes.clear();
+		bytes.push_back(1);//version
+		auto put16 = [&bytes](unsigned v){
+			bytes.push_back(char(v & 0xff));
+			bytes.push_back(char(v >> 8));
+		};
+		for(const auto & c : containers)
+		{
+			put16(c.key);
+			bytes.push_back(char(c.type));
+			switch(c.type)
+			{
+			case ARRAY:
+				put16(c.card - 1);
+				for(auto v : c.values)
+					put16(v);
+				break;
+			case RUN:
+				put16(c.values.size() / 2 - 1);
+				for(auto v : c.values)
+					put16(v);
+				break;
+			default:
+				for(auto w : c.bits)
+					for(unsigned k = 0; k < 8; k++)
+						bytes.push_back(char((w >> (8 * k)) & 0xff));
+			}
+		}
+	}
+	ROARING_BITMAP::ROARING_BITMAP(const string & bytes, unsigned n):nBits(n),card(0){
+		if(bytes.empty() || bytes[0] != 1)
+			throw(domain_error("unknown format of the compressed event indices!"));
+		size_t pos = 1;
+		auto get16 = [&bytes, &pos]()->unsigned{
+			if(pos + 2 > bytes.size())
+				throw(domain_error("truncated compressed event indices!"));
+			unsigned v = (unsigned char)bytes[pos] | ((unsigned char)bytes[pos + 1] << 8);
+			pos += 2;
+			return v;
+		};
+		unsigned nBlocks = (nBits + BLOCK_BITS - 1) / BLOCK_BITS;
+		while(pos < bytes.size())
+		{
+			CONTAINER c;
+			c.key = get16();
+			if(c.key >= nBlocks || (containers.size() && c.key <= containers.back().key) || pos >= bytes.size())
+				throw(domain_error("invalid compressed event indices!"));
+			c.type = bytes[pos++];
+			unsigned block_bits = nBits - c.key * BLOCK_BITS;//may exceed BLOCK_BITS, which is fine as the offsets are 16-bit
+			switch(c.type)
+			{
+			case ARRAY:
+			{
+				unsigned len = get16() + 1;
+				c.values.resize(len);
+				for(auto & v : c.values)
+					v = get16();
+				if(!is_sorted(c.values.begin(), c.values.end()) || c.values.back() >= block_bits)
+					throw(domain_error("invalid compressed event indices!"));
+				c.card = len;
+				break;
+			}
+			case RUN:
+			{
+				unsigned nRuns = get16() + 1;
+				c.values.resize(2 * nRuns);
+				c.card = 0;
+				unsigned next = 0;
+				for(unsigned r = 0; r < nRuns; r++)
+				{
+					unsigned s = c.values[2 * r] = get16();
+					unsigned l = c.values[2 * r + 1] = get16();
+					if(s < next || s + l >= block_bits)
+						throw(domain_error("invalid compressed event indices!"));
+					next = s + l + 1;
+					c.card += l + 1;
+				}
+				break;
+			}
+			case BITMAP:
+			{
+				unsigned nw = block_words(c.key);
+				if(pos + 8 * size_t(nw) > bytes.size())
+					throw(domain_error("truncated compressed event indices!"));
+				c.bits.resize(nw);
+				for(auto & w : c.bits)
+				{
+					w = 0;
+					for(unsigned k = 0; k < 8; k++)
+						w |= MASK_WORD((unsigned char)bytes[pos++]) << (8 * k);
+				}
+				//drop any stray bits beyond nBits
+				unsigned r = nBits % WORD_BITS;
+				if(c.key == nBlocks - 1 && r)
+					c.bits.back() &= (MASK_WORD(1) << r) - 1;
+				c.card = 0;
+				for(auto w : c.bits)
+					c.card += popcount64(w);
+				break;
+			}
+			default:
+				throw(domain_error("invalid compressed event indices!"));
+			}
+			card += c.card;
+			containers.push_back(std::move(c));
+		}
+	}
+};
@@ -210,7 +210,10 @@ void natural_spline(vector<double>x, vector<double> y, vector<double>& b,vector<
 
 }
 
-void spline_eval(int method, double* u,int nSize,
+/*
+ * the events are evaluated in place in their own precision while the coefficients stay in double
+ */
+template<typename T> void spline_eval_t(int method, T* u,int nSize,
 		  const vector<double> & x, const vector<double> & y, const vector<double> & b, const vector<double> & c, const vector<double> & d)
 {
 /* Evaluate  v[l] := spline(u[l], ...),	    l = 1,..,nu, i.e. 0:(nu-1)
@@ -220,7 +223,7 @@ void spline_eval(int method, double* u,int nSize,
 
 	int n=x.size();
 	int nu=nSize;
-	double * v = u;//new double[nSize];
+	T * v = u;//new double[nSize];
     const int n_1 = n - 1;
     int i, j, k, l;
     double ul, dx, tmp;
@@ -265,4 +268,14 @@ void spline_eval(int method, double* u,int nSize,
 //    memcpy(u, v, sizeof(double)*nSize);
 //    delete v;
 }
+void spline_eval(int method, double* u,int nSize,
+		  const vector<double> & x, const vector<double> & y, const vector<double> & b, const vector<double> & c, const vector<double> & d)
+{
+	spline_eval_t(method, u, nSize, x, y, b, c, d);
+}
+void spline_eval(int method, float* u,int nSize,
+		  const vector<double> & x, const vector<double> & y, const vector<double> & b, const vector<double> & c, const vector<double> & d)
+{
+	spline_eval_t(method, u, nSize, x, y, b, c, d);
+}
 };